@@ -0,0 +1,80 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_vector_bench.h
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Shared declarations for the jpVector microbenchmarks
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JPA__VECTOR_BENCH_H
+#define JPA__VECTOR_BENCH_H
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Operations measured by the benchmarks
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpBenchOp {
+    JP_BENCH_PUSHEMPTY,     ///< Push n elements into an empty container
+    JP_BENCH_PUSHRESERVED,  ///< Push n elements after reserving n
+    JP_BENCH_ATSEQUENTIAL,  ///< Read n elements in order
+    JP_BENCH_ATRANDOM,      ///< Read n elements in random order
+    JP_BENCH_ERASEHEAD,     ///< Erase the first element until empty
+    JP_BENCH_ERASEMIDDLE,   ///< Erase the middle element until empty
+    JP_BENCH_ERASETAIL,     ///< Erase the last element until empty
+    JP_BENCH_OPCOUNT
+} jpBenchOp;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Result of a single benchmark run
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpBenchResult {
+    double nsPerOp;         ///< Average time per operation
+    size_t reallocs;        ///< Number of times the storage was resized
+    size_t allocated;       ///< Bytes allocated for elements after pushing
+} jpBenchResult;
+
+///////////////////////////////////////////////////////////////////////////////
+// Functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the current time in nanoseconds
+///
+/// @return	Nanoseconds since an arbitrary point
+///////////////////////////////////////////////////////////////////////////////
+double jpBench_now(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the next index of a pseudorandom sequence
+///
+/// @param	state   State of the sequence - must not be 0
+/// @param	n       Upper bound (exclusive) of the index
+/// @return	The index
+///////////////////////////////////////////////////////////////////////////////
+size_t jpBench_random(unsigned long long *state, size_t n);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Runs a benchmark against std::vector
+///
+/// @param	op          The operation to measure
+/// @param	elemSize    Size of the elements (1, 8, 64 or 256)
+/// @param	n           Number of operations
+/// @return	The result of the run
+///////////////////////////////////////////////////////////////////////////////
+jpBenchResult jpBench_std(jpBenchOp op, size_t elemSize, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+// JPA__VECTOR_BENCH_H
+#endif
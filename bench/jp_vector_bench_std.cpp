@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_vector_bench_std.cpp
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	std::vector side of the jpVector microbenchmarks
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_vector_bench.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Element of a particular size
+///////////////////////////////////////////////////////////////////////////////
+template <size_t Size>
+struct jpBenchElem {
+    unsigned char bytes[Size];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Keeps the compiler from discarding the reads being measured
+///////////////////////////////////////////////////////////////////////////////
+static volatile unsigned char jpBench__sink;
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Pushes n elements
+///
+/// @param	vec     The std::vector
+/// @param	n       Number of elements to push
+///////////////////////////////////////////////////////////////////////////////
+template <size_t Size>
+static void jpBench__push(std::vector<jpBenchElem<Size> > &vec, size_t n)
+{
+    jpBenchElem<Size> elem = {{0}};
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        elem.bytes[0] = (unsigned char)i;
+        vec.push_back(elem);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Counts the reallocations std::vector makes pushing n elements
+///
+/// Repeats a push run on a vector of its own, outside of the timed region.
+///
+/// @param	n       Number of elements to push
+/// @param	reserve Whether to reserve n elements first
+/// @param	result  Receives the reallocation counts
+///////////////////////////////////////////////////////////////////////////////
+template <size_t Size>
+static void jpBench__count(size_t n, bool reserve, jpBenchResult *result)
+{
+    std::vector<jpBenchElem<Size> > vec;
+    jpBenchElem<Size> elem = {{0}};
+    size_t i;
+
+    if (reserve) {
+        vec.reserve(n);
+        result->reallocs += vec.capacity() != 0;
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (vec.size() == vec.capacity()) {
+            result->reallocs++;
+        }
+
+        vec.push_back(elem);
+    }
+
+    result->allocated = vec.capacity() * Size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Runs a benchmark for a particular element size
+///
+/// @param	op  The operation to measure
+/// @param	n   Number of operations
+/// @return	The result of the run
+///////////////////////////////////////////////////////////////////////////////
+template <size_t Size>
+static jpBenchResult jpBench__run(jpBenchOp op, size_t n)
+{
+    std::vector<jpBenchElem<Size> > vec;
+    jpBenchResult result = {0.0, 0, 0};
+    unsigned long long state = 88172645463325252ULL;
+    unsigned char sum = 0;
+    double start = 0.0;
+    size_t i;
+
+    switch (op) {
+    case JP_BENCH_PUSHEMPTY:
+        start = jpBench_now();
+        jpBench__push(vec, n);
+        break;
+    case JP_BENCH_PUSHRESERVED:
+        start = jpBench_now();
+        vec.reserve(n);
+        jpBench__push(vec, n);
+        break;
+    case JP_BENCH_ATSEQUENTIAL:
+        jpBench__push(vec, n);
+        start = jpBench_now();
+        for (i = 0; i < n; ++i) {
+            sum += vec[i].bytes[0];
+        }
+        break;
+    case JP_BENCH_ATRANDOM:
+        jpBench__push(vec, n);
+        start = jpBench_now();
+        for (i = 0; i < n; ++i) {
+            sum += vec[jpBench_random(&state, n)].bytes[0];
+        }
+        break;
+    case JP_BENCH_ERASEHEAD:
+        jpBench__push(vec, n);
+        start = jpBench_now();
+        while (!vec.empty()) {
+            vec.erase(vec.begin());
+        }
+        break;
+    case JP_BENCH_ERASEMIDDLE:
+        jpBench__push(vec, n);
+        start = jpBench_now();
+        while (!vec.empty()) {
+            vec.erase(vec.begin() + vec.size() / 2);
+        }
+        break;
+    case JP_BENCH_ERASETAIL:
+        jpBench__push(vec, n);
+        start = jpBench_now();
+        while (!vec.empty()) {
+            vec.erase(vec.end() - 1);
+        }
+        break;
+    default:
+        break;
+    }
+
+    result.nsPerOp = (jpBench_now() - start) / (double)n;
+    jpBench__sink = sum;
+
+    if (op == JP_BENCH_PUSHEMPTY || op == JP_BENCH_PUSHRESERVED) {
+        vec = std::vector<jpBenchElem<Size> >();
+        jpBench__count<Size>(n, op == JP_BENCH_PUSHRESERVED, &result);
+    }
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+jpBenchResult jpBench_std(jpBenchOp op, size_t elemSize, size_t n)
+{
+    switch (elemSize) {
+    case 1:
+        return jpBench__run<1>(op, n);
+    case 8:
+        return jpBench__run<8>(op, n);
+    case 64:
+        return jpBench__run<64>(op, n);
+    default:
+        return jpBench__run<256>(op, n);
+    }
+}
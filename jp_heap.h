@@ -0,0 +1,245 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_heap.h
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Generic binary (or d-ary) heap on top of jpVector in C99
+///
+/// A jpHeap keeps its elements in a jpVector, ordered so that the first
+/// element is the one that comes before all the others. The order is given by
+/// a comparison passed to each macro that reorders the heap: a function-like
+/// macro or function taking two elements and returning nonzero if the first
+/// must come out before the second, e.g.
+///
+///     #define byDeadline(a,b) ( (a).deadline < (b).deadline )
+///
+///     jpHeap(struct task) tasks;
+///     jpHeap_create(tasks);
+///     jpHeap_push(tasks, task, byDeadline);
+///     jpHeap_pop(tasks, next, byDeadline);
+///
+/// The comparison is expanded in place, so it is inlined rather than called
+/// through a function pointer. It must be the same for every call on a heap.
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JPA__HEAP_H
+#define JPA__HEAP_H
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_vector.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Macros
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of children of each element in a jpHeap - cannot be < 2
+///
+/// Defaults to a binary heap. Define it as 4 before including this header for
+/// a shallower heap whose children share cache lines, which usually makes pop
+/// faster for small elements at the cost of more comparisons per level.
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_HEAP_ARITY
+#define JP_HEAP_ARITY           (2)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Declare a new jpHeap
+///
+/// @param type Data type of the jpHeap's elements
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap(type)\
+    struct {\
+        jpVector(type) vec;\
+        type tmp;\
+    }
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Initializes a jpHeap
+///
+/// This must be called on a newly declared jpHeap before anything else,
+/// unless it is initialized with jpHeap_fromVector.
+///
+/// @param heap The jpHeap
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_create(heap)     jpVector_create((heap).vec)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Frees the memory allocated for a jpHeap
+///
+/// @param heap The jpHeap
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_destroy(heap)    jpVector_destroy((heap).vec)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns the number of elements in a jpHeap
+///
+/// @param heap The jpHeap
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_length(heap)     jpVector_length((heap).vec)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns the jpHeap element at a particular index
+///
+/// Elements are in heap order, not sorted. Used to find the index of an
+/// element for jpHeap_decreaseKey.
+///
+/// @param heap     The jpHeap
+/// @param index    Index of the element
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_at(heap,index)   jpVector_at((heap).vec, index)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns the first element of a non-empty jpHeap without removing it
+///
+/// @param heap The jpHeap
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_peek(heap)       jpVector_at((heap).vec, 0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Moves an element towards the front of a jpHeap until it is in order
+///
+/// Called internally by jpHeap macros.
+///
+/// @param heap     The jpHeap
+/// @param start    Index of the element
+/// @param cmp      The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap__siftUp(heap,start,cmp)\
+    do {\
+        size_t jpHeap__i = (start);\
+        size_t jpHeap__parent;\
+        \
+        (heap).tmp = (heap).vec.data[jpHeap__i];\
+        while (jpHeap__i > 0) {\
+            jpHeap__parent = (jpHeap__i - 1) / JP_HEAP_ARITY;\
+            if (!cmp((heap).tmp, (heap).vec.data[jpHeap__parent])) {\
+                break;\
+            }\
+            (heap).vec.data[jpHeap__i] = (heap).vec.data[jpHeap__parent];\
+            jpHeap__i = jpHeap__parent;\
+        }\
+        (heap).vec.data[jpHeap__i] = (heap).tmp;\
+    } while (0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Moves an element towards the back of a jpHeap until it is in order
+///
+/// Called internally by jpHeap macros.
+///
+/// @param heap     The jpHeap
+/// @param start    Index of the element
+/// @param cmp      The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap__siftDown(heap,start,cmp)\
+    do {\
+        size_t jpHeap__i = (start);\
+        size_t jpHeap__child;\
+        size_t jpHeap__best;\
+        size_t jpHeap__end;\
+        \
+        (heap).tmp = (heap).vec.data[jpHeap__i];\
+        for (;;) {\
+            jpHeap__child = jpHeap__i * JP_HEAP_ARITY + 1;\
+            if (jpHeap__child >= (heap).vec.length) {\
+                break;\
+            }\
+            jpHeap__end = jpHeap__child + JP_HEAP_ARITY;\
+            if (jpHeap__end > (heap).vec.length) {\
+                jpHeap__end = (heap).vec.length;\
+            }\
+            for (jpHeap__best = jpHeap__child++; jpHeap__child < jpHeap__end;\
+                    ++jpHeap__child) {\
+                if (cmp((heap).vec.data[jpHeap__child],\
+                            (heap).vec.data[jpHeap__best])) {\
+                    jpHeap__best = jpHeap__child;\
+                }\
+            }\
+            if (!cmp((heap).vec.data[jpHeap__best], (heap).tmp)) {\
+                break;\
+            }\
+            (heap).vec.data[jpHeap__i] = (heap).vec.data[jpHeap__best];\
+            jpHeap__i = jpHeap__best;\
+        }\
+        (heap).vec.data[jpHeap__i] = (heap).tmp;\
+    } while (0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Pushes a value into a jpHeap
+///
+/// @param heap     The jpHeap
+/// @param value    The value to push
+/// @param cmp      The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_push(heap,value,cmp)\
+    do {\
+        jpVector_push((heap).vec, value);\
+        jpHeap__siftUp(heap, (heap).vec.length - 1, cmp);\
+    } while (0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Removes the first element of a non-empty jpHeap
+///
+/// @param heap     The jpHeap
+/// @param out      Lvalue that receives the removed element
+/// @param cmp      The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_pop(heap,out,cmp)\
+    do {\
+        (out) = (heap).vec.data[0];\
+        (heap).tmp = jpVector_pop((heap).vec);\
+        if ((heap).vec.length) {\
+            (heap).vec.data[0] = (heap).tmp;\
+            jpHeap__siftDown(heap, 0, cmp);\
+        }\
+    } while (0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Replaces an element of a jpHeap with one that comes before it
+///
+/// The index can be found with jpHeap_at. The new value must not come after
+/// the element it replaces, otherwise the heap is left out of order.
+///
+/// @param heap     The jpHeap
+/// @param index    Index of the element
+/// @param value    The new value
+/// @param cmp      The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_decreaseKey(heap,index,value,cmp)\
+    do {\
+        size_t jpHeap__index = (index);\
+        \
+        (heap).vec.data[jpHeap__index] = (value);\
+        jpHeap__siftUp(heap, jpHeap__index, cmp);\
+    } while (0)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Initializes a jpHeap with the elements of a jpVector in O(n)
+///
+/// The jpHeap takes over the jpVector's storage instead of copying it, and
+/// the jpVector is left without data (as after jpVector_destroy). Use this
+/// instead of jpHeap_create. The jpVector must not be mapped.
+///
+/// @param heap The jpHeap
+/// @param vec  The jpVector, with the same element type as the jpHeap
+/// @param cmp  The comparison
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeap_fromVector(heap,vec,cmp)\
+    do {\
+        size_t jpHeap__parent;\
+        \
+        (heap).vec.data = (vec).data;\
+        (heap).vec.max = (vec).max;\
+        (heap).vec.length = (vec).length;\
+        (vec).data = NULL;\
+        (vec).max = 0;\
+        (vec).length = 0;\
+        \
+        jpHeap__parent = (heap).vec.length > 1 ?\
+            ((heap).vec.length - 2) / JP_HEAP_ARITY + 1 : 0;\
+        while (jpHeap__parent-- > 0) {\
+            jpHeap__siftDown(heap, jpHeap__parent, cmp);\
+        }\
+    } while (0)
+
+// JPA__HEAP_H
+#endif
@@ -1,46 +1,7186 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_log.h
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	API for logging information and possibly halting execution
+///////////////////////////////////////////////////////////////////////////////
+#define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _GNU_SOURCE             // sched_getcpu, syscall and O_DIRECT
+#endif
+
+#include "jp_log.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Defined if file sinks can write through io_uring - define
+/// JP_LOG_NOURING to build without <linux/io_uring.h>
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__linux__) && defined(__NR_io_uring_setup)\
+    && !defined(JP_LOG_NOURING)
+#include <linux/io_uring.h>
+#define JP_LOG_URING
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Defined if jp_log can patch the call sites of JP_LOG_KEYS builds
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__ELF__)
+#define JP_LOG_PATCHKEYS
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Defines
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Maximum number of sinks
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_MAXSINKS
+#define JP_LOG_MAXSINKS         (8)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Maximum length of a formatted message - longer ones are truncated
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_MSGMAX
+#define JP_LOG_MSGMAX           (2048)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Maximum length of a line of output, including the message
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_LINEMAX
+#define JP_LOG_LINEMAX          (JP_LOG_MSGMAX + 1024)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Default number of bytes queued for an async sink
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_QUEUESIZE
+#define JP_LOG_QUEUESIZE        (64 * 1024)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Milliseconds an idle async sink waits before flushing, e.g. writing
+/// out a partial compressed block
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_FLUSHMS
+#define JP_LOG_FLUSHMS          (1000)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Default bytes of output per compressed block
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_BLOCKSIZE
+#define JP_LOG_BLOCKSIZE        (64 * 1024)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Largest supported compressed block - offsets are 16 bits anyway
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_BLOCKMAX         (16 * 1024 * 1024)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Identifies a compressed file written by a file sink
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_FILEMAGIC        "jpLogLZ1"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Size of the header preceding each compressed block
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_BLOCKHEADER      (12)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Identifies a compressed file with an index, written by a file sink
+/// with index set
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_INDEXMAGIC       "jpLogIX1"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bits in the bloom filter of call sites in each indexed block
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_BLOOMBITS        (1024)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Size of the header preceding each indexed block, with its index
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_INDEXHEADER      (JP_LOG_BLOCKHEADER + 24 + JP_LOG_BLOOMBITS / 8)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes preceding each line in an indexed block: its time, file
+/// hash, line number, length and level
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_ENTRYHEADER      (24)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes preceding each line queued for an indexed file sink: a
+/// marker and the entry header in hex, which never contains a newline
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_TAGSIZE          (1 + 16 + 8 + 8 + 8 + 1)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief First byte of the tag of a line queued for an indexed file sink
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_TAGMARK          '\x1e'
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Identifies a compressed file with a dictionary of format strings,
+/// written by a file sink with dictionary set
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTMAGIC        "jpLogDC1"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes preceding each entry of a dictionary block: its number and
+/// length
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTHEADER       (8)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Set in the number of a dictionary block entry that defines a call
+/// site and format string
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTDEFINE       (0x80000000U)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of a dictionary block entry that holds a whole line,
+/// without its newline
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTTEXT         (0xFFFFFFFFU)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Most bytes of file name, function name and format string in a
+/// definition - messages past it are kept whole
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTMAX          (1024)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Most definitions in use in a dictionary file at once - the ids
+/// then start over
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_DICTSIZE
+#define JP_LOG_DICTSIZE         (4096)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes preceding each message queued for a dictionary file sink: a
+/// marker, then its level, line and the lengths of its file name, function
+/// name, format string and arguments in hex
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DICTTAGSIZE      (1 + 1 + 8 + 4 + 4 + 4 + 8)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Room for a time written before a line by jpLog_queryFile
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_TIMESIZE         (64)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of entries in the compressor's hash table (a power of two)
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_HASHBITS         (12)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes preceding each line queued in a shard: its time and length
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_SHARDHEADER      (16)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes in each write buffer of a file sink using io_uring or
+/// O_DIRECT (a multiple of JP_LOG_DIRECTALIGN)
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_WRITEBUFSIZE
+#define JP_LOG_WRITEBUFSIZE     (64 * 1024)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of write buffers of a file sink using io_uring or O_DIRECT,
+/// i.e. the most writes in flight at once
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_WRITEBUFS        (4)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Alignment of O_DIRECT buffers, offsets and lengths
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_DIRECTALIGN      (4096)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Longest path of a rotated file, including its archive suffix
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_PATHMAX          (4096)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes of each message kept by the flight recorder
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_RECORDERMSG
+#define JP_LOG_RECORDERMSG      (128)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Most conversions in a format string handled without vsnprintf
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_MAXSPECS
+#define JP_LOG_MAXSPECS         (16)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of entries in the format string cache (a power of two)
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_FORMATBITS       (7)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Entries of the format string cache tried before giving up on it
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_FORMATPROBES     (4)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of jpLog_timeBlock call sites (a power of two)
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_TIMERBITS        (6)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Entries of the timer table tried before giving up on a call site
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_TIMERPROBES      (8)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Magic number at the start of a level control file
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_CONTROLMAGIC     "jpLogCL1"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Most file and call site rules in a level control file
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_CONTROLRULES     (64)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Longest base name of a file in a level control rule, including
+/// the terminating null
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_CONTROLFILE      (48)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Milliseconds between checks of the level control file for changes
+/// made by other processes
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_CONTROLMS
+#define JP_LOG_CONTROLMS        (100)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Buckets of a latency histogram per power of two, as a power of two
+///
+/// With 8 buckets per power of two, a percentile is at most 12.5% above the
+/// true value.
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_SUBBITS          (3)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Buckets of a latency histogram, enough for any 64-bit time
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_BUCKETS          ((64 - JP_LOG_SUBBITS + 1) << JP_LOG_SUBBITS)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bytes of a thread name kept by jpLog_setThreadName
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_NAMEMAX
+#define JP_LOG_NAMEMAX          (32)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Open spans of a thread whose start is kept for dur_ns - deeper
+/// spans end without it
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_LOG_SPANDEPTH
+#define JP_LOG_SPANDEPTH        (64)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Storage class of thread-local variables
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define JP_LOG_THREADLOCAL      _Thread_local
+#else
+#define JP_LOG_THREADLOCAL      __thread
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Marks the calling thread as inside a logging call, for the
+/// allocator checks of JP_LOG_DEBUGALLOC
+///////////////////////////////////////////////////////////////////////////////
+#ifdef JP_LOG_DEBUGALLOC
+#define JP_LOG_ENTER()          ((void)++jpLog__inCall)
+#define JP_LOG_LEAVE()          ((void)--jpLog__inCall)
+#else
+#define JP_LOG_ENTER()          ((void)0)
+#define JP_LOG_LEAVE()          ((void)0)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL            (0)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Reads a variable shared between threads
+///
+/// @param ptr  Pointer to the variable
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define jpLog__load(ptr)        __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#else
+#define jpLog__load(ptr)        ( *(ptr) )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Writes a variable shared between threads
+///
+/// @param ptr      Pointer to the variable
+/// @param value    The new value
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define jpLog__store(ptr,value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#else
+#define jpLog__store(ptr,value) ( *(ptr) = (value) )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Adds to a counter that only the calling thread writes, but other
+/// threads read
+///
+/// @param ptr      Pointer to the counter
+/// @param value    Amount to add
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define jpLog__add(ptr,value)\
+    __atomic_store_n(ptr, *(ptr) + (value), __ATOMIC_RELAXED)
+#else
+#define jpLog__add(ptr,value)   ( *(ptr) += (value) )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Like jpLog__store and jpLog__load, but never reordered with each
+/// other, for a thread that publishes something and then checks whether to
+/// wake another
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define jpLog__storeSeq(ptr,value)\
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+#define jpLog__loadSeq(ptr)     __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#else
+#define jpLog__storeSeq(ptr,value)  ( *(ptr) = (value) )
+#define jpLog__loadSeq(ptr)     ( *(ptr) )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A thread's queue for a sharded async sink
+///
+/// Only the thread that owns the shard writes tail and the counters, and only
+/// the sink's thread writes head, so producers never share a cache line with
+/// each other. Each line is queued after JP_LOG_SHARDHEADER bytes holding
+/// its time and length. head and tail only grow, positions in data are taken
+/// modulo its size. Shards live as long as their sink; the thread counters
+/// that point to them are reused by new threads along with them.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogShard {
+    struct jpLogShard *next;
+    int owned;                      ///< Zero while left by jpLog_preallocate
+    char *data;
+    size_t head;
+    size_t limit;                   ///< tail when the sink's thread looked
+    unsigned long long time;        ///< Time of the line at head
+    char padding[64];
+    size_t tail;
+    unsigned long long dropped;
+    unsigned long long spilled;
+    unsigned long long blockedNs;
+} jpLogShard;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A destination for log output
+///
+/// Async sinks queue formatted lines in a byte ring that their thread writes
+/// out. The thread moves everything queued to batch and writes it without
+/// holding the lock, so producers can refill the whole ring meanwhile and an
+/// overflowing ring only ever holds lines that are not being written.
+///////////////////////////////////////////////////////////////////////////////
+struct jpLogSink {
+    jpLogSinkConfig config;
+    jpLogSinkStats stats;
+    unsigned long long id;
+    jpLogShard *shards;
+    int sleeping;
+    jpLogWriteFn write;
+    jpLogCloseFn flush;
+    jpLogCloseFn close;
+    void *data;
+    int indexed;                    ///< Lines are queued after a tag
+    int dictionary;                 ///< Messages are queued split, after
+                                    ///< a tag, instead of lines
+    int spillFd;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    pthread_cond_t drained;
+    pthread_t thread;
+    char *queue;
+    char *batch;
+    size_t head;
+    size_t length;
+    int writing;
+    int flushing;
+    int stopping;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief An io_uring set up without liburing, with the write buffers of a
+/// file sink registered
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogUring jpLogUring;
+
+#ifdef JP_LOG_URING
+struct jpLogUring {
+    int fd;
+    void *sq;
+    void *cq;
+    struct io_uring_sqe *sqes;
+    size_t sqSize;
+    size_t cqSize;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Index of a block of an indexed file, as stored in its header
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogBlockIndex {
+    uint32_t lines;
+    unsigned levels;
+    unsigned long long minTime;
+    unsigned long long maxTime;
+    unsigned char bloom[JP_LOG_BLOOMBITS / 8];
+} jpLogBlockIndex;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A line of an indexed block, as read back
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogEntry {
+    unsigned long long time;
+    uint32_t fileHash;
+    uint32_t line;
+    jpLogLevel level;
+    const char *text;
+    size_t length;
+} jpLogEntry;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A definition written to a dictionary file, keyed by its bytes
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogDictSlot {
+    unsigned char *data;    ///< The definition, NULL if the slot is free
+    size_t length;
+    uint32_t hash;
+    uint32_t id;
+} jpLogDictSlot;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Data of a file sink
+///
+/// A compressing file sink collects output in block until it is full or the
+/// sink is flushed, then writes it compressed as one block:
+///
+///     uint32 rawSize, uint32 storedSize, uint32 checksum, data
+///
+/// in little-endian byte order, after JP_LOG_FILEMAGIC at the start of the
+/// file. The data is an LZ4 block, or the raw output if storedSize equals
+/// rawSize. The checksum is the FNV-1a hash of the raw output. Blocks do not
+/// refer to each other, so a truncated file can be read up to its last
+/// complete block.
+///
+/// An indexed file starts with JP_LOG_INDEXMAGIC instead, and each block
+/// header goes on with an index of the block:
+///
+///     uint32 lines, uint32 levels, uint64 minTime, uint64 maxTime,
+///     bloom[JP_LOG_BLOOMBITS / 8]
+///
+/// where levels has bit 1 << level set for each level in the block, the
+/// times are CLOCK_REALTIME nanoseconds and bloom has the bits of the file
+/// and call site of each line set. The raw output is then a sequence of
+///
+///     uint64 time, uint32 fileHash, uint32 line, uint32 length,
+///     uint32 level, length bytes of text
+///
+/// and a line never spans two blocks. Producers queue each line after a
+/// JP_LOG_TAGSIZE tag holding the same header, which the sink's thread
+/// turns back into binary.
+///
+/// A dictionary file starts with JP_LOG_DICTMAGIC instead, and its raw
+/// output is a sequence of entries that never span two blocks:
+///
+///     uint32 id, uint32 length, length bytes
+///
+/// The first time a call site logs with a format string, an entry with
+/// JP_LOG_DICTDEFINE set in its id defines id & ~JP_LOG_DICTDEFINE as
+///
+///     uint32 level, uint32 line, file, '\0', func, '\0', format string
+///
+/// and each line logged is then an entry with that id holding the text of
+/// each argument followed by '\0', then the rest of the line (fields and
+/// thread details) without its newline. Ids start from 0 in each file, and
+/// a later definition of an id replaces the earlier one, so a file can be
+/// appended to by another run, and the ids start over once JP_LOG_DICTSIZE
+/// are defined. An entry with id JP_LOG_DICTTEXT holds a whole line instead,
+/// for call sites whose names do not fit in JP_LOG_DICTMAX bytes. Producers
+/// queue each message after a JP_LOG_DICTTAGSIZE tag, followed by the file
+/// and function names, the format string and the arguments, and the sink's
+/// thread looks the definition up in definitions.
+///
+/// A file sink using io_uring or O_DIRECT fills JP_LOG_WRITEBUFS buffers in
+/// turn and writes each one at its own offset once it is full or the sink is
+/// flushed. pending holds the length of the write in flight from each
+/// buffer, 0 if the buffer is free.
+///
+/// A rotating file sink renames its file to path.1 (after moving path.1 to
+/// path.2 and so on) from the sink's thread, and leaves compression and
+/// retention of the archives to a thread of its own, joined before the next
+/// rotation.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogFile {
+    int fd;
+    int index;
+    int dictionary;
+    jpLogDictSlot *definitions;
+    uint32_t definitionCount;
+    jpLogBlockIndex blockIndex;
+    unsigned char *block;
+    unsigned char *packed;
+    uint32_t *table;
+    size_t blockSize;
+    size_t length;
+    char *buffers;
+    jpLogUring *uring;
+    int direct;
+    size_t current;
+    size_t used;
+    off_t offset;
+    off_t offsets[JP_LOG_WRITEBUFS];
+    size_t pending[JP_LOG_WRITEBUFS];
+    char *path;
+    unsigned long long written;
+    unsigned long long rotateBytes;
+    unsigned rotateSeconds;
+    time_t rotateAt;
+    unsigned keepFiles;
+    unsigned long long keepBytes;
+    int compressRotated;
+    int archiving;
+    pthread_t archiver;
+} jpLogFile;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Data of a ring sink
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogRing {
+    pthread_mutex_t lock;
+    char *data;
+    size_t size;
+    size_t head;
+    size_t length;
+    int overwritten;
+} jpLogRing;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Data of a socket sink
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSocket {
+    struct sockaddr_un addr;
+    int fd;
+} jpLogSocket;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A message kept by the flight recorder
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogRecorderEntry {
+    struct timespec time;
+    const char *file;
+    const char *func;
+    int line;
+    jpLogLevel level;
+    size_t length;
+    char msg[JP_LOG_RECORDERMSG];
+} jpLogRecorderEntry;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The flight recorder ring of a thread
+///
+/// Rings are never freed. When a thread exits, its ring is kept (so it is
+/// still dumped) until a new thread reuses it.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogRecorder {
+    struct jpLogRecorder *next;
+    size_t thread;      ///< Number of the thread, in order of first use
+    size_t count;       ///< Number of entries ever written
+    int inUse;          ///< Nonzero while a thread owns the ring
+    jpLogRecorderEntry entries[];
+} jpLogRecorder;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The times one thread spent in a jpLog_timeBlock call site, in
+/// buckets of nanoseconds - only that thread writes it
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogHistogram {
+    struct jpLogHistogram *next;
+    unsigned long long max;
+    unsigned long long buckets[JP_LOG_BUCKETS];
+} jpLogHistogram;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A jpLog_timeBlock call site, keyed by file, line and name
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogTimer {
+    int state;              ///< 0 if free, 1 while being filled, 2 if ready
+    const char *name;
+    const char *file;
+    const char *func;
+    int line;
+    jpLogHistogram *histograms; ///< One per thread that used the site
+} jpLogTimer;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The counters of a thread for jpLog_getStats
+///
+/// Like flight recorder rings, they are never freed and are reused by new
+/// threads once their thread exits - without resetting them, so the totals
+/// stay right.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogCounters {
+    struct jpLogCounters *next;
+    int inUse;
+    unsigned long long records[JP_LOG_LEVELCOUNT];
+    unsigned long long suppressed;
+    unsigned long long sampledOut;
+    unsigned long long timeNs;
+    jpLogShard *shards[JP_LOG_MAXSINKS];    ///< Shards per sink slot, valid
+    unsigned long long shardSinks[JP_LOG_MAXSINKS]; ///< if the id matches
+    jpLogHistogram *histograms[1 << JP_LOG_TIMERBITS];  ///< Per timer
+} jpLogCounters;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A conversion in a format string, e.g. %ld
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSpec {
+    unsigned short offset;  ///< Offset of the '%' in the format string
+    unsigned char length;   ///< Length of the conversion, e.g. 3 for %ld
+    char conv;              ///< Conversion character, e.g. 'd'
+    char size;              ///< Length modifier: 0, 'l', 'q' for ll or 'z'
+    char text[5];           ///< The conversion itself
+} jpLogSpec;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A parsed format string
+///
+/// Only the printf subset %d %u %x (with l, ll or z), %s %p %f %g and %% is
+/// formatted by jp_log itself. Anything else (flags, widths, precisions,
+/// other conversions) is left to vsnprintf.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogFormat {
+    const char *fmt;        ///< The format string, the key of the cache
+    int ready;              ///< Nonzero once the rest has been written
+    int supported;          ///< Zero if the format needs vsnprintf
+    size_t length;          ///< Length of the format string
+    size_t count;           ///< Number of conversions
+    jpLogSpec specs[JP_LOG_MAXSPECS];
+    char types[JP_LOG_MAXSPECS + 1];    ///< Type each argument must have,
+                                        ///< encoded as by jpLog__type
+} jpLogFormat;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Where each argument of a message went, for dictionary file sinks
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogArgs {
+    const char *fmt;        ///< The format string, NULL if the message was
+                            ///< not formatted by jp_log or was truncated
+    size_t count;           ///< Number of arguments
+    size_t starts[JP_LOG_MAXSPECS];     ///< Offset of each in the message
+    size_t ends[JP_LOG_MAXSPECS];       ///< Offset past the end of each
+} jpLogArgs;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A definition of a dictionary file, as read back
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogDefinition {
+    char *data;             ///< The definition, NUL-terminated, or NULL
+    jpLogLevel level;
+    int line;
+    const char *file;       ///< The strings point into data
+    const char *func;
+    const char *fmt;
+    jpLogFormat format;
+} jpLogDefinition;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The definitions of a dictionary file read so far, by id
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogDictionary {
+    jpLogDefinition *definitions;
+    size_t count;
+    size_t capacity;
+} jpLogDictionary;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A call site of a JP_LOG_KEYS build, as listed by jpLog__check
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogKey {
+    unsigned char *code;    ///< The jump or NOP, 8-byte aligned
+    unsigned char *target;  ///< Where the jump goes
+    const char *file;
+    int line;
+    int level;
+} jpLogKey;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A rule of a level control file, for a file or a call site
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogControlRule {
+    char file[JP_LOG_CONTROLFILE];  ///< Base name of the file
+    int line;               ///< Line of the call site, 0 for the whole file
+    int level;              ///< Least severe level logged
+} jpLogControlRule;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A level control file, as mapped by every process using it
+///
+/// Processes take a lock on the file to read or change it. Each process
+/// following it keeps a copy, taken when generation changes.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogControl {
+    char magic[8];          ///< JP_LOG_CONTROLMAGIC
+    unsigned generation;    ///< Changed by every write
+    int level;              ///< Least severe level logged by other sites
+    unsigned count;         ///< Rules in use
+    jpLogControlRule rules[JP_LOG_CONTROLRULES];
+} jpLogControl;
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Decimal digit pairs 00 to 99, for converting two digits at a time
+///////////////////////////////////////////////////////////////////////////////
+static const char jpLog__digits[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char jpLog__hexDigits[17] = "0123456789abcdef";
+
+static const char *jpLog__levelNames[JP_LOG_LEVELCOUNT] = {
+    "INFO",
+    "WARN",
+    "EXIT"
+};
+
+static const char *jpLog__levelKeys[JP_LOG_LEVELCOUNT] = {
+    "info",
+    "warn",
+    "exit"
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The sinks - jpLog__sinkCount is read without jpLog__sinksLock
+///////////////////////////////////////////////////////////////////////////////
+static jpLogSink *jpLog__sinks[JP_LOG_MAXSINKS];
+static size_t jpLog__sinkCount = 0;
+static pthread_mutex_t jpLog__sinksLock = PTHREAD_MUTEX_INITIALIZER;
+static int jpLog__atExit = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Least severe level accepted by any sink
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__minLevel = JP_LOG_INFO;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The flight recorder - disabled while jpLog__recorderSize is 0
+///////////////////////////////////////////////////////////////////////////////
+static jpLogRecorder *jpLog__recorders = NULL;
+static size_t jpLog__recorderSize = 0;
+static size_t jpLog__recorderThreads = 0;
+static int jpLog__recorderFd = STDERR_FILENO;
+static pthread_mutex_t jpLog__recorderLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t jpLog__recorderKey;
+static JP_LOG_THREADLOCAL jpLogRecorder *jpLog__recorder = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Parsed format strings, keyed by address - entries are never evicted
+///////////////////////////////////////////////////////////////////////////////
+static jpLogFormat jpLog__formats[1 << JP_LOG_FORMATBITS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The call sites readied so far, latest first
+///////////////////////////////////////////////////////////////////////////////
+static jpLogCallSite *jpLog__siteList = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief jpLog_timeBlock call sites - entries are never evicted, and
+/// histograms are added to them under jpLog__timersLock. The reporter keeps
+/// the buckets it last saw, to report what changed.
+///////////////////////////////////////////////////////////////////////////////
+static jpLogTimer jpLog__timers[1 << JP_LOG_TIMERBITS];
+static pthread_mutex_t jpLog__timersLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long
+    jpLog__timerReported[1 << JP_LOG_TIMERBITS][JP_LOG_BUCKETS];
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Counters - each thread's, and those of sinks already removed
+/// (protected by jpLog__sinksLock)
+///////////////////////////////////////////////////////////////////////////////
+static jpLogCounters *jpLog__counters = NULL;
+static pthread_mutex_t jpLog__countersLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t jpLog__countersOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t jpLog__countersKey;
+static int jpLog__countersKeyOk = 0;
+static JP_LOG_THREADLOCAL jpLogCounters *jpLog__threadCounters = NULL;
+static jpLogSinkStats jpLog__removedStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Id of the last sink added, so stale shards are not mistaken for a
+/// new sink's
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__sinkIds = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Steady state - set by jpLog_preallocate for jpLog__spareThreads
+/// threads, and each thread's depth of logging calls for JP_LOG_DEBUGALLOC
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__steady = 0;
+static size_t jpLog__spareThreads = 0;
+#ifdef JP_LOG_DEBUGALLOC
+static JP_LOG_THREADLOCAL int jpLog__inCall = 0;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Self-reports - logging calls are timed while jpLog__timing is set
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__timing = 0;
+static int jpLog__reporting = 0;
+static int jpLog__reportStopping = 0;
+static unsigned jpLog__reportPeriod = 0;
+static unsigned long long jpLog__reportBudget = 0;
+static pthread_t jpLog__reportThread;
+static pthread_mutex_t jpLog__reportLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jpLog__reportCond = PTHREAD_COND_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Sampling - the override set by jpLog_setSampleRate, and each
+/// thread's generator state and last rate picked by jpLog__sample
+///////////////////////////////////////////////////////////////////////////////
+static unsigned jpLog__sampleOverride = 0;
+static JP_LOG_THREADLOCAL uint32_t jpLog__sampleState = 0;
+static JP_LOG_THREADLOCAL unsigned jpLog__sampleRate = 1;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Levels set at run time - the levels call sites may log at (read
+/// by the log macros, all of them while the flight recorder runs), the
+/// levels the rules let through, the level control file followed and this
+/// process's copy of it, and the epoch of the copy's file and call site
+/// rules, 0 while it has none. The copy is protected by jpLog__controlLock,
+/// and jpLog__keysFailed is set once call sites cannot be patched.
+///////////////////////////////////////////////////////////////////////////////
+unsigned jpLog__levels = (1U << JP_LOG_LEVELCOUNT) - 1;
+static unsigned jpLog__controlLevels = (1U << JP_LOG_LEVELCOUNT) - 1;
+static jpLogControl *jpLog__control = NULL;
+static int jpLog__controlFd = -1;
+static jpLogControl jpLog__controlCopy;
+static unsigned jpLog__controlEpoch = 0;
+static unsigned jpLog__controlEpochs = 0;
+static int jpLog__controlling = 0;
+static int jpLog__controlStopping = 0;
+#ifdef JP_LOG_PATCHKEYS
+static int jpLog__keysFailed = 0;
+#endif
+static pthread_t jpLog__controlThread;
+static pthread_mutex_t jpLog__controlLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jpLog__controlCond = PTHREAD_COND_INITIALIZER;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The call sites of JP_LOG_KEYS builds linked with jp_log.c, bounds
+/// defined by the linker - NULL if there are none
+///////////////////////////////////////////////////////////////////////////////
+#ifdef JP_LOG_PATCHKEYS
+extern const jpLogKey __start_jp_log_keys[] __attribute__((weak));
+extern const jpLogKey __stop_jp_log_keys[] __attribute__((weak));
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Thread details - what jpLog_setRecordInfo added to records, and
+/// each thread's ID (0 until first used) and name
+///////////////////////////////////////////////////////////////////////////////
+static unsigned jpLog__recordInfo = 0;
+#ifndef __linux__
+static unsigned long jpLog__threadCount = 0;
+#endif
+static JP_LOG_THREADLOCAL unsigned long jpLog__threadId = 0;
+static JP_LOG_THREADLOCAL char jpLog__threadName[JP_LOG_NAMEMAX] = "";
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Each thread's open spans and the times they started
+///////////////////////////////////////////////////////////////////////////////
+static JP_LOG_THREADLOCAL size_t jpLog__spanDepth = 0;
+static JP_LOG_THREADLOCAL unsigned long long
+    jpLog__spanStarts[JP_LOG_SPANDEPTH];
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the CLOCK_REALTIME time some milliseconds from now, for
+///         pthread_cond_timedwait
+///
+/// @param	ms  The milliseconds
+///////////////////////////////////////////////////////////////////////////////
+static struct timespec jpLog__deadline(unsigned ms)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return deadline;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the CLOCK_MONOTONIC time in nanoseconds
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL
+        + (unsigned long long)now.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a whole buffer to a file descriptor
+///
+/// @param	fd      The file descriptor
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__writeAll(int fd, const char *buf, size_t length)
+{
+    ssize_t written = 0;
+
+    while (length) {
+        written = write(fd, buf, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += written;
+        length -= (size_t)written;
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a buffer at an offset of a file, retrying partial writes
+///
+/// @param	fd      The file
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer
+/// @param	offset  Offset in the file
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__pwriteAll(
+        int fd,
+        const char *buf,
+        size_t length,
+        off_t offset)
+{
+    ssize_t written = 0;
+
+    while (length) {
+        written = pwrite(fd, buf, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += written;
+        length -= (size_t)written;
+        offset += written;
+    }
+
+    return 1;
+}
+
+#ifdef JP_LOG_URING
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Frees an io_uring
+///
+/// @param	uring   The io_uring, possibly only partly set up
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__destroyUring(jpLogUring *uring)
+{
+    if (uring->sqes) {
+        munmap(uring->sqes, uring->sqesSize);
+    }
+    if (uring->cq) {
+        munmap(uring->cq, uring->cqSize);
+    }
+    if (uring->sq) {
+        munmap(uring->sq, uring->sqSize);
+    }
+
+    close(uring->fd);
+    free(uring);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Maps a ring of an io_uring
+///
+/// @param	fd      The io_uring
+/// @param	size    Size of the ring
+/// @param	offset  Which ring, one of IORING_OFF_*
+/// @return	The ring, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLog__mapUring(int fd, size_t size, off_t offset)
+{
+    void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+            offset);
+
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sets up an io_uring for a file sink's write buffers
+///
+/// @param	buffers The JP_LOG_WRITEBUFS buffers, registered with the io_uring
+///                 so the kernel does not map them for every write
+/// @return	The io_uring, or NULL if the kernel (or a seccomp filter) does not
+///         allow it
+///////////////////////////////////////////////////////////////////////////////
+static jpLogUring *jpLog__createUring(char *buffers)
+{
+    struct io_uring_params params;
+    struct iovec iov[JP_LOG_WRITEBUFS];
+    jpLogUring *uring = calloc(1, sizeof(*uring));
+    int i;
+
+    if (!uring) {
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+    uring->fd = (int)syscall(__NR_io_uring_setup, JP_LOG_WRITEBUFS, &params);
+    if (uring->fd < 0) {
+        free(uring);
+        return NULL;
+    }
+
+    uring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqSize = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sq = jpLog__mapUring(uring->fd, uring->sqSize, IORING_OFF_SQ_RING);
+    uring->cq = jpLog__mapUring(uring->fd, uring->cqSize, IORING_OFF_CQ_RING);
+    uring->sqes = jpLog__mapUring(uring->fd, uring->sqesSize,
+            IORING_OFF_SQES);
+    if (!uring->sq || !uring->cq || !uring->sqes) {
+        jpLog__destroyUring(uring);
+        return NULL;
+    }
+
+    uring->sqHead = (unsigned *)((char *)uring->sq + params.sq_off.head);
+    uring->sqTail = (unsigned *)((char *)uring->sq + params.sq_off.tail);
+    uring->sqArray = (unsigned *)((char *)uring->sq + params.sq_off.array);
+    uring->sqMask = *(unsigned *)((char *)uring->sq
+            + params.sq_off.ring_mask);
+    uring->cqHead = (unsigned *)((char *)uring->cq + params.cq_off.head);
+    uring->cqTail = (unsigned *)((char *)uring->cq + params.cq_off.tail);
+    uring->cqMask = *(unsigned *)((char *)uring->cq
+            + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)((char *)uring->cq
+            + params.cq_off.cqes);
+
+    for (i = 0; i < JP_LOG_WRITEBUFS; ++i) {
+        iov[i].iov_base = buffers + (size_t)i * JP_LOG_WRITEBUFSIZE;
+        iov[i].iov_len = JP_LOG_WRITEBUFSIZE;
+    }
+
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS,
+                iov, JP_LOG_WRITEBUFS) < 0) {
+        jpLog__destroyUring(uring);
+        return NULL;
+    }
+
+    return uring;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Submits a write from a registered buffer to an io_uring
+///
+/// @param	uring   The io_uring
+/// @param	fd      The file
+/// @param	index   Index of the buffer, also identifying the completion
+/// @param	buf     Start of the write, in the buffer
+/// @param	length  Length of the write
+/// @param	offset  Offset in the file
+/// @return	Nonzero if the write was submitted, zero otherwise
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__submitUring(
+        jpLogUring *uring,
+        int fd,
+        size_t index,
+        const char *buf,
+        size_t length,
+        off_t offset)
+{
+    unsigned tail = *uring->sqTail;
+    unsigned slot = tail & uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[slot];
+    long submitted = 0;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = (unsigned)length;
+    sqe->off = (unsigned long long)offset;
+    sqe->buf_index = (unsigned short)index;
+    sqe->user_data = index;
+    uring->sqArray[slot] = slot;
+    jpLog__store(uring->sqTail, tail + 1);
+
+    do {
+        submitted = syscall(__NR_io_uring_enter, uring->fd, 1, 0, 0, NULL,
+                0);
+    } while (submitted < 0 && errno == EINTR);
+
+    // Take the entry back if the kernel did not, so it is not written twice
+    if (submitted < 1 && jpLog__load(uring->sqHead) == tail) {
+        jpLog__store(uring->sqTail, tail);
+        return 0;
+    }
+
+    return 1;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Finishes a write from a file sink's buffer, writing whatever the
+///         io_uring did not
+///
+/// With O_DIRECT, the rest is written again from the last whole block the
+/// io_uring wrote, since the buffer and offset must stay aligned.
+///
+/// @param	file    The file sink's data
+/// @param	index   Index of the buffer
+/// @param	written Bytes written, or a negative error
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__completeWrite(jpLogFile *file, size_t index, long written)
+{
+    size_t length = file->pending[index];
+
+    if (written < 0) {
+        written = 0;
+    }
+    if (file->direct) {
+        written &= ~(long)(JP_LOG_DIRECTALIGN - 1);
+    }
+
+    if ((size_t)written < length) {
+        jpLog__pwriteAll(file->fd, file->buffers
+                + index * JP_LOG_WRITEBUFSIZE + written,
+                length - (size_t)written, file->offsets[index] + written);
+    }
+
+    file->pending[index] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Finishes the writes a file sink's io_uring has completed
+///
+/// @param	file    The file sink's data
+/// @param	wait    If nonzero, waits for at least one write to complete
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__reapWrites(jpLogFile *file, int wait)
+{
+#ifdef JP_LOG_URING
+    jpLogUring *uring = file->uring;
+    struct io_uring_cqe *cqe = NULL;
+    unsigned head = *uring->cqHead;
+
+    if (wait && head == jpLog__load(uring->cqTail)) {
+        while (syscall(__NR_io_uring_enter, uring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno == EINTR) {
+        }
+    }
+
+    while (head != jpLog__load(uring->cqTail)) {
+        cqe = &uring->cqes[head & uring->cqMask];
+        jpLog__completeWrite(file, (size_t)cqe->user_data, cqe->res);
+        ++head;
+    }
+
+    jpLog__store(uring->cqHead, head);
+#else
+    (void)file;
+    (void)wait;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Waits until the write from a file sink's buffer is done
+///
+/// @param	file    The file sink's data
+/// @param	index   Index of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__waitWrite(jpLogFile *file, size_t index)
+{
+    while (file->pending[index]) {
+        jpLog__reapWrites(file, 1);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a file sink's current buffer at the current offset,
+///         through the io_uring if there is one
+///
+/// @param	file    The file sink's data
+/// @param	length  Bytes to write, at least those used
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__writeBuffer(jpLogFile *file, size_t length)
+{
+    size_t index = file->current;
+
+    file->pending[index] = length;
+    file->offsets[index] = file->offset;
+
+#ifdef JP_LOG_URING
+    if (file->uring && jpLog__submitUring(file->uring, file->fd, index,
+                file->buffers + index * JP_LOG_WRITEBUFSIZE, length,
+                file->offset)) {
+        jpLog__reapWrites(file, 0);
+        return;
+    }
+#endif
+
+    jpLog__completeWrite(file, index, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a file sink's current buffer and moves on to the next one
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__nextBuffer(jpLogFile *file)
+{
+    jpLog__writeBuffer(file, file->used);
+    file->offset += (off_t)file->used;
+    file->current = (file->current + 1) % JP_LOG_WRITEBUFS;
+    file->used = 0;
+    jpLog__waitWrite(file, file->current);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes out everything in a file sink's buffers and waits for it
+///
+/// With O_DIRECT, the last partial block is written padded with zeros and
+/// cut off by ftruncate, and kept to be written again once it has more.
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__flushBuffers(jpLogFile *file)
+{
+    char *buf = file->buffers + file->current * JP_LOG_WRITEBUFSIZE;
+    size_t length = 0;
+    size_t done = 0;
+    size_t i;
+
+    if (file->used && !file->direct) {
+        jpLog__nextBuffer(file);
+    }
+    else if (file->used) {
+        length = (file->used + JP_LOG_DIRECTALIGN - 1)
+            & ~(size_t)(JP_LOG_DIRECTALIGN - 1);
+        memset(buf + file->used, 0, length - file->used);
+        jpLog__writeBuffer(file, length);
+    }
+
+    for (i = 0; i < JP_LOG_WRITEBUFS; ++i) {
+        jpLog__waitWrite(file, i);
+    }
+
+    if (length) {
+        while (ftruncate(file->fd, file->offset + (off_t)file->used) < 0
+                && errno == EINTR) {
+        }
+
+        done = file->used & ~(size_t)(JP_LOG_DIRECTALIGN - 1);
+        memmove(buf, buf + done, file->used - done);
+        file->offset += (off_t)done;
+        file->used -= done;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to a file sink's file, or to its write buffers
+///
+/// @param	file    The file sink's data
+/// @param	buf     The output
+/// @param	length  Length of the output
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__output(jpLogFile *file, const char *buf, size_t length)
+{
+    size_t copied = 0;
+
+    if (!file->buffers) {
+        return jpLog__writeAll(file->fd, buf, length);
+    }
+
+    while (length) {
+        copied = JP_LOG_WRITEBUFSIZE - file->used;
+        copied = copied < length ? copied : length;
+        memcpy(file->buffers + file->current * JP_LOG_WRITEBUFSIZE
+                + file->used, buf, copied);
+        file->used += copied;
+        buf += copied;
+        length -= copied;
+
+        if (file->used == JP_LOG_WRITEBUFSIZE) {
+            jpLog__nextBuffer(file);
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to a stdio stream
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__writeStdio(void *data, const char *buf, size_t length)
+{
+    return fwrite(buf, length, 1, data) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Computes the FNV-1a hash of a block of memory
+///
+/// @param	data    The memory to hash
+/// @param	size    Size of the memory in bytes
+/// @return	The hash
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t jpLog__checksum(const unsigned char *data, size_t size)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stores a 32 bit number in little-endian byte order
+///
+/// @param	dst     Where to store the number
+/// @param	value   The number
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__put32(unsigned char *dst, uint32_t value)
+{
+    dst[0] = (unsigned char)value;
+    dst[1] = (unsigned char)(value >> 8);
+    dst[2] = (unsigned char)(value >> 16);
+    dst[3] = (unsigned char)(value >> 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Loads a 32 bit number stored in little-endian byte order
+///
+/// @param	src Where the number is stored
+/// @return	The number
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t jpLog__get32(const unsigned char *src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8
+        | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stores a 64 bit number in little-endian byte order
+///
+/// @param	dst     Where to store the number
+/// @param	value   The number
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__put64(unsigned char *dst, unsigned long long value)
+{
+    jpLog__put32(dst, (uint32_t)value);
+    jpLog__put32(dst + 4, (uint32_t)(value >> 32));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Loads a 64 bit number stored in little-endian byte order
+///
+/// @param	src Where the number is stored
+/// @return	The number
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__get64(const unsigned char *src)
+{
+    return (unsigned long long)jpLog__get32(src)
+        | (unsigned long long)jpLog__get32(src + 4) << 32;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stores a number as a fixed number of hex digits
+///
+/// @param	dst     Where to store the digits
+/// @param	value   The number
+/// @param	digits  Number of digits
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__putHex(char *dst, unsigned long long value, int digits)
+{
+    while (digits--) {
+        dst[digits] = "0123456789abcdef"[value & 15];
+        value >>= 4;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Loads a number stored as a fixed number of hex digits
+///
+/// @param	src     Where the digits are stored
+/// @param	digits  Number of digits
+/// @param	value   Receives the number
+/// @return	Nonzero on success, zero if a digit is not lowercase hex
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__getHex(const char *src, int digits, unsigned long long *value)
+{
+    int i;
+
+    *value = 0;
+    for (i = 0; i < digits; ++i) {
+        if (src[i] >= '0' && src[i] <= '9') {
+            *value = *value << 4 | (unsigned long long)(src[i] - '0');
+        }
+        else if (src[i] >= 'a' && src[i] <= 'f') {
+            *value = *value << 4 | (unsigned long long)(src[i] - 'a' + 10);
+        }
+        else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the base name of a file name, i.e. what follows its last
+///         '/'
+///
+/// @param	file    The file name
+///////////////////////////////////////////////////////////////////////////////
+static const char *jpLog__baseName(const char *file)
+{
+    const char *base = strrchr(file, '/');
+
+    return base ? base + 1 : file;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the hash an indexed file keeps of a file name
+///
+/// Only the base name is hashed, so a query need not know the path the file
+/// was compiled from.
+///
+/// @param	file    The file name
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t jpLog__hashFile(const char *file)
+{
+    const char *base = jpLog__baseName(file);
+
+    return jpLog__checksum((const unsigned char *)base, strlen(base));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the key of a call site in the bloom filter of an indexed
+///         block
+///
+/// @param	fileHash    Hash of the call site's file name
+/// @param	line        Line of the call site
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t jpLog__siteKey(uint32_t fileHash, uint32_t line)
+{
+    return (fileHash ^ (line * 2654435761U)) * 2246822519U;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a key to the bloom filter of an indexed block
+///
+/// @param	bloom   The bloom filter
+/// @param	key     The key
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__bloomAdd(unsigned char *bloom, uint32_t key)
+{
+    uint32_t bit = key % JP_LOG_BLOOMBITS;
+
+    bloom[bit / 8] |= (unsigned char)(1 << bit % 8);
+    bit = (key >> 16) % JP_LOG_BLOOMBITS;
+    bloom[bit / 8] |= (unsigned char)(1 << bit % 8);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether the bloom filter of an indexed block may hold a
+///         key
+///
+/// @param	bloom   The bloom filter
+/// @param	key     The key
+/// @return	Zero if the key was never added
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__bloomHas(const unsigned char *bloom, uint32_t key)
+{
+    uint32_t bit = key % JP_LOG_BLOOMBITS;
+    uint32_t other = (key >> 16) % JP_LOG_BLOOMBITS;
+
+    return (bloom[bit / 8] >> bit % 8 & 1)
+        && (bloom[other / 8] >> other % 8 & 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the maximum size of a compressed block
+///
+/// @param	size    Size of the raw data
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__compressBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends an LZ4 length continuation to a compressed block
+///
+/// @param	op      End of the compressed block
+/// @param	length  Length minus the 15 stored in the token
+/// @return	New end of the compressed block
+///////////////////////////////////////////////////////////////////////////////
+static unsigned char *jpLog__putLength(unsigned char *op, size_t length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+
+    return op;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Compresses data into an LZ4 block
+///
+/// A single greedy pass with a hash table of 4-byte sequences, like the LZ4
+/// fast mode. Matches end at least 5 bytes and start at least 12 bytes before
+/// the end of the data, as the block format requires.
+///
+/// @param	src     The data
+/// @param	size    Size of the data
+/// @param	dst     Buffer of at least jpLog__compressBound(size) bytes
+/// @param	table   Hash table of 1 << JP_LOG_HASHBITS entries
+/// @return	Size of the compressed block
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__compress(
+        const unsigned char *src,
+        size_t size,
+        unsigned char *dst,
+        uint32_t *table)
+{
+    const unsigned char *ip = src;
+    const unsigned char *anchor = src;
+    const unsigned char *ref = NULL;
+    const unsigned char *end = src + size;
+    const unsigned char *matchEnd = NULL;
+    unsigned char *op = dst;
+    unsigned char *token = NULL;
+    uint32_t sequence = 0;
+    uint32_t hash = 0;
+    size_t length = 0;
+
+    memset(table, 0, sizeof(*table) << JP_LOG_HASHBITS);
+
+    while (size >= 13 && ip < end - 12) {
+        memcpy(&sequence, ip, sizeof(sequence));
+        hash = (sequence * 2654435761U) >> (32 - JP_LOG_HASHBITS);
+        ref = src + table[hash];
+        table[hash] = (uint32_t)(ip - src);
+
+        if (ref >= ip || ip - ref > 65535 || memcmp(ref, ip, 4)) {
+            // Skip faster through data that does not compress
+            ip += 1 + ((size_t)(ip - anchor) >> 6);
+            continue;
+        }
+
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            --ip;
+            --ref;
+        }
+
+        matchEnd = ip + 4;
+        while (matchEnd < end - 5 && *matchEnd == ref[matchEnd - ip]) {
+            ++matchEnd;
+        }
+
+        length = (size_t)(ip - anchor);
+        token = op++;
+        *token = (unsigned char)((length < 15 ? length : 15) << 4);
+        if (length >= 15) {
+            op = jpLog__putLength(op, length - 15);
+        }
+        memcpy(op, anchor, length);
+        op += length;
+
+        *op++ = (unsigned char)(ip - ref);
+        *op++ = (unsigned char)((ip - ref) >> 8);
+
+        length = (size_t)(matchEnd - ip) - 4;
+        *token |= (unsigned char)(length < 15 ? length : 15);
+        if (length >= 15) {
+            op = jpLog__putLength(op, length - 15);
+        }
+
+        ip = anchor = matchEnd;
+    }
+
+    length = (size_t)(end - anchor);
+    *op++ = (unsigned char)((length < 15 ? length : 15) << 4);
+    if (length >= 15) {
+        op = jpLog__putLength(op, length - 15);
+    }
+    memcpy(op, anchor, length);
+
+    return (size_t)(op + length - dst);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads an LZ4 length continuation from a compressed block
+///
+/// @param	ip      Position in the compressed block, advanced past the length
+/// @param	end     End of the compressed block
+/// @param	length  The length so far (15), receives the full length
+/// @return	Nonzero on success, zero if the block is corrupt
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__getLength(
+        const unsigned char **ip,
+        const unsigned char *end,
+        size_t *length)
+{
+    unsigned char byte = 255;
+
+    while (byte == 255) {
+        if (*ip == end || *length > JP_LOG_BLOCKMAX) {
+            return 0;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Decompresses an LZ4 block
+///
+/// @param	src     The compressed block
+/// @param	size    Size of the compressed block
+/// @param	dst     Buffer for the raw data
+/// @param	rawSize Size of the raw data
+/// @return	Nonzero on success, zero if the block is corrupt
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__decompress(
+        const unsigned char *src,
+        size_t size,
+        unsigned char *dst,
+        size_t rawSize)
+{
+    const unsigned char *ip = src;
+    const unsigned char *end = src + size;
+    unsigned char *op = dst;
+    unsigned char *opEnd = dst + rawSize;
+    size_t length = 0;
+    size_t offset = 0;
+    unsigned char token = 0;
+
+    for (;;) {
+        if (ip == end) {
+            return 0;
+        }
+
+        token = *ip++;
+        length = token >> 4;
+        if (length == 15 && !jpLog__getLength(&ip, end, &length)) {
+            return 0;
+        }
+        if (length > (size_t)(end - ip) || length > (size_t)(opEnd - op)) {
+            return 0;
+        }
+        memcpy(op, ip, length);
+        ip += length;
+        op += length;
+
+        // The last sequence has no match
+        if (ip == end) {
+            return op == opEnd;
+        }
+
+        if (end - ip < 2) {
+            return 0;
+        }
+        offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst)) {
+            return 0;
+        }
+
+        length = token & 15;
+        if (length == 15 && !jpLog__getLength(&ip, end, &length)) {
+            return 0;
+        }
+        length += 4;
+        if (length > (size_t)(opEnd - op)) {
+            return 0;
+        }
+
+        // Byte by byte, since the match may overlap what it copies
+        for (; length; --length, ++op) {
+            *op = op[-(ptrdiff_t)offset];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Compresses and writes out the output collected by a file sink
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__flushBlock(jpLogFile *file)
+{
+    jpLogBlockIndex *index = &file->blockIndex;
+    size_t header = file->index ? JP_LOG_INDEXHEADER : JP_LOG_BLOCKHEADER;
+    size_t stored = 0;
+
+    if (!file->length) {
+        return;
+    }
+
+    stored = jpLog__compress(file->block, file->length,
+            file->packed + header, file->table);
+    if (stored >= file->length) {
+        stored = file->length;
+        memcpy(file->packed + header, file->block, stored);
+    }
+
+    jpLog__put32(file->packed, (uint32_t)file->length);
+    jpLog__put32(file->packed + 4, (uint32_t)stored);
+    jpLog__put32(file->packed + 8,
+            jpLog__checksum(file->block, file->length));
+    if (file->index) {
+        jpLog__put32(file->packed + 12, index->lines);
+        jpLog__put32(file->packed + 16, index->levels);
+        jpLog__put64(file->packed + 20, index->minTime);
+        jpLog__put64(file->packed + 28, index->maxTime);
+        memcpy(file->packed + 36, index->bloom, sizeof(index->bloom));
+        memset(index, 0, sizeof(*index));
+    }
+    jpLog__output(file, (const char *)file->packed, header + stored);
+
+    file->length = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Loads the index of a block from its header
+///
+/// @param	index   Receives the index
+/// @param	header  The block's JP_LOG_INDEXHEADER bytes of header
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__getIndex(
+        jpLogBlockIndex *index,
+        const unsigned char *header)
+{
+    index->lines = jpLog__get32(header + 12);
+    index->levels = jpLog__get32(header + 16);
+    index->minTime = jpLog__get64(header + 20);
+    index->maxTime = jpLog__get64(header + 28);
+    memcpy(index->bloom, header + 36, sizeof(index->bloom));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the next line of an indexed block
+///
+/// @param	raw     The block's raw output
+/// @param	size    Size of the raw output
+/// @param	offset  Offset of the line, moved past it
+/// @param	entry   Receives the line
+/// @return	Nonzero on success, zero at the end of the block or if the line
+///         is corrupt, which leaves offset short of size
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__getEntry(
+        const unsigned char *raw,
+        size_t size,
+        size_t *offset,
+        jpLogEntry *entry)
+{
+    const unsigned char *header = raw + *offset;
+    uint32_t level = 0;
+
+    if (size - *offset < JP_LOG_ENTRYHEADER) {
+        return 0;
+    }
+
+    entry->time = jpLog__get64(header);
+    entry->fileHash = jpLog__get32(header + 8);
+    entry->line = jpLog__get32(header + 12);
+    entry->length = jpLog__get32(header + 16);
+    level = jpLog__get32(header + 20);
+    if (level >= JP_LOG_LEVELCOUNT || entry->length > JP_LOG_LINEMAX
+            || entry->length > size - *offset - JP_LOG_ENTRYHEADER) {
+        return 0;
+    }
+
+    entry->level = (jpLogLevel)level;
+    entry->text = (const char *)header + JP_LOG_ENTRYHEADER;
+    *offset += JP_LOG_ENTRYHEADER + entry->length;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether an indexed block may hold lines matching a query
+///
+/// @param	index       Index of the block
+/// @param	query       The query
+/// @param	fileHash    Hash of the query's file
+/// @param	siteKey     Key of the query's call site
+/// @return	Zero if no line of the block matches
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__blockMayMatch(
+        const jpLogBlockIndex *index,
+        const jpLogQuery *query,
+        uint32_t fileHash,
+        uint32_t siteKey)
+{
+    return index->lines
+        && (!query->levels || (index->levels & query->levels))
+        && (!query->since || index->maxTime >= query->since)
+        && (!query->until || index->minTime <= query->until)
+        && (!query->file || jpLog__bloomHas(index->bloom, fileHash))
+        && (!query->file || !query->line
+                || jpLog__bloomHas(index->bloom, siteKey));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether a line of an indexed block matches a query
+///
+/// @param	entry       The line
+/// @param	query       The query
+/// @param	fileHash    Hash of the query's file
+/// @return	Nonzero if the line matches
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__entryMatches(
+        const jpLogEntry *entry,
+        const jpLogQuery *query,
+        uint32_t fileHash)
+{
+    return (!query->levels || (query->levels >> entry->level & 1))
+        && (!query->since || entry->time >= query->since)
+        && (!query->until || entry->time <= query->until)
+        && (!query->file || entry->fileHash == fileHash)
+        && (!query->file || !query->line
+                || entry->line == (uint32_t)query->line);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a time as 2024-01-31T12:00:00.000000000Z and a space
+///
+/// @param	buf     Receives the time, at least JP_LOG_TIMESIZE bytes
+/// @param	time    Nanoseconds since the epoch
+/// @return	Length of the time
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__formatTime(char *buf, unsigned long long time)
+{
+    time_t seconds = (time_t)(time / 1000000000ULL);
+    struct tm tm;
+    size_t length = 0;
+
+    if (!gmtime_r(&seconds, &tm)) {
+        memset(&tm, 0, sizeof(tm));
+    }
+
+    length = strftime(buf, JP_LOG_TIMESIZE, "%Y-%m-%dT%H:%M:%S", &tm);
+    length += (size_t)snprintf(buf + length, JP_LOG_TIMESIZE - length,
+            ".%09luZ ", (unsigned long)(time % 1000000000ULL));
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes out everything a file sink holds back
+///
+/// @param	data    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__flushFile(void *data)
+{
+    jpLogFile *file = data;
+
+    jpLog__flushBlock(file);
+    if (file->buffers) {
+        jpLog__flushBuffers(file);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sets up a file sink to compress its output in blocks
+///
+/// @param	file        The file sink's data
+/// @param	blockSize   Bytes of output per block
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__startCompression(jpLogFile *file, size_t blockSize)
+{
+    // Any line must fit in a block of an indexed file, and any definition
+    // or line in a block of a dictionary file
+    if (file->index && blockSize < JP_LOG_ENTRYHEADER + JP_LOG_LINEMAX) {
+        blockSize = JP_LOG_ENTRYHEADER + JP_LOG_LINEMAX;
+    }
+    if (file->dictionary) {
+        if (blockSize < JP_LOG_DICTHEADER + 8 + JP_LOG_DICTMAX) {
+            blockSize = JP_LOG_DICTHEADER + 8 + JP_LOG_DICTMAX;
+        }
+        if (blockSize < JP_LOG_DICTHEADER + JP_LOG_LINEMAX) {
+            blockSize = JP_LOG_DICTHEADER + JP_LOG_LINEMAX;
+        }
+        file->definitions = calloc(2 * JP_LOG_DICTSIZE,
+                sizeof(*file->definitions));
+    }
+
+    file->blockSize = blockSize < JP_LOG_BLOCKMAX ? blockSize
+        : JP_LOG_BLOCKMAX;
+    file->block = malloc(file->blockSize);
+    file->packed = malloc(JP_LOG_INDEXHEADER
+            + jpLog__compressBound(file->blockSize));
+    file->table = malloc(sizeof(*file->table) << JP_LOG_HASHBITS);
+
+    return file->block && file->packed && file->table
+        && (file->definitions || !file->dictionary);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Builds the path of a rotated file
+///
+/// @param	buf     Receives the path, of JP_LOG_PATHMAX bytes
+/// @param	path    Path of the file sink's file
+/// @param	index   1 for the newest rotated file, 2 for the one before...
+/// @param	lz      If nonzero, the path of its compressed copy
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__archivePath(
+        char *buf,
+        const char *path,
+        unsigned index,
+        int lz)
+{
+    snprintf(buf, JP_LOG_PATHMAX, "%s.%u%s", path, index, lz ? ".lz" : "");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether a file exists, adding up its size
+///
+/// @param	path    Path of the file
+/// @param	size    Has the size of the file added, may be NULL
+/// @return	Nonzero if the file exists
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__exists(const char *path, unsigned long long *size)
+{
+    struct stat info;
+
+    if (stat(path, &info)) {
+        return 0;
+    }
+
+    if (size) {
+        *size += (unsigned long long)info.st_size;
+    }
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Compresses a file into a new file, as written by a compressing
+///         file sink, and removes it
+///
+/// @param	src     Path of the file
+/// @param	dst     Path of the compressed file, only created once complete
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__compressFile(const char *src, const char *dst)
+{
+    char tmp[JP_LOG_PATHMAX + 4];
+    jpLogFile file;
+    ssize_t got = 0;
+    int in = open(src, O_RDONLY);
+    int ok = 0;
+
+    memset(&file, 0, sizeof(file));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    file.fd = in < 0 ? -1 : open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = file.fd >= 0 && jpLog__startCompression(&file, JP_LOG_BLOCKSIZE)
+        && jpLog__writeAll(file.fd, JP_LOG_FILEMAGIC,
+                sizeof(JP_LOG_FILEMAGIC) - 1);
+
+    while (ok && (got = read(in, file.block + file.length,
+                    file.blockSize - file.length))) {
+        if (got < 0) {
+            ok = errno == EINTR;
+            continue;
+        }
+
+        file.length += (size_t)got;
+        if (file.length == file.blockSize) {
+            jpLog__flushBlock(&file);
+        }
+    }
+
+    if (ok) {
+        jpLog__flushBlock(&file);
+    }
+
+    if (file.fd >= 0 && close(file.fd)) {
+        ok = 0;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    free(file.table);
+    free(file.packed);
+    free(file.block);
+
+    if (ok && !rename(tmp, dst)) {
+        unlink(src);
+        return 1;
+    }
+
+    unlink(tmp);
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Compresses the newest rotated file of a file sink if asked to,
+///         then removes the oldest ones beyond its limits
+///
+/// Runs on a thread of its own, so the sink's thread does not wait for it.
+///
+/// @param	arg The file sink's data
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLog__archive(void *arg)
+{
+    jpLogFile *file = arg;
+    char plain[JP_LOG_PATHMAX];
+    char packed[JP_LOG_PATHMAX];
+    unsigned long long bytes = 0;
+    unsigned index;
+    int found = 0;
+
+    if (file->compressRotated) {
+        jpLog__archivePath(plain, file->path, 1, 0);
+        jpLog__archivePath(packed, file->path, 1, 1);
+        jpLog__compressFile(plain, packed);
+    }
+
+    for (index = 1;; ++index) {
+        jpLog__archivePath(plain, file->path, index, 0);
+        jpLog__archivePath(packed, file->path, index, 1);
+        found = jpLog__exists(plain, &bytes);
+        found |= jpLog__exists(packed, &bytes);
+        if (!found) {
+            break;
+        }
+
+        if ((file->keepFiles && index > file->keepFiles)
+                || (file->keepBytes && bytes > file->keepBytes)) {
+            unlink(plain);
+            unlink(packed);
+        }
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Forgets the definitions written to a dictionary file, so the
+///         ids start over
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__clearDefinitions(jpLogFile *file)
+{
+    size_t i;
+
+    for (i = 0; i < 2 * JP_LOG_DICTSIZE; ++i) {
+        free(file->definitions[i].data);
+        file->definitions[i].data = NULL;
+    }
+    file->definitionCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Opens a new, empty file for a rotating file sink
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__openFile(jpLogFile *file)
+{
+    int flags = O_RDWR | O_CREAT | O_TRUNC | (file->buffers ? 0 : O_APPEND);
+
+#ifdef O_DIRECT
+    flags |= file->direct ? O_DIRECT : 0;
+#endif
+
+    file->fd = open(file->path, flags, 0644);
+    file->offset = 0;
+    file->used = 0;
+    file->written = 0;
+
+    if (file->fd >= 0 && file->block) {
+        jpLog__output(file, file->index ? JP_LOG_INDEXMAGIC
+                : file->dictionary ? JP_LOG_DICTMAGIC : JP_LOG_FILEMAGIC,
+                sizeof(JP_LOG_FILEMAGIC) - 1);
+    }
+
+    // Each file defines its own ids
+    if (file->definitions) {
+        jpLog__clearDefinitions(file);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the next time a file sink rotating every so many seconds
+///         rotates
+///
+/// @param	seconds Seconds between rotations
+/// @param	now     The current time
+///////////////////////////////////////////////////////////////////////////////
+static time_t jpLog__nextRotation(unsigned seconds, time_t now)
+{
+    return (now / (time_t)seconds + 1) * (time_t)seconds;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether a rotating file sink must rotate before writing
+///         more output
+///
+/// @param	file    The file sink's data
+/// @param	length  Length of the output
+/// @return	Nonzero if the file must rotate
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__rotateDue(jpLogFile *file, size_t length)
+{
+    time_t now = 0;
+
+    if (file->rotateBytes && file->written
+            && file->written + length > file->rotateBytes) {
+        return 1;
+    }
+
+    // An empty file is not rotated, but waits for the next time
+    if (file->rotateSeconds && (now = time(NULL)) >= file->rotateAt) {
+        file->rotateAt = jpLog__nextRotation(file->rotateSeconds, now);
+        return file->written != 0;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Renames a file sink's file to path.1 and opens a new one
+///
+/// Output queued meanwhile waits in the sink's queue. If the file cannot be
+/// renamed, output keeps going to it.
+///
+/// @param	file    The file sink's data
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__rotateFile(jpLogFile *file)
+{
+    char from[JP_LOG_PATHMAX];
+    char to[JP_LOG_PATHMAX];
+    unsigned count = 0;
+    unsigned index;
+    int lz;
+
+    jpLog__flushFile(file);
+
+    if (file->archiving) {
+        pthread_join(file->archiver, NULL);
+        file->archiving = 0;
+    }
+
+    do {
+        ++count;
+        jpLog__archivePath(from, file->path, count, 0);
+        jpLog__archivePath(to, file->path, count, 1);
+    } while (jpLog__exists(from, NULL) || jpLog__exists(to, NULL));
+
+    for (index = count - 1; index > 0; --index) {
+        for (lz = 0; lz < 2; ++lz) {
+            jpLog__archivePath(from, file->path, index, lz);
+            jpLog__archivePath(to, file->path, index + 1, lz);
+            rename(from, to);
+        }
+    }
+
+    jpLog__archivePath(to, file->path, 1, 0);
+    if (rename(file->path, to)) {
+        return;
+    }
+
+    close(file->fd);
+    jpLog__openFile(file);
+    file->archiving = !pthread_create(&file->archiver, NULL, jpLog__archive,
+            file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds an entry to the block of a dictionary file, flushing the
+///         block first if the entry does not fit
+///
+/// @param	file    The file sink's data
+/// @param	id      Number of the entry
+/// @param	data    The entry's bytes
+/// @param	length  Length of the entry's bytes
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__addDictEntry(
+        jpLogFile *file,
+        uint32_t id,
+        const void *data,
+        size_t length)
+{
+    if (file->blockSize - file->length < JP_LOG_DICTHEADER + length) {
+        jpLog__flushBlock(file);
+    }
+
+    jpLog__put32(file->block + file->length, id);
+    jpLog__put32(file->block + file->length + 4, (uint32_t)length);
+    memcpy(file->block + file->length + JP_LOG_DICTHEADER, data, length);
+    file->length += JP_LOG_DICTHEADER + length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the id of a definition in a dictionary file, defining it
+///         on first use
+///
+/// @param	file    The file sink's data
+/// @param	data    The definition
+/// @param	length  Length of the definition
+/// @return	The id
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t jpLog__define(
+        jpLogFile *file,
+        const unsigned char *data,
+        size_t length)
+{
+    jpLogDictSlot *slot = NULL;
+    uint32_t hash = jpLog__checksum(data, length);
+    size_t mask = 2 * JP_LOG_DICTSIZE - 1;
+    uint32_t id = 0;
+    size_t i;
+
+    for (i = hash & mask;; i = (i + 1) & mask) {
+        slot = &file->definitions[i];
+        if (!slot->data) {
+            break;
+        }
+        if (slot->hash == hash && slot->length == length
+                && !memcmp(slot->data, data, length)) {
+            return slot->id;
+        }
+    }
+
+    // The table is at most half full, so probes stay short
+    if (file->definitionCount == JP_LOG_DICTSIZE) {
+        jpLog__clearDefinitions(file);
+        return jpLog__define(file, data, length);
+    }
+
+    // Without memory, the definition is written again on its next use
+    id = file->definitionCount++;
+    slot->data = malloc(length);
+    if (slot->data) {
+        memcpy(slot->data, data, length);
+        slot->length = length;
+        slot->hash = hash;
+        slot->id = id;
+    }
+
+    jpLog__addDictEntry(file, id | JP_LOG_DICTDEFINE, data, length);
+    return id;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Collects tagged messages for a dictionary file, defining their
+///         call sites and format strings on first use
+///
+/// @param	file    The file sink's data
+/// @param	buf     The tagged messages
+/// @param	length  Length of the tagged messages
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__collectDictionary(
+        jpLogFile *file,
+        const char *buf,
+        size_t length)
+{
+    unsigned char definition[8 + JP_LOG_DICTMAX];
+    unsigned long long level = 0;
+    unsigned long long line = 0;
+    unsigned long long fileLength = 0;
+    unsigned long long funcLength = 0;
+    unsigned long long fmtLength = 0;
+    unsigned long long size = 0;
+    unsigned char *at = NULL;
+    const char *text = NULL;
+    const char *next = NULL;
+    size_t names = 0;
+    uint32_t id = 0;
+
+    while (length) {
+        // As for indexed files, what is left of a message cut short by
+        // JP_LOG_DROPOLDEST is skipped
+        if (length < JP_LOG_DICTTAGSIZE || buf[0] != JP_LOG_TAGMARK
+                || !jpLog__getHex(buf + 1, 1, &level)
+                || !jpLog__getHex(buf + 2, 8, &line)
+                || !jpLog__getHex(buf + 10, 4, &fileLength)
+                || !jpLog__getHex(buf + 14, 4, &funcLength)
+                || !jpLog__getHex(buf + 18, 4, &fmtLength)
+                || !jpLog__getHex(buf + 22, 8, &size)
+                || level >= JP_LOG_LEVELCOUNT
+                || fileLength + funcLength + fmtLength + 2 > JP_LOG_DICTMAX
+                || size >= JP_LOG_LINEMAX
+                || fileLength + funcLength + fmtLength + size + 1
+                    > length - JP_LOG_DICTTAGSIZE
+                || buf[JP_LOG_DICTTAGSIZE + fileLength + funcLength
+                    + fmtLength + size] != '\n') {
+            next = memchr(buf + 1, JP_LOG_TAGMARK, length - 1);
+            length -= next ? (size_t)(next - buf) : length;
+            buf = next;
+            continue;
+        }
+
+        // Lines of call sites whose names did not fit come whole
+        text = buf + JP_LOG_DICTTAGSIZE;
+        names = (size_t)(fileLength + funcLength + fmtLength);
+        id = JP_LOG_DICTTEXT;
+        if (fileLength) {
+            at = definition;
+            jpLog__put32(at, (uint32_t)level);
+            jpLog__put32(at + 4, (uint32_t)line);
+            at += 8;
+            memcpy(at, text, (size_t)fileLength);
+            at += fileLength;
+            *at++ = '\0';
+            memcpy(at, text + fileLength, (size_t)funcLength);
+            at += funcLength;
+            *at++ = '\0';
+            memcpy(at, text + fileLength + funcLength, (size_t)fmtLength);
+            id = jpLog__define(file, definition, 10 + names);
+        }
+
+        jpLog__addDictEntry(file, id, text + names, (size_t)size);
+
+        buf += JP_LOG_DICTTAGSIZE + names + size + 1;
+        length -= JP_LOG_DICTTAGSIZE + names + size + 1;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Collects tagged lines for an indexed file, adding them to the
+///         index of the block they go in
+///
+/// @param	file    The file sink's data
+/// @param	buf     The tagged lines
+/// @param	length  Length of the tagged lines
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__collectIndexed(
+        jpLogFile *file,
+        const char *buf,
+        size_t length)
+{
+    jpLogBlockIndex *index = &file->blockIndex;
+    unsigned long long time = 0;
+    unsigned long long hash = 0;
+    unsigned long long line = 0;
+    unsigned long long size = 0;
+    unsigned long long level = 0;
+    unsigned char *entry = NULL;
+    const char *next = NULL;
+
+    while (length) {
+        // Dropping the oldest line of a queue cuts a line with a newline
+        // in its message short, so whatever is left of it is skipped
+        if (length < JP_LOG_TAGSIZE || buf[0] != JP_LOG_TAGMARK
+                || !jpLog__getHex(buf + 1, 16, &time)
+                || !jpLog__getHex(buf + 17, 8, &hash)
+                || !jpLog__getHex(buf + 25, 8, &line)
+                || !jpLog__getHex(buf + 33, 8, &size)
+                || !jpLog__getHex(buf + 41, 1, &level)
+                || size > JP_LOG_LINEMAX || size > length - JP_LOG_TAGSIZE
+                || level >= JP_LOG_LEVELCOUNT) {
+            next = memchr(buf + 1, JP_LOG_TAGMARK, length - 1);
+            length -= next ? (size_t)(next - buf) : length;
+            buf = next;
+            continue;
+        }
+
+        if (file->blockSize - file->length < JP_LOG_ENTRYHEADER + size) {
+            jpLog__flushBlock(file);
+        }
+
+        entry = file->block + file->length;
+        jpLog__put64(entry, time);
+        jpLog__put32(entry + 8, (uint32_t)hash);
+        jpLog__put32(entry + 12, (uint32_t)line);
+        jpLog__put32(entry + 16, (uint32_t)size);
+        jpLog__put32(entry + 20, (uint32_t)level);
+        memcpy(entry + JP_LOG_ENTRYHEADER, buf + JP_LOG_TAGSIZE, size);
+        file->length += JP_LOG_ENTRYHEADER + size;
+
+        if (!index->lines || time < index->minTime) {
+            index->minTime = time;
+        }
+        if (!index->lines || time > index->maxTime) {
+            index->maxTime = time;
+        }
+        ++index->lines;
+        index->levels |= 1U << level;
+        jpLog__bloomAdd(index->bloom, (uint32_t)hash);
+        jpLog__bloomAdd(index->bloom,
+                jpLog__siteKey((uint32_t)hash, (uint32_t)line));
+
+        buf += JP_LOG_TAGSIZE + size;
+        length -= JP_LOG_TAGSIZE + size;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to a file, or collects it for compression
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__writeFile(void *data, const char *buf, size_t length)
+{
+    jpLogFile *file = data;
+    size_t copied = 0;
+
+    if (file->path) {
+        if (file->fd < 0) {
+            jpLog__openFile(file);
+        }
+        if (jpLog__rotateDue(file, length)) {
+            jpLog__rotateFile(file);
+        }
+        file->written += length;
+    }
+
+    if (!file->block) {
+        return jpLog__output(file, buf, length);
+    }
+
+    if (file->index) {
+        jpLog__collectIndexed(file, buf, length);
+        return 1;
+    }
+
+    if (file->dictionary) {
+        jpLog__collectDictionary(file, buf, length);
+        return 1;
+    }
+
+    while (length) {
+        copied = file->blockSize - file->length;
+        copied = copied < length ? copied : length;
+        memcpy(file->block + file->length, buf, copied);
+        file->length += copied;
+        buf += copied;
+        length -= copied;
+
+        if (file->length == file->blockSize) {
+            jpLog__flushBlock(file);
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Closes a file sink's file
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__closeFile(void *data)
+{
+    jpLogFile *file = data;
+
+    jpLog__flushFile(file);
+
+    if (file->archiving) {
+        pthread_join(file->archiver, NULL);
+    }
+
+#ifdef JP_LOG_URING
+    if (file->uring) {
+        jpLog__destroyUring(file->uring);
+    }
+#endif
+
+    if (file->definitions) {
+        jpLog__clearDefinitions(file);
+        free(file->definitions);
+    }
+
+    close(file->fd);
+    free(file->path);
+    free(file->buffers);
+    free(file->table);
+    free(file->packed);
+    free(file->block);
+    free(file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to a ring, overwriting the oldest output
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__writeRing(void *data, const char *buf, size_t length)
+{
+    jpLogRing *ring = data;
+    size_t tail = 0;
+    size_t first = 0;
+
+    if (length > ring->size) {
+        buf += length - ring->size;
+        length = ring->size;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+
+    tail = (ring->head + ring->length) % ring->size;
+    first = ring->size - tail < length ? ring->size - tail : length;
+    memcpy(ring->data + tail, buf, first);
+    memcpy(ring->data, buf + first, length - first);
+
+    ring->length += length;
+    if (ring->length > ring->size) {
+        ring->head = (ring->head + ring->length - ring->size) % ring->size;
+        ring->length = ring->size;
+        ring->overwritten = 1;
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Frees a ring sink's ring
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__closeRing(void *data)
+{
+    jpLogRing *ring = data;
+
+    pthread_mutex_destroy(&ring->lock);
+    free(ring->data);
+    free(ring);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sends output to a socket, connecting first if needed
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__writeSocket(void *data, const char *buf, size_t length)
+{
+    jpLogSocket *sock = data;
+    ssize_t sent = 0;
+
+    if (sock->fd < 0) {
+        sock->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock->fd < 0) {
+            return 0;
+        }
+        if (connect(sock->fd, (struct sockaddr *)&sock->addr,
+                    sizeof(sock->addr))) {
+            close(sock->fd);
+            sock->fd = -1;
+            return 0;
+        }
+    }
+
+    while (length) {
+        sent = send(sock->fd, buf, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(sock->fd);
+            sock->fd = -1;
+            return 0;
+        }
+        buf += sent;
+        length -= (size_t)sent;
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Closes a socket sink's socket
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__closeSocket(void *data)
+{
+    jpLogSocket *sock = data;
+
+    if (sock->fd >= 0) {
+        close(sock->fd);
+    }
+    free(sock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Copies into a shard's queue, wrapping around its end
+///
+/// @param	shard   The shard
+/// @param	size    Size of the shard's queue
+/// @param	pos     Position in the queue, not yet taken modulo size
+/// @param	src     What to copy
+/// @param	length  Bytes to copy
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__copyIn(
+        jpLogShard *shard,
+        size_t size,
+        size_t pos,
+        const void *src,
+        size_t length)
+{
+    size_t at = pos % size;
+    size_t first = size - at < length ? size - at : length;
+
+    memcpy(shard->data + at, src, first);
+    memcpy(shard->data, (const char *)src + first, length - first);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Copies out of a shard's queue, wrapping around its end
+///
+/// @param	shard   The shard
+/// @param	size    Size of the shard's queue
+/// @param	pos     Position in the queue, not yet taken modulo size
+/// @param	dst     Where to copy
+/// @param	length  Bytes to copy
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__copyOut(
+        const jpLogShard *shard,
+        size_t size,
+        size_t pos,
+        void *dst,
+        size_t length)
+{
+    size_t at = pos % size;
+    size_t first = size - at < length ? size - at : length;
+
+    memcpy(dst, shard->data + at, first);
+    memcpy((char *)dst + first, shard->data, length - first);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes the lines queued in the shards of a sink so far, oldest
+///         first
+///
+/// Called from the sink's thread without its lock. Each shard is already in
+/// order, so this merges them by the time of the line at their head.
+///
+/// @param	sink    The sink
+/// @param	queued  Receives the most bytes found queued in one shard
+/// @return	Number of bytes written
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__mergeShards(jpLogSink *sink, size_t *queued)
+{
+    size_t size = sink->config.queueSize + JP_LOG_SHARDHEADER;
+    jpLogShard *shards = jpLog__load(&sink->shards);
+    jpLogShard *shard = NULL;
+    jpLogShard *oldest = NULL;
+    unsigned long long header[2];
+    size_t length = 0;
+    size_t total = 0;
+
+    *queued = 0;
+    for (shard = shards; shard; shard = shard->next) {
+        shard->limit = jpLog__load(&shard->tail);
+        if (shard->limit - shard->head > *queued) {
+            *queued = shard->limit - shard->head;
+        }
+        if (shard->head != shard->limit) {
+            jpLog__copyOut(shard, size, shard->head, &shard->time,
+                    sizeof(shard->time));
+        }
+    }
+
+    for (;;) {
+        oldest = NULL;
+        for (shard = shards; shard; shard = shard->next) {
+            if (shard->head != shard->limit
+                    && (!oldest || shard->time < oldest->time)) {
+                oldest = shard;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        jpLog__copyOut(oldest, size, oldest->head, header, sizeof(header));
+        if (length + header[1] > sink->config.queueSize) {
+            sink->write(sink->data, sink->batch, length);
+            total += length;
+            length = 0;
+        }
+
+        jpLog__copyOut(oldest, size, oldest->head + sizeof(header),
+                sink->batch + length, (size_t)header[1]);
+        length += (size_t)header[1];
+        jpLog__store(&oldest->head,
+                oldest->head + sizeof(header) + (size_t)header[1]);
+        if (oldest->head != oldest->limit) {
+            jpLog__copyOut(oldest, size, oldest->head, &oldest->time,
+                    sizeof(oldest->time));
+        }
+    }
+
+    if (length) {
+        sink->write(sink->data, sink->batch, length);
+        total += length;
+    }
+
+    return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether an async sink's thread has nothing to do, and if
+///         so tells producers to wake it
+///
+/// Called with the sink's lock held.
+///
+/// @param	sink    The sink
+/// @return	Nonzero if the sink's thread can wait
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__idle(jpLogSink *sink)
+{
+    jpLogShard *shard = NULL;
+
+    if (sink->length || sink->stopping || sink->flushing) {
+        return 0;
+    }
+
+    // Producers publish a line and then check sleeping, so either they see
+    // it set or this sees their line
+    jpLog__storeSeq(&sink->sleeping, 1);
+    for (shard = jpLog__load(&sink->shards); shard; shard = shard->next) {
+        if (shard->head != jpLog__loadSeq(&shard->tail)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes out the queue of an async sink until it is stopped
+///
+/// @param	arg The sink
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLog__worker(void *arg)
+{
+    jpLogSink *sink = arg;
+    struct timespec deadline;
+    size_t size = sink->config.queueSize;
+    size_t length = 0;
+    size_t first = 0;
+    size_t queued = 0;
+
+    pthread_mutex_lock(&sink->lock);
+
+    for (;;) {
+        while (jpLog__idle(sink)) {
+            if (!sink->flush) {
+                pthread_cond_wait(&sink->notEmpty, &sink->lock);
+                continue;
+            }
+
+            deadline = jpLog__deadline(JP_LOG_FLUSHMS);
+            if (pthread_cond_timedwait(&sink->notEmpty, &sink->lock,
+                        &deadline) == ETIMEDOUT) {
+                sink->flushing = 1;
+            }
+        }
+        jpLog__store(&sink->sleeping, 0);
+
+        if (sink->length) {
+            length = sink->length;
+            first = size - sink->head < length ? size - sink->head : length;
+            memcpy(sink->batch, sink->queue + sink->head, first);
+            memcpy(sink->batch + first, sink->queue, length - first);
+            sink->head = (sink->head + length) % size;
+            sink->length = 0;
+            sink->writing = 1;
+            pthread_cond_broadcast(&sink->notFull);
+            pthread_mutex_unlock(&sink->lock);
+
+            sink->write(sink->data, sink->batch, length);
+
+            pthread_mutex_lock(&sink->lock);
+            sink->stats.bytes += length;
+            sink->writing = 0;
+            continue;
+        }
+
+        if (jpLog__load(&sink->shards)) {
+            sink->writing = 1;
+            pthread_mutex_unlock(&sink->lock);
+
+            length = jpLog__mergeShards(sink, &queued);
+
+            pthread_mutex_lock(&sink->lock);
+            sink->stats.bytes += length;
+            if (queued > sink->stats.queueHighWater) {
+                sink->stats.queueHighWater = queued;
+            }
+            sink->writing = 0;
+            pthread_cond_broadcast(&sink->notFull);
+            if (length) {
+                continue;
+            }
+        }
+
+        // The queue is empty, so anything the sink holds back can go out
+        if (sink->flush) {
+            sink->writing = 1;
+            pthread_mutex_unlock(&sink->lock);
+            sink->flush(sink->data);
+            pthread_mutex_lock(&sink->lock);
+            sink->writing = 0;
+        }
+
+        sink->flushing = 0;
+        ++sink->stats.flushes;
+        pthread_cond_broadcast(&sink->drained);
+
+        if (sink->stopping) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sink->lock);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Drops the oldest line queued for an async sink
+///
+/// Called with the sink's lock held.
+///
+/// @param	sink    The sink, with a non-empty queue
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__dropOldest(jpLogSink *sink)
+{
+    size_t size = sink->config.queueSize;
+    size_t first = size - sink->head < sink->length ? size - sink->head
+        : sink->length;
+    const char *end = memchr(sink->queue + sink->head, '\n', first);
+    size_t length = sink->length;
+
+    if (end) {
+        length = (size_t)(end - (sink->queue + sink->head)) + 1;
+    }
+    else if ((end = memchr(sink->queue, '\n', sink->length - first))) {
+        length = first + (size_t)(end - sink->queue) + 1;
+    }
+
+    sink->head = (sink->head + length) % size;
+    sink->length -= length;
+    ++sink->stats.dropped;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Queues a line for an async sink, applying its overflow policy if
+///         there is no room
+///
+/// @param	sink    The sink
+/// @param	line    The line
+/// @param	length  Length of the line, at most the size of the queue
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__enqueue(jpLogSink *sink, const char *line, size_t length)
+{
+    struct timespec start;
+    struct timespec end;
+    size_t size = sink->config.queueSize;
+    size_t tail = 0;
+    size_t first = 0;
+
+    pthread_mutex_lock(&sink->lock);
+
+    if (size - sink->length < length) {
+        switch (sink->config.overflow) {
+        case JP_LOG_DROPNEWEST:
+            ++sink->stats.dropped;
+            pthread_mutex_unlock(&sink->lock);
+            return;
+        case JP_LOG_DROPOLDEST:
+            while (size - sink->length < length) {
+                jpLog__dropOldest(sink);
+            }
+            break;
+        case JP_LOG_SPILL:
+            ++sink->stats.spilled;
+            pthread_mutex_unlock(&sink->lock);
+            jpLog__writeAll(sink->spillFd, line, length);
+            return;
+        case JP_LOG_BLOCK:
+        default:
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            while (size - sink->length < length) {
+                pthread_cond_wait(&sink->notFull, &sink->lock);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            sink->stats.blockedNs += (unsigned long long)
+                ((end.tv_sec - start.tv_sec) * 1000000000LL
+                 + (end.tv_nsec - start.tv_nsec));
+            break;
+        }
+    }
+
+    tail = (sink->head + sink->length) % size;
+    first = size - tail < length ? size - tail : length;
+    memcpy(sink->queue + tail, line, first);
+    memcpy(sink->queue, line + first, length - first);
+    sink->length += length;
+    if (sink->length > sink->stats.queueHighWater) {
+        sink->stats.queueHighWater = sink->length;
+    }
+
+    pthread_cond_signal(&sink->notEmpty);
+    pthread_mutex_unlock(&sink->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Waits until an async sink has written everything queued
+///
+/// @param	sink    The sink
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__drain(jpLogSink *sink)
+{
+    pthread_mutex_lock(&sink->lock);
+    sink->flushing = 1;
+    pthread_cond_signal(&sink->notEmpty);
+    while (sink->length || sink->writing || sink->flushing) {
+        pthread_cond_wait(&sink->drained, &sink->lock);
+    }
+    pthread_mutex_unlock(&sink->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds the counters of a sink to a total
+///
+/// @param	total   The total
+/// @param	stats   Counters of the sink
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__addSinkStats(
+        jpLogSinkStats *total,
+        const jpLogSinkStats *stats)
+{
+    total->dropped += stats->dropped;
+    total->spilled += stats->spilled;
+    total->blockedNs += stats->blockedNs;
+    total->bytes += stats->bytes;
+    total->flushes += stats->flushes;
+    if (stats->queueHighWater > total->queueHighWater) {
+        total->queueHighWater = stats->queueHighWater;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stops an async sink's thread and frees a sink
+///
+/// @param	sink    The sink
+/// @param	total   Receives the sink's final counters added up, or NULL
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__destroySink(jpLogSink *sink, jpLogSinkStats *total)
+{
+    jpLogSinkStats stats;
+    jpLogShard *shard = NULL;
+
+    if (sink->config.async) {
+        pthread_mutex_lock(&sink->lock);
+        sink->stopping = 1;
+        pthread_cond_signal(&sink->notEmpty);
+        pthread_mutex_unlock(&sink->lock);
+        pthread_join(sink->thread, NULL);
+    }
+
+    if (sink->close) {
+        sink->close(sink->data);
+    }
+
+    if (total) {
+        jpLog_getSinkStats(sink, &stats);
+        jpLog__addSinkStats(total, &stats);
+    }
+
+    while ((shard = sink->shards)) {
+        sink->shards = shard->next;
+        free(shard->data);
+        free(shard);
+    }
+
+    pthread_cond_destroy(&sink->drained);
+    pthread_cond_destroy(&sink->notFull);
+    pthread_cond_destroy(&sink->notEmpty);
+    pthread_mutex_destroy(&sink->lock);
+    if (sink->spillFd >= 0) {
+        close(sink->spillFd);
+    }
+    free(sink->batch);
+    free(sink->queue);
+    free(sink);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the number of sinks
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__countSinks(void)
+{
+    return jpLog__load(&jpLog__sinkCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Recomputes jpLog__minLevel - called with jpLog__sinksLock held
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__updateMinLevel(void)
+{
+    int minLevel = jpLog__sinkCount ? JP_LOG_LEVELCOUNT : JP_LOG_INFO;
+    size_t i;
+
+    for (i = 0; i < jpLog__sinkCount; ++i) {
+        if ((int)jpLog__sinks[i]->config.minLevel < minLevel) {
+            minLevel = jpLog__sinks[i]->config.minLevel;
+        }
+    }
+
+    jpLog__store(&jpLog__minLevel, minLevel);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Releases a thread's flight recorder ring when the thread exits
+///
+/// @param	data    The ring
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__releaseRecorder(void *data)
+{
+    jpLogRecorder *recorder = data;
+
+    jpLog__store(&recorder->inUse, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the calling thread's flight recorder ring
+///
+/// @return	The ring, or NULL if the recorder is disabled, out of memory or
+///         has no ring left in steady state
+///////////////////////////////////////////////////////////////////////////////
+static jpLogRecorder *jpLog__threadRecorder(void)
+{
+    jpLogRecorder *recorder = jpLog__recorder;
+
+    if (recorder || !jpLog__load(&jpLog__recorderSize)) {
+        return recorder;
+    }
+
+    pthread_mutex_lock(&jpLog__recorderLock);
+
+    for (recorder = jpLog__recorders; recorder; recorder = recorder->next) {
+        if (!recorder->inUse) {
+            break;
+        }
+    }
+
+    if (!recorder && !jpLog__load(&jpLog__steady)) {
+        recorder = calloc(1, sizeof(*recorder)
+                + jpLog__recorderSize * sizeof(recorder->entries[0]));
+        if (recorder) {
+            recorder->next = jpLog__recorders;
+            jpLog__store(&jpLog__recorders, recorder);
+        }
+    }
+
+    if (!recorder) {
+        pthread_mutex_unlock(&jpLog__recorderLock);
+        return NULL;
+    }
+
+    recorder->thread = jpLog__recorderThreads++;
+    recorder->count = 0;
+    recorder->inUse = 1;
+    pthread_setspecific(jpLog__recorderKey, recorder);
+    jpLog__recorder = recorder;
+
+    pthread_mutex_unlock(&jpLog__recorderLock);
+    return recorder;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds unused flight recorder rings until there is one for each of
+///         a number of threads
+///
+/// @param	threads Number of threads
+/// @return	Nonzero on success, zero if out of memory
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__addRecorders(size_t threads)
+{
+    jpLogRecorder *recorder = NULL;
+    size_t count = 0;
+
+    pthread_mutex_lock(&jpLog__recorderLock);
+
+    for (recorder = jpLog__recorders; recorder; recorder = recorder->next) {
+        ++count;
+    }
+
+    for (; count < threads; ++count) {
+        recorder = calloc(1, sizeof(*recorder)
+                + jpLog__recorderSize * sizeof(recorder->entries[0]));
+        if (!recorder) {
+            break;
+        }
+
+        recorder->next = jpLog__recorders;
+        jpLog__store(&jpLog__recorders, recorder);
+    }
+
+    pthread_mutex_unlock(&jpLog__recorderLock);
+    return count >= threads;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Releases a thread's counters when it exits
+///
+/// @param	data    The counters
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__releaseCounters(void *data)
+{
+    jpLogCounters *counters = data;
+
+    jpLog__store(&counters->inUse, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Creates the key that releases counters when their thread exits
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__createCountersKey(void)
+{
+    jpLog__countersKeyOk = !pthread_key_create(&jpLog__countersKey,
+            jpLog__releaseCounters);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the calling thread's counters, setting them up on first
+///         use
+///
+/// @return	The counters, or NULL if they could not be allocated or none
+///         are left in steady state
+///////////////////////////////////////////////////////////////////////////////
+static jpLogCounters *jpLog__getCounters(void)
+{
+    jpLogCounters *counters = jpLog__threadCounters;
+
+    if (counters) {
+        return counters;
+    }
+
+    pthread_once(&jpLog__countersOnce, jpLog__createCountersKey);
+    if (!jpLog__countersKeyOk) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&jpLog__countersLock);
+
+    for (counters = jpLog__counters; counters; counters = counters->next) {
+        if (!jpLog__load(&counters->inUse)) {
+            break;
+        }
+    }
+
+    if (!counters) {
+        counters = jpLog__load(&jpLog__steady) ? NULL
+            : calloc(1, sizeof(*counters));
+        if (!counters) {
+            pthread_mutex_unlock(&jpLog__countersLock);
+            return NULL;
+        }
+
+        counters->next = jpLog__counters;
+        jpLog__counters = counters;
+    }
+
+    counters->inUse = 1;
+    pthread_setspecific(jpLog__countersKey, counters);
+    jpLog__threadCounters = counters;
+
+    pthread_mutex_unlock(&jpLog__countersLock);
+    return counters;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds unused counters until there are counters for each of a
+///         number of threads
+///
+/// @param	threads Number of threads
+/// @return	Nonzero on success, zero if out of memory
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__addCounters(size_t threads)
+{
+    jpLogCounters *counters = NULL;
+    size_t count = 0;
+
+    pthread_once(&jpLog__countersOnce, jpLog__createCountersKey);
+    pthread_mutex_lock(&jpLog__countersLock);
+
+    for (counters = jpLog__counters; counters; counters = counters->next) {
+        ++count;
+    }
+
+    for (; count < threads; ++count) {
+        counters = calloc(1, sizeof(*counters));
+        if (!counters) {
+            break;
+        }
+
+        counters->next = jpLog__counters;
+        jpLog__counters = counters;
+    }
+
+    pthread_mutex_unlock(&jpLog__countersLock);
+    return count >= threads;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a shard to a sharded async sink
+///
+/// @param	sink    The sink
+/// @param	owned   Zero for a spare shard that no thread has taken yet
+/// @return	The shard, or NULL if it could not be allocated
+///////////////////////////////////////////////////////////////////////////////
+static jpLogShard *jpLog__addShard(jpLogSink *sink, int owned)
+{
+    jpLogShard *shard = calloc(1, sizeof(*shard));
+
+    if (!shard) {
+        return NULL;
+    }
+
+    shard->data = malloc(sink->config.queueSize + JP_LOG_SHARDHEADER);
+    if (!shard->data) {
+        free(shard);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    shard->owned = owned;
+    shard->next = sink->shards;
+    jpLog__store(&sink->shards, shard);
+    pthread_mutex_unlock(&sink->lock);
+
+    return shard;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds spare shards to a sharded async sink until it has one for
+///         each of a number of threads
+///
+/// @param	sink    The sink
+/// @param	threads Number of threads
+/// @return	Nonzero on success, zero if out of memory
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__addSpareShards(jpLogSink *sink, size_t threads)
+{
+    const jpLogShard *shard = NULL;
+    size_t count = 0;
+
+    pthread_mutex_lock(&sink->lock);
+    for (shard = sink->shards; shard; shard = shard->next) {
+        ++count;
+    }
+    pthread_mutex_unlock(&sink->lock);
+
+    for (; count < threads; ++count) {
+        if (!jpLog__addShard(sink, 0)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the calling thread's shard of a sharded async sink,
+///         taking a spare or adding one on first use
+///
+/// @param	sink    The sink
+/// @param	slot    Index of the sink in jpLog__sinks
+/// @return	The shard, or NULL if it could not be allocated or none is left
+///         in steady state
+///////////////////////////////////////////////////////////////////////////////
+static jpLogShard *jpLog__getShard(jpLogSink *sink, size_t slot)
+{
+    jpLogCounters *counters = jpLog__getCounters();
+    jpLogShard *shard = NULL;
+
+    if (!counters) {
+        return NULL;
+    }
+
+    if (counters->shardSinks[slot] == sink->id) {
+        return counters->shards[slot];
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    for (shard = sink->shards; shard && shard->owned; shard = shard->next) {
+    }
+    if (shard) {
+        shard->owned = 1;
+    }
+    pthread_mutex_unlock(&sink->lock);
+
+    if (!shard && !jpLog__load(&jpLog__steady)) {
+        shard = jpLog__addShard(sink, 1);
+    }
+    if (!shard) {
+        return NULL;
+    }
+
+    counters->shards[slot] = shard;
+    counters->shardSinks[slot] = sink->id;
+    return shard;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Queues a line in the calling thread's shard of a sharded async
+///         sink, applying its overflow policy if there is no room
+///
+/// Nothing is shared with other producers unless the sink's thread is
+/// waiting for lines or the shard is full. JP_LOG_DROPOLDEST drops the new
+/// line like JP_LOG_DROPNEWEST, since only the sink's thread takes lines out
+/// of a shard.
+///
+/// @param	sink    The sink
+/// @param	slot    Index of the sink in jpLog__sinks
+/// @param	line    The line
+/// @param	length  Length of the line, at most the size of the queue
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__enqueueShard(
+        jpLogSink *sink,
+        size_t slot,
+        const char *line,
+        size_t length)
+{
+    jpLogShard *shard = jpLog__getShard(sink, slot);
+    size_t size = sink->config.queueSize + JP_LOG_SHARDHEADER;
+    size_t needed = JP_LOG_SHARDHEADER + length;
+    unsigned long long header[2];
+    unsigned long long start = 0;
+
+    if (!shard) {
+        jpLog__enqueue(sink, line, length);
+        return;
+    }
+
+    if (size - (shard->tail - jpLog__load(&shard->head)) < needed) {
+        switch (sink->config.overflow) {
+        case JP_LOG_DROPNEWEST:
+        case JP_LOG_DROPOLDEST:
+            jpLog__add(&shard->dropped, 1);
+            return;
+        case JP_LOG_SPILL:
+            jpLog__add(&shard->spilled, 1);
+            jpLog__writeAll(sink->spillFd, line, length);
+            return;
+        case JP_LOG_BLOCK:
+        default:
+            start = jpLog__now();
+            pthread_mutex_lock(&sink->lock);
+            while (size - (shard->tail - jpLog__load(&shard->head))
+                    < needed) {
+                pthread_cond_signal(&sink->notEmpty);
+                pthread_cond_wait(&sink->notFull, &sink->lock);
+            }
+            pthread_mutex_unlock(&sink->lock);
+            jpLog__add(&shard->blockedNs, jpLog__now() - start);
+            break;
+        }
+    }
+
+    header[0] = jpLog__now();
+    header[1] = length;
+    jpLog__copyIn(shard, size, shard->tail, header, sizeof(header));
+    jpLog__copyIn(shard, size, shard->tail + sizeof(header), line, length);
+    jpLog__storeSeq(&shard->tail, shard->tail + needed);
+
+    // Only wake the sink's thread if it is waiting for lines
+    if (jpLog__loadSeq(&sink->sleeping)) {
+        pthread_mutex_lock(&sink->lock);
+        pthread_cond_signal(&sink->notEmpty);
+        pthread_mutex_unlock(&sink->lock);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the time to start timing a logging call from, or 0 if
+///         calls are not being timed
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__startTiming(void)
+{
+    return jpLog__load(&jpLog__timing) ? jpLog__now() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds the time a logging call took to the calling thread's
+///         counters
+///
+/// @param	start   Time from jpLog__startTiming
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__stopTiming(unsigned long long start)
+{
+    jpLogCounters *counters = NULL;
+
+    if (start && (counters = jpLog__getCounters())) {
+        jpLog__add(&counters->timeNs, jpLog__now() - start);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Counts a message in the calling thread's counters
+///
+/// @param	level   Level of the message
+/// @param	wanted  Nonzero if a sink accepted the message
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__count(jpLogLevel level, int wanted)
+{
+    jpLogCounters *counters = jpLog__getCounters();
+
+    if (!counters) {
+        return;
+    }
+
+    if (wanted) {
+        jpLog__add(&counters->records[level], 1);
+    }
+    else {
+        jpLog__add(&counters->suppressed, 1);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends a string to a buffer - async-signal-safe
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	str     The string
+/// @param	strLength   Length of the string
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__append(
+        char *buf,
+        size_t length,
+        size_t size,
+        const char *str,
+        size_t strLength)
+{
+    // A smaller size than an earlier append's must not wrap below
+    if (length >= size) {
+        return length;
+    }
+
+    if (strLength > size - length) {
+        strLength = size - length;
+    }
+
+    memcpy(buf + length, str, strLength);
+    return length + strLength;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends an unsigned decimal number to a buffer - async-signal-safe
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	value   The number
+/// @param	width   Minimum number of digits, padded with zeros
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendUint(
+        char *buf,
+        size_t length,
+        size_t size,
+        unsigned long long value,
+        int width)
+{
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *first = end;
+    size_t pair = 0;
+
+    // Two digits per division
+    while (value >= 100) {
+        pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        first -= 2;
+        memcpy(first, &jpLog__digits[pair], 2);
+    }
+
+    if (value >= 10) {
+        first -= 2;
+        memcpy(first, &jpLog__digits[value * 2], 2);
+    }
+    else {
+        *--first = (char)('0' + value);
+    }
+
+    while (end - first < width) {
+        *--first = '0';
+    }
+
+    return jpLog__append(buf, length, size, first, (size_t)(end - first));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends an unsigned hexadecimal number to a buffer
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	value   The number
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendHex(
+        char *buf,
+        size_t length,
+        size_t size,
+        unsigned long long value)
+{
+    char digits[16];
+    char *end = digits + sizeof(digits);
+    char *first = end;
+
+    do {
+        *--first = jpLog__hexDigits[value & 15];
+        value >>= 4;
+    } while (value);
+
+    return jpLog__append(buf, length, size, first, (size_t)(end - first));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a flight recorder ring to jpLog__recorderFd -
+///         async-signal-safe
+///
+/// @param	recorder    The ring
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__dumpRecorder(const jpLogRecorder *recorder)
+{
+    const jpLogRecorderEntry *entry = NULL;
+    char line[JP_LOG_RECORDERMSG + 512];
+    size_t names = sizeof(line) - JP_LOG_RECORDERMSG - 32;
+    size_t size = jpLog__recorderSize;
+    size_t count = jpLog__load(&recorder->count);
+    size_t length = 0;
+    size_t i;
+
+    length = jpLog__append(line, 0, sizeof(line), "-- thread ", 10);
+    length = jpLog__appendUint(line, length, sizeof(line), recorder->thread, 1);
+    length = jpLog__append(line, length, sizeof(line), ", ", 2);
+    length = jpLog__appendUint(line, length, sizeof(line),
+            count < size ? count : size, 1);
+    length = jpLog__append(line, length, sizeof(line), " records --\n", 12);
+    jpLog__writeAll(jpLog__recorderFd, line, length);
+
+    for (i = count < size ? 0 : count - size; i < count; ++i) {
+        entry = &recorder->entries[i % size];
+        length = jpLog__append(line, 0, sizeof(line), "[", 1);
+        length = jpLog__appendUint(line, length, sizeof(line),
+                (unsigned long long)entry->time.tv_sec, 1);
+        length = jpLog__append(line, length, sizeof(line), ".", 1);
+        length = jpLog__appendUint(line, length, sizeof(line),
+                (unsigned long long)entry->time.tv_nsec, 9);
+        length = jpLog__append(line, length, sizeof(line), "][", 2);
+        length = jpLog__append(line, length, sizeof(line),
+                jpLog__levelNames[entry->level], 4);
+        length = jpLog__append(line, length, sizeof(line), "][", 2);
+        // Long names are cut short so the message and newline always fit
+        length = jpLog__append(line, length, names, entry->file,
+                strlen(entry->file));
+        length = jpLog__append(line, length, sizeof(line), "][", 2);
+        length = jpLog__append(line, length, names, entry->func,
+                strlen(entry->func));
+        length = jpLog__append(line, length, sizeof(line), "][", 2);
+        length = jpLog__appendUint(line, length, sizeof(line),
+                (unsigned long long)entry->line, 1);
+        length = jpLog__append(line, length, sizeof(line), "]: ", 3);
+        length = jpLog__append(line, length, sizeof(line) - 1, entry->msg,
+                entry->length);
+        length = jpLog__append(line, length, sizeof(line), "\n", 1);
+        jpLog__writeAll(jpLog__recorderFd, line, length);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Dumps the flight recorder and re-raises a fatal signal
+///
+/// Installed with SA_RESETHAND, so the signal's default action (usually a
+/// core dump) happens when it is raised again.
+///
+/// @param	sig The signal
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__crashHandler(int sig)
+{
+    jpLog_dumpRecorder();
+    raise(sig);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends a string to a buffer, escaping quotes, backslashes and
+///         control characters
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	str     The string
+/// @param	strLength   Length of the string
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendEscaped(
+        char *buf,
+        size_t length,
+        size_t size,
+        const char *str,
+        size_t strLength)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escape[6] = { '\\', 'u', '0', '0', 0, 0 };
+    size_t start = 0;
+    size_t i;
+    unsigned char c = 0;
+
+    for (i = 0; i < strLength; ++i) {
+        c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Copy the run of plain characters before this one at once
+        length = jpLog__append(buf, length, size, str + start, i - start);
+        start = i + 1;
+
+        switch (c) {
+        case '"':
+        case '\\':
+            escape[1] = (char)c;
+            length = jpLog__append(buf, length, size, escape, 2);
+            break;
+        case '\n':
+            length = jpLog__append(buf, length, size, "\\n", 2);
+            break;
+        case '\r':
+            length = jpLog__append(buf, length, size, "\\r", 2);
+            break;
+        case '\t':
+            length = jpLog__append(buf, length, size, "\\t", 2);
+            break;
+        default:
+            escape[1] = 'u';
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 15];
+            length = jpLog__append(buf, length, size, escape, 6);
+            break;
+        }
+    }
+
+    return jpLog__append(buf, length, size, str + start, i - start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends a string to a buffer as a logfmt value
+///
+/// The string is quoted if it is empty or contains spaces, '=', quotes,
+/// backslashes or control characters.
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	str     The string
+/// @param	strLength   Length of the string
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendLogfmt(
+        char *buf,
+        size_t length,
+        size_t size,
+        const char *str,
+        size_t strLength)
+{
+    int quote = !strLength;
+    size_t i;
+
+    for (i = 0; i < strLength && !quote; ++i) {
+        quote = (unsigned char)str[i] <= ' ' || str[i] == '='
+            || str[i] == '"' || str[i] == '\\';
+    }
+
+    if (!quote) {
+        return jpLog__append(buf, length, size, str, strLength);
+    }
+
+    length = jpLog__append(buf, length, size, "\"", 1);
+    length = jpLog__appendEscaped(buf, length, size, str, strLength);
+    return jpLog__append(buf, length, size, "\"", 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends a signed decimal number to a buffer
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	value   The number
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendInt(
+        char *buf,
+        size_t length,
+        size_t size,
+        long long value)
+{
+    if (value < 0) {
+        length = jpLog__append(buf, length, size, "-", 1);
+        return jpLog__appendUint(buf, length, size,
+                0ULL - (unsigned long long)value, 1);
+    }
+
+    return jpLog__appendUint(buf, length, size, (unsigned long long)value, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends the shortest decimal form of a double that reads back as
+///         the same double
+///
+/// Any normal double that round-trips through 15 significant digits has its
+/// shortest form there, with %g dropping the trailing zeros; the rest need
+/// 16 or 17. Subnormals have fewer digits of precision, so they are tried
+/// from 1.
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	value   The number
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendDouble(
+        char *buf,
+        size_t length,
+        size_t size,
+        double value)
+{
+    char number[32];
+    int precision = fpclassify(value) == FP_SUBNORMAL ? 1 : 15;
+    int result = 0;
+
+    for (;;) {
+        result = snprintf(number, sizeof(number), "%.*g", precision, value);
+        if (precision == 17 || strtod(number, NULL) == value) {
+            break;
+        }
+        ++precision;
+    }
+
+    return jpLog__append(buf, length, size, number,
+            result > 0 ? (size_t)result : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends the fields of a record to a buffer
+///
+/// Fields are appended as ' key=value' for logfmt and ',"key":value' for
+/// JSON.
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	fields  The fields
+/// @param	count   Number of fields
+/// @param	json    If nonzero, the fields are appended as JSON
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendFields(
+        char *buf,
+        size_t length,
+        size_t size,
+        const jpLogField *fields,
+        size_t count,
+        int json)
+{
+    const jpLogField *field = NULL;
+    const char *str = NULL;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        field = &fields[i];
+        if (json) {
+            length = jpLog__append(buf, length, size, ",\"", 2);
+            length = jpLog__appendEscaped(buf, length, size, field->key,
+                    strlen(field->key));
+            length = jpLog__append(buf, length, size, "\":", 2);
+        }
+        else {
+            length = jpLog__append(buf, length, size, " ", 1);
+            length = jpLog__append(buf, length, size, field->key,
+                    strlen(field->key));
+            length = jpLog__append(buf, length, size, "=", 1);
+        }
+
+        switch (field->type) {
+        case JP_LOG_FIELD_INT:
+            length = jpLog__appendInt(buf, length, size, field->value.i);
+            break;
+        case JP_LOG_FIELD_UINT:
+            length = jpLog__appendUint(buf, length, size, field->value.u, 1);
+            break;
+        case JP_LOG_FIELD_DOUBLE:
+            if (json && !isfinite(field->value.d)) {
+                length = jpLog__append(buf, length, size, "null", 4);
+                break;
+            }
+            length = jpLog__appendDouble(buf, length, size, field->value.d);
+            break;
+        case JP_LOG_FIELD_BOOL:
+            length = field->value.u ? jpLog__append(buf, length, size,
+                    "true", 4) : jpLog__append(buf, length, size, "false", 5);
+            break;
+        case JP_LOG_FIELD_STR:
+        default:
+            str = field->value.s ? field->value.s : "";
+            if (json) {
+                length = jpLog__append(buf, length, size, "\"", 1);
+                length = jpLog__appendEscaped(buf, length, size, str,
+                        strlen(str));
+                length = jpLog__append(buf, length, size, "\"", 1);
+            }
+            else {
+                length = jpLog__appendLogfmt(buf, length, size, str,
+                        strlen(str));
+            }
+            break;
+        }
+    }
+
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the type a conversion takes, encoded as by jpLog__type
+///
+/// @param	spec    The conversion, which takes an argument
+///////////////////////////////////////////////////////////////////////////////
+static char jpLog__specType(const jpLogSpec *spec)
+{
+    switch (spec->conv) {
+    case 's':
+    case 'p':
+        return spec->conv;
+    case 'f':
+    case 'g':
+        return 'f';
+    default:
+        break;
+    }
+
+    switch (spec->size) {
+    case 'l':
+    case 'q':
+        return spec->size;
+    case 'z':
+        return sizeof(size_t) == sizeof(long) ? 'l'
+            : sizeof(size_t) == sizeof(long long) ? 'q' : 'i';
+    default:
+        return 'i';
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Parses a format string
+///
+/// @param	fmt     The format string
+/// @param	format  Receives the conversions, with supported set to zero if
+///                 the format needs vsnprintf
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__parseFormat(const char *fmt, jpLogFormat *format)
+{
+    const char *end = fmt + strlen(fmt);
+    const char *p = fmt;
+    jpLogSpec *spec = NULL;
+    size_t args = 0;
+
+    format->supported = 0;
+    format->length = (size_t)(end - fmt);
+    format->count = 0;
+    if (format->length > 0xFFFF) {
+        return;
+    }
+
+    while ((p = memchr(p, '%', (size_t)(end - p)))) {
+        if (format->count == JP_LOG_MAXSPECS) {
+            return;
+        }
+
+        spec = &format->specs[format->count++];
+        spec->offset = (unsigned short)(p - fmt);
+        spec->size = 0;
+        if (*++p == 'z') {
+            spec->size = 'z';
+            ++p;
+        }
+        else if (*p == 'l') {
+            spec->size = *++p == 'l' ? 'q' : 'l';
+            p += spec->size == 'q';
+        }
+
+        spec->conv = *p++;
+        switch (spec->conv) {
+        case 'd':
+        case 'u':
+        case 'x':
+            break;
+        case 's':
+        case 'p':
+        case 'f':
+        case 'g':
+        case '%':
+            if (spec->size) {
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+
+        spec->length = (unsigned char)(p - fmt - spec->offset);
+        memcpy(spec->text, fmt + spec->offset, spec->length);
+        spec->text[spec->length] = '\0';
+        if (spec->conv != '%') {
+            format->types[args++] = jpLog__specType(spec);
+        }
+    }
+
+    format->types[args] = '\0';
+    format->supported = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks the types of a message's arguments against its supported
+///         parsed format string
+///
+/// Signedness may differ, as printf allows.
+///
+/// @param	format  The parse
+/// @param	types   Types of the arguments, encoded by jpLog__types, or NULL
+///                 if they are not known
+/// @return	Nonzero if the types match or are not known
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__typesMatch(const jpLogFormat *format, const char *types)
+{
+    const char *expected = format->types;
+
+    if (!types) {
+        return 1;
+    }
+
+    for (; *expected && *types; ++expected, ++types) {
+        if (*expected != *types
+                && !(*expected == 'p' && *types == 's')
+                && !(strchr("ilq", *expected) && *types == *expected - 32)) {
+            return 0;
+        }
+    }
+
+    return *expected == *types;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the cached parse of a format string, parsing it on first
+///         use
+///
+/// The cache is keyed by address, so each call site's format string is
+/// parsed once. A string at a cached address may since have changed (if it
+/// was not a literal), which jpLog__format checks for.
+///
+/// @param	fmt     The format string
+/// @return	The parse, or NULL if it is not cached
+///////////////////////////////////////////////////////////////////////////////
+static const jpLogFormat *jpLog__findFormat(const char *fmt)
+{
+#ifdef __GNUC__
+    jpLogFormat *format = NULL;
+    const char *key = NULL;
+    uint32_t hash = (uint32_t)((uintptr_t)fmt * 2654435761U)
+        >> (32 - JP_LOG_FORMATBITS);
+    size_t i;
+
+    for (i = 0; i < JP_LOG_FORMATPROBES; ++i) {
+        format = &jpLog__formats[(hash + i) & ((1 << JP_LOG_FORMATBITS) - 1)];
+        key = jpLog__load(&format->fmt);
+        if (!key) {
+            if (__atomic_compare_exchange_n(&format->fmt, &key, fmt, 0,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                jpLog__parseFormat(fmt, format);
+                jpLog__store(&format->ready, 1);
+                return format;
+            }
+        }
+
+        // Another thread may still be parsing it
+        if (key == fmt) {
+            return jpLog__load(&format->ready) ? format : NULL;
+        }
+    }
+#else
+    (void)fmt;
+#endif
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a message with a supported parsed format string
+///
+/// Fails if the string no longer matches the parse, after consuming part of
+/// ap and writing part of the message.
+///
+/// @param	format  The parse
+/// @param	fmt     The format string
+/// @param	buf     The buffer
+/// @param	size    Size of the buffer, at least 1
+/// @param	ap      Format arguments
+/// @param	length  Receives the length of the message, truncated to fit
+/// @param	args    Receives where each argument went, may be NULL
+/// @return	Nonzero on success, zero if the string does not match the parse
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__format(
+        const jpLogFormat *format,
+        const char *fmt,
+        char *buf,
+        size_t size,
+        va_list ap,
+        size_t *length,
+        jpLogArgs *args)
+{
+    const jpLogSpec *spec = NULL;
+    const char *p = fmt;
+    const char *str = NULL;
+    size_t limit = size - 1;
+    size_t len = 0;
+    size_t start = 0;
+    size_t count = 0;
+    size_t literal = 0;
+    long long value = 0;
+    unsigned long long uvalue = 0;
+    int result = 0;
+    size_t i;
+
+    for (i = 0; i <= format->count; ++i) {
+        spec = &format->specs[i];
+
+        // strcspn stops at the end of a shorter string
+        literal = (i < format->count ? spec->offset : format->length)
+            - (size_t)(p - fmt);
+        if (strcspn(p, "%") != literal || (i == format->count && p[literal])) {
+            return 0;
+        }
+
+        len = jpLog__append(buf, len, limit, p, literal);
+        p += literal;
+        if (i == format->count) {
+            break;
+        }
+
+        if (strncmp(p, spec->text, spec->length)) {
+            return 0;
+        }
+        p += spec->length;
+
+        start = len;
+        switch (spec->conv) {
+        case 'd':
+            switch (spec->size) {
+            case 'l': value = va_arg(ap, long); break;
+            case 'q': value = va_arg(ap, long long); break;
+            case 'z': value = va_arg(ap, ssize_t); break;
+            default: value = va_arg(ap, int); break;
+            }
+            len = jpLog__appendInt(buf, len, limit, value);
+            break;
+        case 'u':
+        case 'x':
+            switch (spec->size) {
+            case 'l': uvalue = va_arg(ap, unsigned long); break;
+            case 'q': uvalue = va_arg(ap, unsigned long long); break;
+            case 'z': uvalue = va_arg(ap, size_t); break;
+            default: uvalue = va_arg(ap, unsigned); break;
+            }
+            len = spec->conv == 'u' ? jpLog__appendUint(buf, len, limit,
+                    uvalue, 1) : jpLog__appendHex(buf, len, limit, uvalue);
+            break;
+        case 's':
+            str = va_arg(ap, const char *);
+            str = str ? str : "(null)";
+            len = jpLog__append(buf, len, limit, str, strlen(str));
+            break;
+        case 'p':
+            uvalue = (uintptr_t)va_arg(ap, void *);
+            if (!uvalue) {
+                len = jpLog__append(buf, len, limit, "(nil)", 5);
+                break;
+            }
+            len = jpLog__append(buf, len, limit, "0x", 2);
+            len = jpLog__appendHex(buf, len, limit, uvalue);
+            break;
+        case 'f':
+        case 'g':
+            // Left to snprintf, which rounds exactly as vsnprintf would
+            result = snprintf(buf + len, size - len, spec->text,
+                    va_arg(ap, double));
+            len += result < 0 ? 0 : (size_t)result;
+            len = len < limit ? len : limit;
+            break;
+        case '%':
+        default:
+            len = jpLog__append(buf, len, limit, "%", 1);
+            break;
+        }
+
+        if (args && spec->conv != '%') {
+            args->starts[count] = start;
+            args->ends[count++] = len;
+        }
+    }
+
+    // A truncated message no longer splits into its arguments
+    if (args && len < limit) {
+        args->fmt = fmt;
+        args->count = count;
+    }
+
+    buf[len] = '\0';
+    *length = len;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a message, like vsnprintf but faster for the supported
+///         subset of printf
+///
+/// @param	buf     The buffer
+/// @param	size    Size of the buffer, at least 1
+/// @param	fmt     Format string
+/// @param	ap      Format arguments
+/// @param	types   Types of the format arguments, encoded by jpLog__types,
+///                 or NULL if they are not known
+/// @param	args    Receives where each argument went, may be NULL
+/// @return	Length of the message, truncated to fit
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__vformat(
+        char *buf,
+        size_t size,
+        const char *fmt,
+        va_list ap,
+        const char *types,
+        jpLogArgs *args)
+{
+    jpLogFormat parsed;
+    const jpLogFormat *format = jpLog__findFormat(fmt);
+    size_t length = 0;
+    int result = 0;
+    va_list copy;
+
+    if (args) {
+        args->fmt = NULL;
+    }
+
+    va_copy(copy, ap);
+    if (format && format->supported && jpLog__typesMatch(format, types)
+            && jpLog__format(format, fmt, buf, size, ap, &length, args)) {
+        va_end(copy);
+        return length;
+    }
+
+    // Not cached, or the string changed since it was, or the arguments
+    // do not match it - reading them anyway would be undefined
+    if (!format || format->supported) {
+        jpLog__parseFormat(fmt, &parsed);
+        if (parsed.supported && !jpLog__typesMatch(&parsed, types)) {
+            length = jpLog__append(buf, 0, size - 1, "format mismatch: ", 17);
+            length = jpLog__append(buf, length, size - 1, fmt, parsed.length);
+            buf[length] = '\0';
+            va_end(copy);
+            return length;
+        }
+        if (parsed.supported) {
+            jpLog__format(&parsed, fmt, buf, size, copy, &length, args);
+            va_end(copy);
+            return length;
+        }
+    }
+
+    result = vsnprintf(buf, size, fmt, copy);
+    va_end(copy);
+    length = result < 0 ? 0 : (size_t)result;
+
+    return length < size ? length : size - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends "[LEVEL][file][func][line]: " to a buffer
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	level   Level of the message
+/// @param	file    Name of the file that logged the message
+/// @param	func    Name of the function that logged the message
+/// @param	line    Line that logged the message
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendPrefix(
+        char *buf,
+        size_t length,
+        size_t size,
+        jpLogLevel level,
+        const char *file,
+        const char *func,
+        int line)
+{
+    length = jpLog__append(buf, length, size, "[", 1);
+    length = jpLog__append(buf, length, size, jpLog__levelNames[level], 4);
+    length = jpLog__append(buf, length, size, "][", 2);
+    length = jpLog__append(buf, length, size, file, strlen(file));
+    length = jpLog__append(buf, length, size, "][", 2);
+    length = jpLog__append(buf, length, size, func, strlen(func));
+    length = jpLog__append(buf, length, size, "][", 2);
+    length = jpLog__appendInt(buf, length, size, line);
+    return jpLog__append(buf, length, size, "]: ", 3);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads a definition of a dictionary file
+///
+/// @param	data        The definition
+/// @param	length      Length of the definition
+/// @param	definition  Receives the definition, with a copy of data that
+///                     replaces the one it had
+/// @return	Nonzero on success, zero if the definition is corrupt or memory
+///         runs out
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__readDefinition(
+        const unsigned char *data,
+        size_t length,
+        jpLogDefinition *definition)
+{
+    jpLogFormat format;
+    char *copy = NULL;
+    char *func = NULL;
+    char *fmt = NULL;
+    uint32_t level = 0;
+
+    if (length < 10 || length > 8 + JP_LOG_DICTMAX
+            || (level = jpLog__get32(data)) >= JP_LOG_LEVELCOUNT
+            || !(copy = malloc(length + 1))) {
+        return 0;
+    }
+
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    func = memchr(copy + 8, '\0', length - 8);
+    if (func) {
+        ++func;
+        fmt = memchr(func, '\0', length - (size_t)(func - copy));
+    }
+
+    // Only formats jp_log formats itself are split
+    if (fmt) {
+        ++fmt;
+        jpLog__parseFormat(fmt, &format);
+    }
+    if (!fmt || !format.supported
+            || format.length != length - (size_t)(fmt - copy)) {
+        free(copy);
+        return 0;
+    }
+
+    free(definition->data);
+    definition->format = format;
+    definition->data = copy;
+    definition->level = (jpLogLevel)level;
+    definition->line = (int)jpLog__get32(data + 4);
+    definition->file = copy + 8;
+    definition->func = func;
+    definition->fmt = fmt;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Puts a line of a dictionary file back together, as
+///         jpLog_formatText wrote it
+///
+/// @param	definition  Definition of the line
+/// @param	args        The arguments, each followed by a NUL, then the rest
+///                     of the line
+/// @param	length      Length of args
+/// @param	buf         The buffer
+/// @param	size        Size of the buffer, at least 2
+/// @return	Length of the line, or 0 if there are too few arguments
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__rehydrate(
+        const jpLogDefinition *definition,
+        const char *args,
+        size_t length,
+        char *buf,
+        size_t size)
+{
+    const jpLogFormat *format = &definition->format;
+    const jpLogSpec *spec = NULL;
+    const char *end = args + length;
+    const char *arg = NULL;
+    size_t limit = size - 1;
+    size_t len = 0;
+    size_t at = 0;
+    size_t i;
+
+    len = jpLog__appendPrefix(buf, len, limit, definition->level,
+            definition->file, definition->func, definition->line);
+
+    for (i = 0; i < format->count; ++i) {
+        spec = &format->specs[i];
+        len = jpLog__append(buf, len, limit, definition->fmt + at,
+                spec->offset - at);
+        at = spec->offset + spec->length;
+
+        if (spec->conv == '%') {
+            len = jpLog__append(buf, len, limit, "%", 1);
+            continue;
+        }
+
+        arg = memchr(args, '\0', (size_t)(end - args));
+        if (!arg) {
+            return 0;
+        }
+        len = jpLog__append(buf, len, limit, args, (size_t)(arg - args));
+        args = arg + 1;
+    }
+
+    len = jpLog__append(buf, len, limit, definition->fmt + at,
+            format->length - at);
+    len = jpLog__append(buf, len, limit, args, (size_t)(end - args));
+    buf[len++] = '\n';
+
+    return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Puts the lines of a dictionary block back together and passes
+///         them on
+///
+/// @param	raw         The block's raw output
+/// @param	size        Size of the raw output
+/// @param	dictionary  The definitions read so far, added to
+/// @param	text        Buffer of JP_LOG_BLOCKSIZE + JP_LOG_LINEMAX bytes
+/// @param	write       Receives the lines
+/// @param	data        Passed to write
+/// @return	Nonzero on success, zero if the block is corrupt, memory runs
+///         out or write fails
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__readDictionary(
+        const unsigned char *raw,
+        size_t size,
+        jpLogDictionary *dictionary,
+        char *text,
+        jpLogWriteFn write,
+        void *data)
+{
+    jpLogDefinition *definitions = NULL;
+    const char *args = NULL;
+    size_t capacity = 0;
+    size_t offset = 0;
+    size_t length = 0;
+    size_t line = 0;
+    uint32_t id = 0;
+    uint32_t entry = 0;
+
+    while (size - offset >= JP_LOG_DICTHEADER) {
+        id = jpLog__get32(raw + offset);
+        entry = jpLog__get32(raw + offset + 4);
+        args = (const char *)raw + offset + JP_LOG_DICTHEADER;
+        if (entry > size - offset - JP_LOG_DICTHEADER) {
+            return 0;
+        }
+        offset += JP_LOG_DICTHEADER + entry;
+
+        if (id == JP_LOG_DICTTEXT) {
+            line = entry < JP_LOG_LINEMAX ? entry : JP_LOG_LINEMAX - 1;
+            memcpy(text + length, args, line);
+            text[length + line++] = '\n';
+        }
+
+        // Ids are defined in order, and may be defined again
+        else if (id & JP_LOG_DICTDEFINE) {
+            id &= ~JP_LOG_DICTDEFINE;
+            if (id > dictionary->count) {
+                return 0;
+            }
+            if (id == dictionary->capacity) {
+                capacity = id ? 2 * id : 64;
+                definitions = realloc(dictionary->definitions,
+                        capacity * sizeof(*definitions));
+                if (!definitions) {
+                    return 0;
+                }
+                memset(definitions + id, 0,
+                        (capacity - id) * sizeof(*definitions));
+                dictionary->definitions = definitions;
+                dictionary->capacity = capacity;
+            }
+            if (!jpLog__readDefinition(raw + offset - entry, entry,
+                        &dictionary->definitions[id])) {
+                return 0;
+            }
+            dictionary->count += id == dictionary->count;
+            continue;
+        }
+
+        else if (id >= dictionary->count || !(line = jpLog__rehydrate(
+                        &dictionary->definitions[id], args, entry,
+                        text + length, JP_LOG_LINEMAX))) {
+            return 0;
+        }
+
+        length += line;
+        if (length >= JP_LOG_BLOCKSIZE) {
+            if (!write(data, text, length)) {
+                return 0;
+            }
+            length = 0;
+        }
+    }
+
+    return offset == size && (!length || write(data, text, length));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns a call site, filling it in on first use
+///
+/// @param	site    The call site, or NULL
+/// @param	level   Level of the message
+/// @param	file    Name of the current file
+/// @param	func    Name of the current function
+/// @param	line    Current line number
+/// @return	The call site, or NULL if there is none or another thread is
+///         still filling it in
+///////////////////////////////////////////////////////////////////////////////
+static jpLogCallSite *jpLog__readySite(
+        jpLogCallSite *site,
+        jpLogLevel level,
+        const char *file,
+        const char *func,
+        int line)
+{
+#ifdef __GNUC__
+    size_t length = 0;
+    int state = site ? jpLog__load(&site->state) : 2;
+
+    if (state == 2) {
+        return site;
+    }
+
+    // A site still being filled in is skipped this time
+    if (state || !__atomic_compare_exchange_n(&site->state, &state, 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return state == 2 ? site : NULL;
+    }
+
+    site->level = level;
+    site->file = file;
+    site->func = func;
+    site->line = line;
+    length = jpLog__appendPrefix(site->prefix, 0, sizeof(site->prefix), level,
+            file, func, line);
+    site->prefixLength = length < sizeof(site->prefix) ? length : 0;
+
+    site->next = jpLog__load(&jpLog__siteList);
+    while (!__atomic_compare_exchange_n(&jpLog__siteList, &site->next, site,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    jpLog__store(&site->state, 2);
+    return site;
+#else
+    (void)site;
+    (void)level;
+    (void)file;
+    (void)func;
+    (void)line;
+
+    return NULL;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the entry of a jpLog_timeBlock call site, adding it on
+///         first use
+///
+/// @param	file    Name of the current file
+/// @param	func    Name of the current function
+/// @param	line    Current line number
+/// @param	name    Name of the timer
+/// @return	The call site, or NULL if the table is full around it
+///////////////////////////////////////////////////////////////////////////////
+static jpLogTimer *jpLog__findTimer(
+        const char *file,
+        const char *func,
+        int line,
+        const char *name)
+{
+#ifdef __GNUC__
+    jpLogTimer *timer = NULL;
+    uint32_t hash = (uint32_t)(((uintptr_t)file + (uintptr_t)line * 31
+                + (uintptr_t)name) * 2654435761U) >> (32 - JP_LOG_TIMERBITS);
+    int state = 0;
+    size_t i;
+
+    for (i = 0; i < JP_LOG_TIMERPROBES; ++i) {
+        timer = &jpLog__timers[(hash + i) & ((1 << JP_LOG_TIMERBITS) - 1)];
+        state = jpLog__load(&timer->state);
+        if (!state && __atomic_compare_exchange_n(&timer->state, &state, 1,
+                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            timer->name = name;
+            timer->file = file;
+            timer->func = func;
+            timer->line = line;
+            jpLog__store(&timer->state, 2);
+            return timer;
+        }
+
+        // A site still being filled in is skipped this time
+        if (state == 2 && timer->line == line && timer->file == file
+                && timer->name == name) {
+            return timer;
+        }
+    }
+#else
+    (void)file;
+    (void)func;
+    (void)line;
+    (void)name;
+#endif
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the histogram bucket of a time
+///
+/// Times below 2^JP_LOG_SUBBITS get a bucket each. Above that, each power of
+/// two is split into 1 << JP_LOG_SUBBITS buckets.
+///
+/// @param	ns  The time in nanoseconds
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__bucket(unsigned long long ns)
+{
+    int top = 0;
+
+    if (ns < (1U << JP_LOG_SUBBITS)) {
+        return (size_t)ns;
+    }
+
+#ifdef __GNUC__
+    top = 63 - __builtin_clzll(ns);
+#else
+    while (ns >> top >> 1) {
+        ++top;
+    }
+#endif
+
+    return ((size_t)(top - JP_LOG_SUBBITS + 1) << JP_LOG_SUBBITS)
+        + (size_t)(ns >> (top - JP_LOG_SUBBITS))
+        - (1U << JP_LOG_SUBBITS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the longest time that falls in a histogram bucket
+///
+/// @param	bucket  The bucket
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__bucketMax(size_t bucket)
+{
+    size_t shift = (bucket >> JP_LOG_SUBBITS);
+    unsigned long long base = (bucket & ((1U << JP_LOG_SUBBITS) - 1))
+        + (1U << JP_LOG_SUBBITS);
+
+    if (!shift) {
+        return (unsigned long long)bucket;
+    }
+
+    return ((base + 1) << (shift - 1)) - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds up the histograms of every thread that used a timer
+///
+/// @param	timer   The timer
+/// @param	buckets Receives JP_LOG_BUCKETS bucket counts
+/// @param	max     Receives the longest time
+/// @return	Number of times
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__mergeTimer(
+        const jpLogTimer *timer,
+        unsigned long long *buckets,
+        unsigned long long *max)
+{
+    const jpLogHistogram *histogram = jpLog__load(&timer->histograms);
+    unsigned long long count = 0;
+    unsigned long long value = 0;
+    size_t i;
+
+    memset(buckets, 0, JP_LOG_BUCKETS * sizeof(buckets[0]));
+    *max = 0;
+
+    for (; histogram; histogram = histogram->next) {
+        for (i = 0; i < JP_LOG_BUCKETS; ++i) {
+            value = jpLog__load(&histogram->buckets[i]);
+            buckets[i] += value;
+            count += value;
+        }
+
+        value = jpLog__load(&histogram->max);
+        *max = value > *max ? value : *max;
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns a percentile of a histogram - the longest time of the
+///         bucket it falls in, but no more than the longest time seen
+///
+/// @param	buckets The histogram
+/// @param	count   Number of times in the histogram, at least 1
+/// @param	max     Longest time seen
+/// @param	percent The percentile, e.g. 99
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLog__percentile(
+        const unsigned long long *buckets,
+        unsigned long long count,
+        unsigned long long max,
+        unsigned percent)
+{
+    unsigned long long rank = (count * percent + 99) / 100;
+    unsigned long long seen = 0;
+    unsigned long long value = 0;
+    size_t i;
+
+    for (i = 0; i < JP_LOG_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank && seen) {
+            value = jpLog__bucketMax(i);
+            break;
+        }
+    }
+
+    return value < max ? value : max;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns a level read from a level control file, made valid
+///
+/// @param	level   The level, which another process may have garbled
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__controlClamp(int level)
+{
+    return level < JP_LOG_INFO ? JP_LOG_INFO
+        : level > JP_LOG_EXIT ? JP_LOG_EXIT : level;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Splits the site of a level control rule into a base name and a
+///         line
+///
+/// @param	site    The site, as file or file:line
+/// @param	rule    Receives the base name and line
+/// @return	Nonzero on success, zero if site is not a file or call site
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__parseSite(const char *site, jpLogControlRule *rule)
+{
+    const char *colon = strrchr(site, ':');
+    const char *base = site;
+    const char *end = colon ? colon : site + strlen(site);
+    char *lineEnd = NULL;
+    long line = 0;
+    const char *c;
+
+    if (colon) {
+        line = strtol(colon + 1, &lineEnd, 10);
+        if (lineEnd == colon + 1 || *lineEnd || line <= 0
+                || line != (long)(int)line) {
+            return 0;
+        }
+    }
+
+    for (c = site; c < end; ++c) {
+        base = *c == '/' ? c + 1 : base;
+    }
+
+    if (base == end || (size_t)(end - base) >= JP_LOG_CONTROLFILE) {
+        return 0;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+    memcpy(rule->file, base, (size_t)(end - base));
+    rule->line = (int)line;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Maps a level control file, creating it if needed, with a lock
+///         on it
+///
+/// @param	path    Path of the file
+/// @param	fd      Receives the file, which holds the lock until it is
+///                 closed
+/// @return	The mapping, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+static jpLogControl *jpLog__mapControl(const char *path, int *fd)
+{
+    jpLogControl *control = NULL;
+    struct flock lock;
+    struct stat info;
+
+    *fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (*fd < 0) {
+        return NULL;
+    }
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl(*fd, F_SETLKW, &lock) || fstat(*fd, &info)
+            || (info.st_size && info.st_size != sizeof(*control))
+            || (!info.st_size && ftruncate(*fd, sizeof(*control)))) {
+        close(*fd);
+        return NULL;
+    }
+
+    control = mmap(NULL, sizeof(*control), PROT_READ | PROT_WRITE, MAP_SHARED,
+            *fd, 0);
+    if (control == MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+
+    // A new file is all zeros, i.e. every level logged and no rules
+    if (!info.st_size) {
+        memcpy(control->magic, JP_LOG_CONTROLMAGIC, sizeof(control->magic));
+    }
+    else if (memcmp(control->magic, JP_LOG_CONTROLMAGIC,
+                sizeof(control->magic))) {
+        munmap(control, sizeof(*control));
+        close(*fd);
+        return NULL;
+    }
+
+    return control;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Unmaps a level control file mapped by jpLog__mapControl,
+///         releasing its lock
+///
+/// @param	control The mapping
+/// @param	fd      The file
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__unmapControl(jpLogControl *control, int fd)
+{
+    munmap(control, sizeof(*control));
+    close(fd);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the least severe level a call site logs at under the
+///         rules of a level control file
+///
+/// A call site rule comes before a rule for its file, which comes before the
+/// file's level.
+///
+/// @param	control The rules
+/// @param	file    Name of the call site's file
+/// @param	line    Line of the call site
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__controlLevel(
+        const jpLogControl *control,
+        const char *file,
+        int line)
+{
+    const char *base = jpLog__baseName(file);
+    const jpLogControlRule *rule = NULL;
+    int level = control->level;
+    int found = 0;
+    int match = 0;
+    size_t i;
+
+    for (i = 0; i < control->count && i < JP_LOG_CONTROLRULES; ++i) {
+        rule = &control->rules[i];
+        match = rule->line == line ? 2 : !rule->line;
+        if (match > found && !strncmp(rule->file, base, JP_LOG_CONTROLFILE)) {
+            level = rule->level;
+            found = match;
+        }
+    }
+
+    return jpLog__controlClamp(level);
+}
+
+#ifdef JP_LOG_PATCHKEYS
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Rewrites a call site of a JP_LOG_KEYS build as a jump or a NOP
+///
+/// @param	key         The call site
+/// @param	jump        Nonzero for a jump, zero for a NOP
+/// @param	pageSize    Size of a page
+/// @return	Nonzero on success, zero if the code cannot be made writable
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__patchKey(const jpLogKey *key, int jump, uintptr_t pageSize)
+{
+    static const unsigned char nop[5] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+    uint64_t *word = (uint64_t *)(void *)key->code;
+    void *page = (void *)((uintptr_t)key->code & ~(pageSize - 1));
+    int32_t offset = (int32_t)(key->target - (key->code + 5));
+    union {
+        uint64_t word;
+        unsigned char bytes[8];
+    } code;
+
+    code.word = jpLog__load(word);
+    if (jump) {
+        code.bytes[0] = 0xe9;
+        memcpy(code.bytes + 1, &offset, sizeof(offset));
+    }
+    else {
+        memcpy(code.bytes, nop, sizeof(nop));
+    }
+
+    if (code.word == jpLog__load(word)) {
+        return 1;
+    }
+
+    if (mprotect(page, pageSize, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        return 0;
+    }
+
+    // One aligned store, so threads running the code see either instruction.
+    // It is written in assembly, as ThreadSanitizer has no shadow for code
+    __asm__ __volatile__("movq %1, %0; mfence"
+            : "=m"(*word)
+            : "r"(code.word)
+            : "memory");
+    mprotect(page, pageSize, PROT_READ | PROT_EXEC);
+    return 1;
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sets the levels the rules let through - called with
+///         jpLog__controlLock held, after the rules and epoch
+///
+/// Call sites may log at those levels, or at every level while the flight
+/// recorder runs, so that it records what the rules turn off. The call
+/// sites of JP_LOG_KEYS builds become jumps where they may log, and NOPs
+/// elsewhere. They are left as they are once one cannot be patched.
+///
+/// @param	levels  Bit 1 << level set for each level
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__setLevels(unsigned levels)
+{
+    int recording = jpLog__load(&jpLog__recorderSize) != 0;
+#ifdef JP_LOG_PATCHKEYS
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const jpLogKey *key = NULL;
+    unsigned epoch = jpLog__controlEpoch;
+    int jump = 0;
+#endif
+
+    jpLog__store(&jpLog__controlLevels, levels);
+    jpLog__store(&jpLog__levels,
+            recording ? (1U << JP_LOG_LEVELCOUNT) - 1 : levels);
+
+#ifdef JP_LOG_PATCHKEYS
+    for (key = __start_jp_log_keys; !jpLog__keysFailed
+            && key < __stop_jp_log_keys; ++key) {
+        jump = recording || (levels >> key->level & 1U);
+        if (jump && !recording && epoch) {
+            jump = key->level >= jpLog__controlLevel(&jpLog__controlCopy,
+                    key->file, key->line);
+        }
+        jpLog__keysFailed = !jpLog__patchKey(key, jump, pageSize);
+    }
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Copies the level control file followed if it changed - called
+///         with jpLog__controlLock held
+///
+/// Updates the levels the log macros let through, and the epoch call sites
+/// check their cached verdicts against. A file another process holds the
+/// lock of is copied on the next check instead of waiting.
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__refreshControl(void)
+{
+    jpLogControl *control = jpLog__control;
+    struct flock lock;
+    int least = JP_LOG_INFO;
+    size_t i;
+
+    if (jpLog__load(&control->generation) == jpLog__controlCopy.generation) {
+        return;
+    }
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    if (fcntl(jpLog__controlFd, F_SETLK, &lock)) {
+        return;
+    }
+
+    jpLog__controlCopy = *control;
+    lock.l_type = F_UNLCK;
+    fcntl(jpLog__controlFd, F_SETLK, &lock);
+
+    if (jpLog__controlCopy.count > JP_LOG_CONTROLRULES) {
+        jpLog__controlCopy.count = JP_LOG_CONTROLRULES;
+    }
+    least = jpLog__controlClamp(jpLog__controlCopy.level);
+    for (i = 0; i < jpLog__controlCopy.count; ++i) {
+        if (jpLog__controlClamp(jpLog__controlCopy.rules[i].level) < least) {
+            least = jpLog__controlClamp(jpLog__controlCopy.rules[i].level);
+        }
+    }
+
+    jpLog__controlEpochs = jpLog__controlEpochs % 0x7fffffffU + 1;
+    jpLog__store(&jpLog__controlEpoch,
+            jpLog__controlCopy.count ? jpLog__controlEpochs : 0);
+    jpLog__setLevels((1U << JP_LOG_LEVELCOUNT) - (1U << least));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the index of the rule of a file or call site in a level
+///         control file, or the number of rules if it has none
+///
+/// @param	control The mapping
+/// @param	rule    The file and line of the rule
+///////////////////////////////////////////////////////////////////////////////
+static unsigned jpLog__findRule(
+        const jpLogControl *control,
+        const jpLogControlRule *rule)
+{
+    unsigned count = control->count < JP_LOG_CONTROLRULES ? control->count
+        : JP_LOG_CONTROLRULES;
+    unsigned i;
+
+    for (i = 0; i < count; ++i) {
+        if (control->rules[i].line == rule->line && !strncmp(
+                    control->rules[i].file, rule->file, JP_LOG_CONTROLFILE)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Publishes a change to a level control file and unmaps it -
+///         called with jpLog__controlLock held
+///
+/// This process follows the change at once, others at their next check.
+///
+/// @param	control The mapping, changed
+/// @param	fd      The file
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__changeControl(jpLogControl *control, int fd)
+{
+    jpLog__store(&control->generation, control->generation + 1);
+    jpLog__unmapControl(control, fd);
+
+    if (jpLog__controlling) {
+        jpLog__refreshControl();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Rereads the level control file every JP_LOG_CONTROLMS
+///         milliseconds, until jpLog_stopControl
+///
+/// @param	arg Unused
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLog__controller(void *arg)
+{
+    struct timespec deadline;
+
+    (void)arg;
+
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    for (;;) {
+        deadline = jpLog__deadline(JP_LOG_CONTROLMS);
+        while (!jpLog__controlStopping && pthread_cond_timedwait(
+                    &jpLog__controlCond, &jpLog__controlLock, &deadline)
+                != ETIMEDOUT) {
+        }
+
+        if (jpLog__controlStopping) {
+            break;
+        }
+
+        jpLog__refreshControl();
+    }
+
+    pthread_mutex_unlock(&jpLog__controlLock);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks the levels set at run time for a message
+///
+/// The log macros only check the message's level, so call sites whose file
+/// or own rule turns them off are caught here. Each call site's verdict is
+/// cached in its jpLogCallSite until the rules change, so only call sites
+/// without one check the rules under jpLog__controlLock every time.
+///
+/// @param	level   Level of the message
+/// @param	site    The call site, or NULL
+/// @param	file    Name of the current file
+/// @param	line    Current line number
+/// @return	Nonzero if the message is to be logged
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__allowed(
+        jpLogLevel level,
+        jpLogCallSite *site,
+        const char *file,
+        int line)
+{
+    unsigned epoch = 0;
+    unsigned cached = 0;
+    int allowed = 0;
+
+    // Messages logged without the macros, or let through by them for the
+    // flight recorder, have not been checked against the rules' levels
+    if (!(jpLog__load(&jpLog__controlLevels) >> level & 1U)) {
+        return 0;
+    }
+
+    epoch = jpLog__load(&jpLog__controlEpoch);
+    if (!epoch) {
+        return 1;
+    }
+
+    cached = site ? jpLog__load(&site->control) : 0;
+    if (cached >> 1 == epoch) {
+        return (int)(cached & 1U);
+    }
+
+    // The epoch may have changed meanwhile, so it is read with the copy
+    pthread_mutex_lock(&jpLog__controlLock);
+    epoch = jpLog__controlEpoch;
+    allowed = !epoch || (int)level >= jpLog__controlLevel(
+            &jpLog__controlCopy, file, line);
+    pthread_mutex_unlock(&jpLog__controlLock);
+
+    if (site && epoch) {
+        jpLog__store(&site->control, epoch << 1 | (unsigned)allowed);
+    }
+
+    return allowed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the ID of the calling thread, looking it up on first use
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long jpLog__getThreadId(void)
+{
+    if (!jpLog__threadId) {
+#ifdef __linux__
+        jpLog__threadId = (unsigned long)syscall(SYS_gettid);
+#else
+        jpLog__threadId = __atomic_add_fetch(&jpLog__threadCount, 1,
+                __ATOMIC_RELAXED);
+#endif
+    }
+
+    return jpLog__threadId;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the CPU the calling thread is running on, or -1
+///////////////////////////////////////////////////////////////////////////////
+static int jpLog__getCpu(void)
+{
+#ifdef __linux__
+    // Answered by the vDSO without a system call where it can be
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Fills in the rest of a record - the prefix of its call site, if it
+///         has one, the details of the calling thread and the time
+///
+/// @param	record  The record, with its level, file, func, line and span
+///                 set, and its time if it is already known or else 0
+/// @param	callSite    The call site, or NULL
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__fillRecord(jpLogRecord *record, jpLogCallSite *callSite)
+{
+    jpLogCallSite *site = jpLog__readySite(callSite, record->level,
+            record->file, record->func, record->line);
+    unsigned info = jpLog__load(&jpLog__recordInfo);
+
+#ifdef __GNUC__
+    if (site) {
+        __atomic_fetch_add(&site->records, 1, __ATOMIC_RELAXED);
+    }
+#endif
+
+    record->prefix = site && site->prefixLength ? site->prefix : NULL;
+    record->prefixLength = site ? site->prefixLength : 0;
+    record->thread = (info & JP_LOG_THREADID) || record->span
+        ? jpLog__getThreadId() : 0;
+    record->threadName = (info & JP_LOG_THREADNAME) && jpLog__threadName[0]
+        ? jpLog__threadName : NULL;
+    record->cpu = info & JP_LOG_CPU ? jpLog__getCpu() : -1;
+    record->time = record->time ? record->time : jpLog__now();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends the thread details of a record to a buffer, like fields
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer so far
+/// @param	size    Size of the buffer
+/// @param	record  The record
+/// @param	json    If nonzero, the details are appended as JSON
+/// @return	New length of the buffer
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__appendThread(
+        char *buf,
+        size_t length,
+        size_t size,
+        const jpLogRecord *record,
+        int json)
+{
+    jpLogField fields[3];
+    size_t count = 0;
+
+    if (record->thread) {
+        fields[count].key = "thread";
+        fields[count].type = JP_LOG_FIELD_UINT;
+        fields[count++].value.u = record->thread;
+    }
+    if (record->threadName) {
+        fields[count].key = "thread_name";
+        fields[count].type = JP_LOG_FIELD_STR;
+        fields[count++].value.s = record->threadName;
+    }
+    if (record->cpu >= 0) {
+        fields[count].key = "cpu";
+        fields[count].type = JP_LOG_FIELD_INT;
+        fields[count++].value.i = record->cpu;
+    }
+
+    return jpLog__appendFields(buf, length, size, fields, count, json);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Claims the next entry of a flight recorder ring
+///
+/// @param	recorder    The calling thread's ring
+/// @param	level       Level of the message
+/// @param	file        Name of the current file
+/// @param	func        Name of the current function
+/// @param	line        Current line number
+/// @return	The entry, to be completed by jpLog__endEntry
+///////////////////////////////////////////////////////////////////////////////
+static jpLogRecorderEntry *jpLog__beginEntry(
+        jpLogRecorder *recorder,
+        jpLogLevel level,
+        const char *file,
+        const char *func,
+        int line)
+{
+    jpLogRecorderEntry *entry =
+        &recorder->entries[recorder->count % jpLog__recorderSize];
+
+    clock_gettime(CLOCK_REALTIME, &entry->time);
+    entry->file = file;
+    entry->func = func;
+    entry->line = line;
+    entry->level = level;
+
+    return entry;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Publishes an entry claimed by jpLog__beginEntry
+///
+/// @param	recorder    The calling thread's ring
+/// @param	entry       The entry, with its message written
+/// @param	length      Length of the message, truncated to fit the entry
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__endEntry(
+        jpLogRecorder *recorder,
+        jpLogRecorderEntry *entry,
+        size_t length)
+{
+    entry->length = length < sizeof(entry->msg) ? length
+        : sizeof(entry->msg) - 1;
+    jpLog__store(&recorder->count, recorder->count + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes the tag queued before a line for an indexed file sink
+///
+/// @param	tag     Receives the JP_LOG_TAGSIZE bytes of the tag
+/// @param	record  The record
+/// @param	length  Length of the line
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__putTag(char *tag, const jpLogRecord *record, size_t length)
+{
+    struct timespec now;
+
+    // Queries ask for wall clock times, unlike the records' own times
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    tag[0] = JP_LOG_TAGMARK;
+    jpLog__putHex(tag + 1, (unsigned long long)now.tv_sec * 1000000000ULL
+            + (unsigned long long)now.tv_nsec, 16);
+    jpLog__putHex(tag + 17, jpLog__hashFile(record->file), 8);
+    jpLog__putHex(tag + 25, (uint32_t)record->line, 8);
+    jpLog__putHex(tag + 33, length, 8);
+    jpLog__putHex(tag + 41, (unsigned long long)record->level, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a message queued for a dictionary file sink, split into
+///         its call site, format string and arguments after a tag
+///
+/// The message goes in whole, as the argument of "%s", if it was not split,
+/// and as the format string itself if it was logged with "%s" or without a
+/// format string and holds no conversion. Its line goes in whole, without
+/// a call site, if the names do not fit in JP_LOG_DICTMAX bytes or the
+/// message holds a NUL.
+///
+/// @param	out     Receives the tag, names and arguments, and a newline
+/// @param	record  The record
+/// @param	args    Where each argument of the message went, or NULL if the
+///                 message was not formatted
+/// @return	Length of what was written
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLog__putDictionary(
+        char *out,
+        const jpLogRecord *record,
+        const jpLogArgs *args)
+{
+    char *text = out + JP_LOG_DICTTAGSIZE;
+    const char *fmt = "%s";
+    size_t fileLength = strlen(record->file);
+    size_t funcLength = strlen(record->func);
+    size_t fmtLength = 2;
+    size_t limit = JP_LOG_LINEMAX - 1;
+    size_t length = 0;
+    size_t count = 0;
+    int split = 0;
+    int whole = 1;
+    size_t i;
+
+    if (args && args->fmt && strcmp(args->fmt, "%s")) {
+        fmt = args->fmt;
+        fmtLength = strlen(fmt);
+        count = args->count;
+        split = 1;
+        whole = 0;
+    }
+    else if ((!args || args->fmt)
+            && !memchr(record->msg, '%', record->length)) {
+        fmt = record->msg;
+        fmtLength = record->length;
+        whole = 0;
+    }
+
+    if (fileLength + funcLength + fmtLength + 2 > JP_LOG_DICTMAX) {
+        fmt = "%s";
+        fmtLength = 2;
+        count = 0;
+        split = 0;
+        whole = 1;
+    }
+
+    // Arguments end with a NUL, which the text of a split message lacks
+    if (fileLength + funcLength + fmtLength + 2 > JP_LOG_DICTMAX
+            || (!split && memchr(record->msg, '\0', record->length))) {
+        length = jpLog_formatText(record, text, JP_LOG_LINEMAX) - 1;
+        fileLength = 0;
+        funcLength = 0;
+        fmtLength = 0;
+    }
+    else {
+        memcpy(text, record->file, fileLength);
+        memcpy(text + fileLength, record->func, funcLength);
+        memcpy(text + fileLength + funcLength, fmt, fmtLength);
+        text += fileLength + funcLength + fmtLength;
+
+        for (i = 0; i < count; ++i) {
+            length = jpLog__append(text, length, limit,
+                    record->msg + args->starts[i],
+                    args->ends[i] - args->starts[i]);
+            length = jpLog__append(text, length, limit, "", 1);
+        }
+        if (whole) {
+            length = jpLog__append(text, length, limit, record->msg,
+                    record->length);
+            length = jpLog__append(text, length, limit, "", 1);
+        }
+
+        length = jpLog__appendFields(text, length, limit, record->fields,
+                record->fieldCount, 0);
+        length = jpLog__appendThread(text, length, limit, record, 0);
+    }
+
+    out[0] = JP_LOG_TAGMARK;
+    jpLog__putHex(out + 1, (unsigned long long)record->level, 1);
+    jpLog__putHex(out + 2, (uint32_t)record->line, 8);
+    jpLog__putHex(out + 10, fileLength, 4);
+    jpLog__putHex(out + 14, funcLength, 4);
+    jpLog__putHex(out + 18, fmtLength, 4);
+    jpLog__putHex(out + 22, length, 8);
+    text[length] = '\n';
+
+    return (size_t)(text - out) + length + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sends a record to every sink that accepts its level
+///
+/// @param	record  The record
+/// @param	args    Where each argument of the message went, or NULL if the
+///                 message was not formatted
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__dispatch(const jpLogRecord *record, const jpLogArgs *args)
+{
+    char out[JP_LOG_TAGSIZE + JP_LOG_LINEMAX];
+    char split[JP_LOG_DICTTAGSIZE + JP_LOG_DICTMAX + JP_LOG_LINEMAX];
+    char *line = out + JP_LOG_TAGSIZE;
+    jpLogFormatFn format = NULL;
+    jpLogSink *sink = NULL;
+    size_t count = jpLog__countSinks();
+    size_t length = 0;
+    size_t splitLength = 0;
+    int tagged = 0;
+    size_t i;
+
+    // stdio may allocate its buffers, so steady state bypasses it
+    if (!count) {
+        length = jpLog_formatText(record, line, JP_LOG_LINEMAX);
+        if (jpLog__load(&jpLog__steady)) {
+            jpLog__writeAll(record->level == JP_LOG_INFO ? STDOUT_FILENO
+                    : STDERR_FILENO, line, length);
+        }
+        else {
+            jpLog__writeStdio(record->level == JP_LOG_INFO ? stdout : stderr,
+                    line, length);
+        }
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        sink = jpLog__sinks[i];
+        if (record->level < sink->config.minLevel) {
+            continue;
+        }
+
+        // Dictionary file sinks are always async, and get the message split
+        // instead of a line
+        if (sink->dictionary) {
+            if (!splitLength) {
+                splitLength = jpLog__putDictionary(split, record, args);
+            }
+            if (sink->config.sharded) {
+                jpLog__enqueueShard(sink, i, split, splitLength);
+            }
+            else {
+                jpLog__enqueue(sink, split, splitLength);
+            }
+            continue;
+        }
+
+        // Sinks sharing a formatter share the formatted line
+        if (sink->config.format != format) {
+            format = sink->config.format;
+            length = format(record, line, JP_LOG_LINEMAX);
+            tagged = 0;
+        }
+
+        // Indexed file sinks are always async, and get the tag with the line
+        if (sink->indexed) {
+            if (!tagged) {
+                jpLog__putTag(out, record, length);
+                tagged = 1;
+            }
+            if (sink->config.sharded) {
+                jpLog__enqueueShard(sink, i, out, JP_LOG_TAGSIZE + length);
+            }
+            else {
+                jpLog__enqueue(sink, out, JP_LOG_TAGSIZE + length);
+            }
+        }
+        else if (sink->config.async && sink->config.sharded) {
+            jpLog__enqueueShard(sink, i, line, length);
+        }
+        else if (sink->config.async) {
+            jpLog__enqueue(sink, line, length);
+        }
+        else {
+            pthread_mutex_lock(&sink->lock);
+            sink->write(sink->data, line, length);
+            sink->stats.bytes += length;
+            pthread_mutex_unlock(&sink->lock);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sends a message to every sink that accepts its level
+///
+/// @param	level   Level of the message
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	fmt     Format string
+/// @param	ap      Format arguments
+/// @param	types   Types of the format arguments, or NULL
+/// @param	fields  Fields of the message, or NULL
+/// @param	count   Number of fields
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__log(
+        jpLogLevel level,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *fmt,
+        va_list ap,
+        const char *types,
+        const jpLogField *fields,
+        size_t count)
+{
+    char msg[JP_LOG_MSGMAX];
+    jpLogRecord record;
+    jpLogArgs args;
+    jpLogRecorder *recorder = jpLog__threadRecorder();
+    jpLogRecorderEntry *entry = NULL;
+    size_t length = 0;
+    int allowed = jpLog__allowed(level, site, file, line);
+    int wanted = allowed && (int)level >= jpLog__load(&jpLog__minLevel);
+
+    // Messages the rules turn off are still recorded, but not counted
+    if (allowed) {
+        jpLog__count(level, wanted);
+    }
+    if (!wanted && !recorder) {
+        return;
+    }
+
+    if (recorder) {
+        entry = jpLog__beginEntry(recorder, level, file, func, line);
+    }
+
+    // Messages no sink wants are only formatted into the flight recorder
+    length = wanted ? jpLog__vformat(msg, sizeof(msg), fmt, ap, types, &args)
+        : jpLog__vformat(entry->msg, sizeof(entry->msg), fmt, ap, types,
+                NULL);
+
+    if (recorder) {
+        if (wanted) {
+            memcpy(entry->msg, msg, length < sizeof(entry->msg) ? length
+                    : sizeof(entry->msg) - 1);
+        }
+        jpLog__endEntry(recorder, entry, length);
+    }
+
+    if (!wanted) {
+        return;
+    }
+
+    record.level = level;
+    record.file = file;
+    record.func = func;
+    record.line = line;
+    record.msg = msg;
+    record.length = length;
+    record.fields = fields;
+    record.fieldCount = count;
+    record.time = 0;
+    record.span = JP_LOG_SPAN_NONE;
+    jpLog__fillRecord(&record, site);
+
+    jpLog__dispatch(&record, &args);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sends a message with fields to every sink that accepts its level
+///
+/// @param	level   Level of the message
+/// @param	span    Whether the message begins or ends a span
+/// @param	time    Time of the message, or 0 for now
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	msg     The message
+/// @param	fields  Fields of the message
+/// @param	count   Number of fields
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__logFields(
+        jpLogLevel level,
+        jpLogSpan span,
+        unsigned long long time,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *msg,
+        const jpLogField *fields,
+        size_t count)
+{
+    jpLogRecord record;
+    jpLogRecorder *recorder = jpLog__threadRecorder();
+    jpLogRecorderEntry *entry = NULL;
+    size_t length = 0;
+    int allowed = jpLog__allowed(level, site, file, line);
+    int wanted = allowed && (int)level >= jpLog__load(&jpLog__minLevel);
+
+    // Messages the rules turn off are still recorded, but not counted
+    if (allowed) {
+        jpLog__count(level, wanted);
+    }
+    if (recorder) {
+        entry = jpLog__beginEntry(recorder, level, file, func, line);
+        length = jpLog__append(entry->msg, 0, sizeof(entry->msg) - 1, msg,
+                strlen(msg));
+        length = jpLog__appendFields(entry->msg, length,
+                sizeof(entry->msg) - 1, fields, count, 0);
+        jpLog__endEntry(recorder, entry, length);
+    }
+
+    if (!wanted) {
+        return;
+    }
+
+    record.level = level;
+    record.file = file;
+    record.func = func;
+    record.line = line;
+    record.msg = msg;
+    record.length = strlen(msg);
+    record.fields = fields;
+    record.fieldCount = count;
+    record.time = time;
+    record.span = span;
+    jpLog__fillRecord(&record, site);
+
+    jpLog__dispatch(&record, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Dumps the flight recorder and exits after an exit message
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__die(void)
+{
+    if (jpLog__load(&jpLog__recorderSize)) {
+        jpLog_dumpRecorder();
+    }
+
+    // Async sinks are flushed by jpLog_shutdown at exit
+    exit(EXIT_FAILURE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Removes the sinks when the program exits
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__shutdownAtExit(void)
+{
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sets a field to an unsigned value
+///
+/// @param	field   The field
+/// @param	key     Name of the field
+/// @param	value   The value
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__setUint(
+        jpLogField *field,
+        const char *key,
+        unsigned long long value)
+{
+    field->key = key;
+    field->type = JP_LOG_FIELD_UINT;
+    field->value.u = value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Logs the percentiles of each timer since the last report, from
+///         the reporter's thread
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__reportTimers(void)
+{
+    unsigned long long buckets[JP_LOG_BUCKETS];
+    unsigned long long *reported = NULL;
+    unsigned long long count = 0;
+    unsigned long long max = 0;
+    const jpLogTimer *timer = NULL;
+    jpLogField fields[8];
+    size_t top = 0;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < sizeof(jpLog__timers) / sizeof(jpLog__timers[0]); ++i) {
+        timer = &jpLog__timers[i];
+        if (jpLog__load(&timer->state) != 2) {
+            continue;
+        }
+
+        jpLog__mergeTimer(timer, buckets, &max);
+        reported = jpLog__timerReported[i];
+        count = 0;
+        for (j = 0; j < JP_LOG_BUCKETS; ++j) {
+            buckets[j] -= reported[j];
+            reported[j] += buckets[j];
+            count += buckets[j];
+            top = buckets[j] ? j : top;
+        }
+
+        if (!count) {
+            continue;
+        }
+
+        // The longest time overall may be from before this report
+        max = jpLog__bucketMax(top) < max ? jpLog__bucketMax(top) : max;
+
+        fields[0].key = "timer";
+        fields[0].type = JP_LOG_FIELD_STR;
+        fields[0].value.s = timer->name;
+        fields[1].key = "file";
+        fields[1].type = JP_LOG_FIELD_STR;
+        fields[1].value.s = timer->file;
+        fields[2].key = "line";
+        fields[2].type = JP_LOG_FIELD_INT;
+        fields[2].value.i = timer->line;
+        jpLog__setUint(&fields[3], "count", count);
+        jpLog__setUint(&fields[4], "p50_ns",
+                jpLog__percentile(buckets, count, max, 50));
+        jpLog__setUint(&fields[5], "p90_ns",
+                jpLog__percentile(buckets, count, max, 90));
+        jpLog__setUint(&fields[6], "p99_ns",
+                jpLog__percentile(buckets, count, max, 99));
+        jpLog__setUint(&fields[7], "max_ns", max);
+        jpLog__kv(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__,
+                "jp_log timer", fields, 8);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Logs what jp_log's counters did every jpLog__reportPeriod
+///         milliseconds, until jpLog_stopReport
+///
+/// @param	arg Unused
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLog__reporter(void *arg)
+{
+    jpLogField fields[12];
+    jpLogStats last;
+    jpLogStats stats;
+    struct timespec deadline;
+    unsigned long long timeNs = 0;
+
+    (void)arg;
+    jpLog_getStats(&last);
+
+    pthread_mutex_lock(&jpLog__reportLock);
+
+    for (;;) {
+        deadline = jpLog__deadline(jpLog__reportPeriod);
+        while (!jpLog__reportStopping && pthread_cond_timedwait(
+                    &jpLog__reportCond, &jpLog__reportLock, &deadline)
+                != ETIMEDOUT) {
+        }
+
+        if (jpLog__reportStopping) {
+            break;
+        }
+
+        pthread_mutex_unlock(&jpLog__reportLock);
+
+        jpLog_getStats(&stats);
+        timeNs = stats.timeNs - last.timeNs;
+        jpLog__setUint(&fields[0], "info",
+                stats.records[JP_LOG_INFO] - last.records[JP_LOG_INFO]);
+        jpLog__setUint(&fields[1], "warn",
+                stats.records[JP_LOG_WARN] - last.records[JP_LOG_WARN]);
+        jpLog__setUint(&fields[2], "exit",
+                stats.records[JP_LOG_EXIT] - last.records[JP_LOG_EXIT]);
+        jpLog__setUint(&fields[3], "suppressed",
+                stats.suppressed - last.suppressed);
+        jpLog__setUint(&fields[4], "sampled_out",
+                stats.sampledOut - last.sampledOut);
+        jpLog__setUint(&fields[5], "bytes",
+                stats.sinks.bytes - last.sinks.bytes);
+        jpLog__setUint(&fields[6], "flushes",
+                stats.sinks.flushes - last.sinks.flushes);
+        jpLog__setUint(&fields[7], "dropped",
+                stats.sinks.dropped - last.sinks.dropped);
+        jpLog__setUint(&fields[8], "spilled",
+                stats.sinks.spilled - last.sinks.spilled);
+        jpLog__setUint(&fields[9], "blocked_ns",
+                stats.sinks.blockedNs - last.sinks.blockedNs);
+        jpLog__setUint(&fields[10], "queue_high_water",
+                stats.sinks.queueHighWater);
+        jpLog__setUint(&fields[11], "time_ns", timeNs);
+        jpLog__kv(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__,
+                "jp_log report", fields, 12);
+
+        if (jpLog__reportBudget && timeNs > jpLog__reportBudget) {
+            jpLog__setUint(&fields[0], "time_ns", timeNs);
+            jpLog__setUint(&fields[1], "budget_ns", jpLog__reportBudget);
+            jpLog__kv(JP_LOG_WARN, NULL, __FILE__, __func__, __LINE__,
+                    "jp_log over budget", fields, 2);
+        }
+
+        jpLog__reportTimers();
+
+        last = stats;
+        pthread_mutex_lock(&jpLog__reportLock);
+    }
+
+    pthread_mutex_unlock(&jpLog__reportLock);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink - see jpLog_addSink
+///
+/// @param	flush   Writes out output the sink holds back, may be NULL. Only
+///                 called for async sinks, when their queue is empty.
+/// @param	indexed If nonzero, the sink is async and each line is queued
+///                 after a tag for an indexed file
+/// @param	dictionary  If nonzero, the sink is async and each message is
+///                 queued split after a tag for a dictionary file
+///////////////////////////////////////////////////////////////////////////////
+static jpLogSink *jpLog__addSink(
+        jpLogWriteFn write,
+        jpLogCloseFn flush,
+        jpLogCloseFn close,
+        void *data,
+        const jpLogSinkConfig *config,
+        int indexed,
+        int dictionary)
+{
+    if (!write) {
+        return NULL;
+    }
+
+    jpLogSink *sink = calloc(1, sizeof(*sink));
+    if (!sink) {
+        return NULL;
+    }
+
+    if (config) {
+        sink->config = *config;
+    }
+    if (!sink->config.format) {
+        sink->config.format = jpLog_formatText;
+    }
+    if (!sink->config.queueSize) {
+        sink->config.queueSize = JP_LOG_QUEUESIZE;
+    }
+    if (sink->config.queueSize < JP_LOG_TAGSIZE + JP_LOG_LINEMAX) {
+        sink->config.queueSize = JP_LOG_TAGSIZE + JP_LOG_LINEMAX;
+    }
+    if (dictionary && sink->config.queueSize
+            < JP_LOG_DICTTAGSIZE + JP_LOG_DICTMAX + JP_LOG_LINEMAX) {
+        sink->config.queueSize = JP_LOG_DICTTAGSIZE + JP_LOG_DICTMAX
+            + JP_LOG_LINEMAX;
+    }
+
+    sink->indexed = indexed;
+    sink->dictionary = dictionary;
+    sink->write = write;
+    sink->flush = flush;
+    sink->close = close;
+    sink->data = data;
+    sink->spillFd = -1;
+    pthread_mutex_init(&sink->lock, NULL);
+    pthread_cond_init(&sink->notEmpty, NULL);
+    pthread_cond_init(&sink->notFull, NULL);
+    pthread_cond_init(&sink->drained, NULL);
+
+    if (sink->config.async && sink->config.overflow == JP_LOG_SPILL) {
+        sink->spillFd = sink->config.spillPath ? open(sink->config.spillPath,
+                O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+    }
+
+    if (sink->config.async) {
+        sink->queue = malloc(sink->config.queueSize);
+        sink->batch = malloc(sink->config.queueSize);
+        if (!sink->queue || !sink->batch
+                || (sink->config.overflow == JP_LOG_SPILL
+                    && sink->spillFd < 0)
+                || pthread_create(&sink->thread, NULL, jpLog__worker, sink)) {
+            // Not async yet, so the caller keeps ownership of data
+            sink->config.async = 0;
+            sink->close = NULL;
+            jpLog__destroySink(sink, NULL);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&jpLog__sinksLock);
+
+    if (jpLog__sinkCount == JP_LOG_MAXSINKS) {
+        pthread_mutex_unlock(&jpLog__sinksLock);
+        sink->close = NULL;
+        jpLog__destroySink(sink, NULL);
+        return NULL;
+    }
+
+    // In steady state, threads must find their shards already there
+    if (jpLog__steady && sink->config.async && sink->config.sharded
+            && !jpLog__addSpareShards(sink, jpLog__spareThreads)) {
+        pthread_mutex_unlock(&jpLog__sinksLock);
+        sink->close = NULL;
+        jpLog__destroySink(sink, NULL);
+        return NULL;
+    }
+
+    if (!jpLog__atExit) {
+        jpLog__atExit = !atexit(jpLog__shutdownAtExit);
+    }
+
+    sink->id = ++jpLog__sinkIds;
+    jpLog__sinks[jpLog__sinkCount] = sink;
+    jpLog__store(&jpLog__sinkCount, jpLog__sinkCount + 1);
+    jpLog__updateMinLevel();
+
+    pthread_mutex_unlock(&jpLog__sinksLock);
+    return sink;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addSink(
+        jpLogWriteFn write,
+        jpLogCloseFn close,
+        void *data,
+        const jpLogSinkConfig *config)
+{
+    return jpLog__addSink(write, NULL, close, data, config, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addStdioSink(FILE *stream, const jpLogSinkConfig *config)
+{
+    if (!stream) {
+        return NULL;
+    }
+
+    return jpLog_addSink(jpLog__writeStdio, NULL, stream, config);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addFileSink(
+        const char *path,
+        const jpLogSinkConfig *config,
+        const jpLogFileConfig *fileConfig)
+{
+    if (!path) {
+        return NULL;
+    }
+
+    jpLogSinkConfig sinkConfig;
+    jpLogFile *file = calloc(1, sizeof(*file));
+    jpLogSink *sink = NULL;
+    char magic[sizeof(JP_LOG_FILEMAGIC) - 1];
+    void *buffers = NULL;
+    ssize_t existing = 0;
+    off_t end = 0;
+    int index = fileConfig && fileConfig->index;
+    int dictionary = fileConfig && fileConfig->dictionary;
+    int compress = index || dictionary
+        || (fileConfig && fileConfig->compress);
+    const char *expected = index ? JP_LOG_INDEXMAGIC
+        : dictionary ? JP_LOG_DICTMAGIC : JP_LOG_FILEMAGIC;
+    int buffered = fileConfig && (fileConfig->uring || fileConfig->direct);
+    int flags = 0;
+
+    if (!file) {
+        return NULL;
+    }
+
+    memset(&sinkConfig, 0, sizeof(sinkConfig));
+    if (config) {
+        sinkConfig = *config;
+    }
+
+    // Spilled lines would keep their tags
+    if (((index || dictionary) && sinkConfig.overflow == JP_LOG_SPILL)
+            || (index && dictionary)) {
+        free(file);
+        return NULL;
+    }
+
+    // Buffered writes go to offsets of their own rather than appending
+    file->fd = open(path, O_RDWR | O_CREAT | (buffered ? 0 : O_APPEND),
+            0644);
+    if (file->fd < 0) {
+        free(file);
+        return NULL;
+    }
+
+    // Compressed, indexed, dictionary and plain output must not be mixed in
+    // one file
+    existing = pread(file->fd, magic, sizeof(magic), 0);
+    if (existing < 0 || (existing > 0 && compress
+                != (existing == sizeof(magic)
+                    && !memcmp(magic, expected, sizeof(magic))))) {
+        jpLog__closeFile(file);
+        return NULL;
+    }
+
+    if (compress) {
+        file->index = index;
+        file->dictionary = dictionary;
+        if (!jpLog__startCompression(file, fileConfig->blockSize
+                    ? fileConfig->blockSize : JP_LOG_BLOCKSIZE) || (!existing
+                    && !jpLog__writeAll(file->fd, expected, sizeof(magic)))) {
+            jpLog__closeFile(file);
+            return NULL;
+        }
+
+        // Producers only queue output, the sink's thread compresses it
+        sinkConfig.async = 1;
+    }
+
+    if (buffered) {
+        end = lseek(file->fd, 0, SEEK_END);
+        if (end < 0 || posix_memalign(&buffers, JP_LOG_DIRECTALIGN,
+                    JP_LOG_WRITEBUFS * JP_LOG_WRITEBUFSIZE)) {
+            jpLog__closeFile(file);
+            return NULL;
+        }
+
+        file->buffers = buffers;
+        file->offset = end;
+
+#ifdef O_DIRECT
+        // O_DIRECT writes whole blocks, so the last partial block of the
+        // file is read back to be written again. File systems that do not
+        // support it get cached writes.
+        if (fileConfig->direct) {
+            file->offset = end & ~(off_t)(JP_LOG_DIRECTALIGN - 1);
+            file->used = (size_t)(end - file->offset);
+            flags = fcntl(file->fd, F_GETFL);
+            file->direct = flags >= 0 && pread(file->fd, file->buffers,
+                    file->used, file->offset) == (ssize_t)file->used
+                && !fcntl(file->fd, F_SETFL, flags | O_DIRECT);
+            if (!file->direct) {
+                file->offset = end;
+                file->used = 0;
+            }
+        }
+#endif
+
+#ifdef JP_LOG_URING
+        // Without io_uring, the same buffers are written with pwrite
+        if (fileConfig->uring) {
+            file->uring = jpLog__createUring(file->buffers);
+        }
+#endif
+
+        // The sink's thread is the only one to touch the buffers
+        sinkConfig.async = 1;
+    }
+
+    if (fileConfig && (fileConfig->rotateBytes
+                || fileConfig->rotateSeconds)) {
+        end = lseek(file->fd, 0, SEEK_END);
+        file->path = strlen(path) + 16 < JP_LOG_PATHMAX ? strdup(path)
+            : NULL;
+        if (end < 0 || !file->path) {
+            jpLog__closeFile(file);
+            return NULL;
+        }
+
+        file->written = (unsigned long long)end;
+        file->rotateBytes = fileConfig->rotateBytes;
+        file->rotateSeconds = fileConfig->rotateSeconds;
+        if (file->rotateSeconds) {
+            file->rotateAt = jpLog__nextRotation(file->rotateSeconds,
+                    time(NULL));
+        }
+        file->keepFiles = fileConfig->keepFiles;
+        file->keepBytes = fileConfig->keepBytes;
+        file->compressRotated = fileConfig->compressRotated && !compress;
+
+        // Rotation happens on the sink's thread, while producers queue
+        sinkConfig.async = 1;
+    }
+
+    sink = jpLog__addSink(jpLog__writeFile, jpLog__flushFile,
+            jpLog__closeFile, file, &sinkConfig, file->index,
+            file->dictionary);
+    if (!sink) {
+        jpLog__closeFile(file);
+    }
+
+    return sink;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addRingSink(size_t size, const jpLogSinkConfig *config)
+{
+    if (!size) {
+        return NULL;
+    }
+
+    jpLogRing *ring = calloc(1, sizeof(*ring));
+    jpLogSink *sink = NULL;
+
+    if (!ring) {
+        return NULL;
+    }
+
+    ring->data = malloc(size);
+    if (!ring->data) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->size = size;
+    pthread_mutex_init(&ring->lock, NULL);
+
+    sink = jpLog_addSink(jpLog__writeRing, jpLog__closeRing, ring, config);
+    if (!sink) {
+        jpLog__closeRing(ring);
+    }
+
+    return sink;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addTraceSink(const char *path, const jpLogSinkConfig *config)
+{
+    if (!path) {
+        return NULL;
+    }
+
+    jpLogSinkConfig trace = { JP_LOG_INFO, NULL, 0, 0, JP_LOG_BLOCK, NULL, 0 };
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    ssize_t existing = 0;
+    char first[2] = { 0 };
+    int ok = 0;
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Events are only appended to a trace file, not to compressed, indexed
+    // or plain output
+    existing = pread(fd, first, 2, 0);
+    ok = existing ? existing == 2 && !memcmp(first, "[\n", 2)
+        : jpLog__writeAll(fd, "[\n", 2);
+    close(fd);
+    if (!ok) {
+        return NULL;
+    }
+
+    if (config) {
+        trace = *config;
+    }
+    trace.format = jpLog_formatTrace;
+
+    // Compressed blocks or rotated files would not be one JSON array
+    return jpLog_addFileSink(path, &trace, NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_readRing(jpLogSink *sink, char *buf, size_t size)
+{
+    if (!sink || sink->write != jpLog__writeRing || (!buf && size)) {
+        return 0;
+    }
+
+    jpLogRing *ring = sink->data;
+    size_t start = 0;
+    size_t length = 0;
+    size_t i;
+
+    pthread_mutex_lock(&ring->lock);
+
+    // Skip the partial line left at the front by overwriting, then the
+    // oldest lines until the rest fits in buf
+    length = ring->length;
+    if (ring->overwritten) {
+        while (start < length
+                && ring->data[(ring->head + start++) % ring->size] != '\n');
+    }
+    while (length - start > size) {
+        while (start < length
+                && ring->data[(ring->head + start++) % ring->size] != '\n');
+    }
+
+    length -= start;
+    for (i = 0; i < length; ++i) {
+        buf[i] = ring->data[(ring->head + start + i) % ring->size];
+    }
+
+    pthread_mutex_unlock(&ring->lock);
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addSocketSink(const char *path, const jpLogSinkConfig *config)
+{
+    if (!path) {
+        return NULL;
+    }
+
+    jpLogSocket *sock = calloc(1, sizeof(*sock));
+    jpLogSink *sink = NULL;
+
+    if (!sock) {
+        return NULL;
+    }
+
+    if (strlen(path) >= sizeof(sock->addr.sun_path)) {
+        free(sock);
+        return NULL;
+    }
+
+    sock->addr.sun_family = AF_UNIX;
+    strcpy(sock->addr.sun_path, path);
+    sock->fd = -1;
+
+    sink = jpLog_addSink(jpLog__writeSocket, jpLog__closeSocket, sock, config);
+    if (!sink) {
+        jpLog__closeSocket(sock);
+    }
+
+    return sink;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_getSinkStats(jpLogSink *sink, jpLogSinkStats *stats)
+{
+    jpLogShard *shard = NULL;
+
+    pthread_mutex_lock(&sink->lock);
+    *stats = sink->stats;
+    for (shard = sink->shards; shard; shard = shard->next) {
+        stats->dropped += jpLog__load(&shard->dropped);
+        stats->spilled += jpLog__load(&shard->spilled);
+        stats->blockedNs += jpLog__load(&shard->blockedNs);
+    }
+    pthread_mutex_unlock(&sink->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_getStats(jpLogStats *stats)
+{
+    jpLogCounters *counters = NULL;
+    jpLogSinkStats sinkStats;
+    size_t i;
+    int level;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&jpLog__countersLock);
+    for (counters = jpLog__counters; counters; counters = counters->next) {
+        for (level = 0; level < JP_LOG_LEVELCOUNT; ++level) {
+            stats->records[level] += jpLog__load(&counters->records[level]);
+        }
+        stats->suppressed += jpLog__load(&counters->suppressed);
+        stats->sampledOut += jpLog__load(&counters->sampledOut);
+        stats->timeNs += jpLog__load(&counters->timeNs);
+    }
+    pthread_mutex_unlock(&jpLog__countersLock);
+
+    pthread_mutex_lock(&jpLog__sinksLock);
+    stats->sinks = jpLog__removedStats;
+    for (i = 0; i < jpLog__sinkCount; ++i) {
+        jpLog_getSinkStats(jpLog__sinks[i], &sinkStats);
+        jpLog__addSinkStats(&stats->sinks, &sinkStats);
+    }
+    pthread_mutex_unlock(&jpLog__sinksLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_getSiteStats(jpLogSiteStats *sites, size_t max)
+{
+    const jpLogCallSite *site = NULL;
+    size_t count = 0;
+
+    // Sites are filled in before they are listed
+    for (site = jpLog__load(&jpLog__siteList); site; site = site->next) {
+        if (count < max) {
+            sites[count].level = site->level;
+            sites[count].file = site->file;
+            sites[count].func = site->func;
+            sites[count].line = site->line;
+            sites[count].records = jpLog__load(&site->records);
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_getTimerStats(jpLogTimerStats *timers, size_t max)
+{
+    unsigned long long buckets[JP_LOG_BUCKETS];
+    unsigned long long longest = 0;
+    unsigned long long count = 0;
+    const jpLogTimer *timer = NULL;
+    size_t found = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(jpLog__timers) / sizeof(jpLog__timers[0]); ++i) {
+        timer = &jpLog__timers[i];
+        if (jpLog__load(&timer->state) != 2) {
+            continue;
+        }
+
+        if (found < max) {
+            count = jpLog__mergeTimer(timer, buckets, &longest);
+            timers[found].name = timer->name;
+            timers[found].file = timer->file;
+            timers[found].func = timer->func;
+            timers[found].line = timer->line;
+            timers[found].count = count;
+            timers[found].p50 = count ? jpLog__percentile(buckets, count,
+                    longest, 50) : 0;
+            timers[found].p90 = count ? jpLog__percentile(buckets, count,
+                    longest, 90) : 0;
+            timers[found].p99 = count ? jpLog__percentile(buckets, count,
+                    longest, 99) : 0;
+            timers[found].max = longest;
+        }
+        ++found;
+    }
+
+    return found;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startReport(unsigned periodMs, unsigned long long budgetNs)
+{
+    if (!periodMs) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&jpLog__reportLock);
+
+    if (jpLog__reporting) {
+        pthread_mutex_unlock(&jpLog__reportLock);
+        return 0;
+    }
+
+    jpLog__reportPeriod = periodMs;
+    jpLog__reportBudget = budgetNs;
+    jpLog__reportStopping = 0;
+    jpLog__store(&jpLog__timing, 1);
+    if (pthread_create(&jpLog__reportThread, NULL, jpLog__reporter, NULL)) {
+        jpLog__store(&jpLog__timing, 0);
+        pthread_mutex_unlock(&jpLog__reportLock);
+        return 0;
+    }
+
+    jpLog__reporting = 1;
+    pthread_mutex_unlock(&jpLog__reportLock);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_stopReport(void)
+{
+    pthread_mutex_lock(&jpLog__reportLock);
+
+    if (!jpLog__reporting) {
+        pthread_mutex_unlock(&jpLog__reportLock);
+        return;
+    }
+
+    jpLog__reportStopping = 1;
+    pthread_cond_signal(&jpLog__reportCond);
+    pthread_mutex_unlock(&jpLog__reportLock);
+
+    pthread_join(jpLog__reportThread, NULL);
+
+    pthread_mutex_lock(&jpLog__reportLock);
+    jpLog__reporting = 0;
+    jpLog__store(&jpLog__timing, 0);
+    pthread_mutex_unlock(&jpLog__reportLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startControl(const char *path)
+{
+    struct flock lock;
+    jpLogControl *control = NULL;
+    int fd = -1;
+
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    if (jpLog__controlling || !(control = jpLog__mapControl(path, &fd))) {
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    // The file stays open to lock it while copying
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    fcntl(fd, F_SETLK, &lock);
+
+    if (jpLog__control) {
+        jpLog__unmapControl(jpLog__control, jpLog__controlFd);
+    }
+    jpLog__control = control;
+    jpLog__controlFd = fd;
+    jpLog__controlCopy.generation = control->generation + 1;
+    jpLog__refreshControl();
+
+    jpLog__controlStopping = 0;
+    if (pthread_create(&jpLog__controlThread, NULL, jpLog__controller,
+                NULL)) {
+        jpLog__store(&jpLog__controlEpoch, 0);
+        jpLog__setLevels((1U << JP_LOG_LEVELCOUNT) - 1);
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    jpLog__controlling = 1;
+    pthread_mutex_unlock(&jpLog__controlLock);
+    return 1;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-/// @file	jp_log.h
-/// @author	Jacob Adkins (jpadkins)
-/// @brief	API for logging information and possibly halting execution
+void jpLog_stopControl(void)
+{
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    if (!jpLog__controlling) {
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return;
+    }
+
+    jpLog__controlStopping = 1;
+    pthread_cond_signal(&jpLog__controlCond);
+    pthread_mutex_unlock(&jpLog__controlLock);
+
+    pthread_join(jpLog__controlThread, NULL);
+
+    // The file stays mapped until the next jpLog_startControl
+    pthread_mutex_lock(&jpLog__controlLock);
+    jpLog__controlling = 0;
+    jpLog__store(&jpLog__controlEpoch, 0);
+    jpLog__setLevels((1U << JP_LOG_LEVELCOUNT) - 1);
+    pthread_mutex_unlock(&jpLog__controlLock);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-#include "jp_log.h"
+int jpLog_setControl(const char *path, const char *site, jpLogLevel level)
+{
+    jpLogControlRule rule;
+    jpLogControl *control = NULL;
+    unsigned i = 0;
+    int fd = -1;
+
+    if ((unsigned)level >= JP_LOG_LEVELCOUNT
+            || (site && !jpLog__parseSite(site, &rule))) {
+        return 0;
+    }
+
+    // Closing another descriptor of the file would drop this process's lock
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    if (!(control = jpLog__mapControl(path, &fd))) {
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    i = site ? jpLog__findRule(control, &rule) : 0;
+    if (i == JP_LOG_CONTROLRULES) {
+        jpLog__unmapControl(control, fd);
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    if (site) {
+        rule.level = level;
+        control->rules[i] = rule;
+        control->count = i < control->count ? control->count : i + 1;
+    }
+    else {
+        control->level = level;
+    }
+
+    jpLog__changeControl(control, fd);
+    pthread_mutex_unlock(&jpLog__controlLock);
+    return 1;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Includes
+int jpLog_clearControl(const char *path, const char *site)
+{
+    jpLogControlRule rule;
+    jpLogControl *control = NULL;
+    unsigned count = 0;
+    unsigned i = 0;
+    int fd = -1;
+
+    if (site && !jpLog__parseSite(site, &rule)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    if (!(control = jpLog__mapControl(path, &fd))) {
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    // The count may have been garbled by another process
+    count = control->count < JP_LOG_CONTROLRULES ? control->count
+        : JP_LOG_CONTROLRULES;
+    i = site ? jpLog__findRule(control, &rule) : 0;
+    if (site && i >= count) {
+        jpLog__unmapControl(control, fd);
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    // The last rule takes the place of the one removed
+    if (site) {
+        control->rules[i] = control->rules[count - 1];
+        control->count = count - 1;
+    }
+    else {
+        control->level = JP_LOG_INFO;
+        control->count = 0;
+    }
+
+    jpLog__changeControl(control, fd);
+    pthread_mutex_unlock(&jpLog__controlLock);
+    return 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-#include <stdio.h>
-#include <stdlib.h>
+int jpLog_readControl(const char *path, jpLogWriteFn write, void *data)
+{
+    char buf[JP_LOG_CONTROLFILE + 32];
+    jpLogControl *control = NULL;
+    const jpLogControlRule *rule = NULL;
+    const char *key = NULL;
+    unsigned count = 0;
+    unsigned i;
+    int length = 0;
+    int fd = -1;
+    int ok = 0;
+
+    pthread_mutex_lock(&jpLog__controlLock);
+
+    if (!(control = jpLog__mapControl(path, &fd))) {
+        pthread_mutex_unlock(&jpLog__controlLock);
+        return 0;
+    }
+
+    length = snprintf(buf, sizeof(buf), "* %s\n",
+            jpLog__levelKeys[jpLog__controlClamp(control->level)]);
+    ok = write(data, buf, (size_t)length);
+
+    count = control->count < JP_LOG_CONTROLRULES ? control->count
+        : JP_LOG_CONTROLRULES;
+    for (i = 0; ok && i < count; ++i) {
+        rule = &control->rules[i];
+        key = jpLog__levelKeys[jpLog__controlClamp(rule->level)];
+        if (rule->line) {
+            length = snprintf(buf, sizeof(buf), "%.*s:%d %s\n",
+                    JP_LOG_CONTROLFILE - 1, rule->file, rule->line, key);
+        }
+        else {
+            length = snprintf(buf, sizeof(buf), "%.*s %s\n",
+                    JP_LOG_CONTROLFILE - 1, rule->file, key);
+        }
+        ok = write(data, buf, (size_t)length);
+    }
+
+    jpLog__unmapControl(control, fd);
+    pthread_mutex_unlock(&jpLog__controlLock);
+    return ok;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Defines
+int jpLog_preallocate(size_t threads)
+{
+    size_t i;
+    int ok = 0;
+
+    pthread_mutex_lock(&jpLog__sinksLock);
+
+    ok = jpLog__addCounters(threads) && (!jpLog__load(&jpLog__recorderSize)
+            || jpLog__addRecorders(threads));
+    for (i = 0; ok && i < jpLog__sinkCount; ++i) {
+        if (jpLog__sinks[i]->config.async && jpLog__sinks[i]->config.sharded) {
+            ok = jpLog__addSpareShards(jpLog__sinks[i], threads);
+        }
+    }
+
+    if (ok) {
+        jpLog__spareThreads = threads > jpLog__spareThreads ? threads
+            : jpLog__spareThreads;
+        jpLog__store(&jpLog__steady, 1);
+    }
+
+    pthread_mutex_unlock(&jpLog__sinksLock);
+    return ok;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
+void jpLog_flush(void)
+{
+    size_t count = jpLog__countSinks();
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (jpLog__sinks[i]->config.async) {
+            jpLog__drain(jpLog__sinks[i]);
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Public functions
+void jpLog_shutdown(void)
+{
+    size_t count = 0;
+    size_t i;
+
+    jpLog_stopReport();
+    jpLog_stopControl();
+
+    pthread_mutex_lock(&jpLog__sinksLock);
+
+    count = jpLog__sinkCount;
+    jpLog__store(&jpLog__sinkCount, 0);
+    jpLog__updateMinLevel();
+
+    for (i = 0; i < count; ++i) {
+        jpLog__destroySink(jpLog__sinks[i], &jpLog__removedStats);
+        jpLog__sinks[i] = NULL;
+    }
+
+    pthread_mutex_unlock(&jpLog__sinksLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startRecorder(size_t records, int fd)
+{
+    if (!records || fd < 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&jpLog__recorderLock);
+
+    if (jpLog__recorderSize
+            || pthread_key_create(&jpLog__recorderKey,
+                jpLog__releaseRecorder)) {
+        pthread_mutex_unlock(&jpLog__recorderLock);
+        return 0;
+    }
+
+    jpLog__recorderFd = fd;
+    jpLog__store(&jpLog__recorderSize, records);
+
+    pthread_mutex_unlock(&jpLog__recorderLock);
+
+    // Call sites turned off at run time are turned back on to be recorded
+    pthread_mutex_lock(&jpLog__controlLock);
+    jpLog__setLevels(jpLog__controlLevels);
+    pthread_mutex_unlock(&jpLog__controlLock);
+
+    // Threads in steady state only take rings that are already there
+    pthread_mutex_lock(&jpLog__sinksLock);
+    if (jpLog__steady) {
+        jpLog__addRecorders(jpLog__spareThreads);
+    }
+    pthread_mutex_unlock(&jpLog__sinksLock);
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_dumpRecorder(void)
+{
+    static const char header[] = "-- jpLog flight recorder --\n";
+    const jpLogRecorder *recorder = jpLog__load(&jpLog__recorders);
+
+    if (!jpLog__load(&jpLog__recorderSize)) {
+        return;
+    }
+
+    jpLog__writeAll(jpLog__recorderFd, header, sizeof(header) - 1);
+    for (; recorder; recorder = recorder->next) {
+        jpLog__dumpRecorder(recorder);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_installCrashHandler(void)
+{
+    static const int signals[] = { SIGSEGV, SIGABRT, SIGBUS, SIGILL, SIGFPE };
+    struct sigaction action;
+    size_t i;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = jpLog__crashHandler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+        if (sigaction(signals[i], &action, NULL)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_readFile(const char *path, jpLogWriteFn write, void *data)
+{
+    if (!path || !write) {
+        return 0;
+    }
+
+    unsigned char header[JP_LOG_INDEXHEADER];
+    unsigned char *raw = NULL;
+    unsigned char *packed = NULL;
+    char *text = NULL;
+    FILE *file = fopen(path, "rb");
+    jpLogDictionary dictionary;
+    jpLogEntry entry;
+    size_t headerSize = JP_LOG_BLOCKHEADER;
+    size_t rawSize = 0;
+    size_t stored = 0;
+    size_t length = 0;
+    size_t offset = 0;
+    int ok = 1;
+
+    if (!file) {
+        return 0;
+    }
+
+    memset(&dictionary, 0, sizeof(dictionary));
+    length = fread(header, 1, sizeof(JP_LOG_FILEMAGIC) - 1, file);
+    if (length == sizeof(JP_LOG_INDEXMAGIC) - 1
+            && !memcmp(header, JP_LOG_INDEXMAGIC, length)) {
+        headerSize = JP_LOG_INDEXHEADER;
+    }
+
+    // The lines of a dictionary file are put back together one block at
+    // a time
+    else if (length == sizeof(JP_LOG_DICTMAGIC) - 1
+            && !memcmp(header, JP_LOG_DICTMAGIC, length)) {
+        text = malloc(JP_LOG_BLOCKSIZE + JP_LOG_LINEMAX);
+        ok = text != NULL;
+    }
+
+    // Plain text is copied as is
+    else if (length < sizeof(JP_LOG_FILEMAGIC) - 1
+            || memcmp(header, JP_LOG_FILEMAGIC, length)) {
+        raw = malloc(JP_LOG_BLOCKSIZE);
+        ok = raw && write(data, (const char *)header, length);
+        while (ok && (length = fread(raw, 1, JP_LOG_BLOCKSIZE, file))) {
+            ok = write(data, (const char *)raw, length);
+        }
+        ok = ok && !ferror(file);
+
+        free(raw);
+        fclose(file);
+        return ok;
+    }
+
+    while (ok && (length = fread(header, 1, headerSize, file))) {
+        rawSize = jpLog__get32(header);
+        stored = jpLog__get32(header + 4);
+        ok = length == headerSize && rawSize <= JP_LOG_BLOCKMAX
+            && stored <= jpLog__compressBound(rawSize);
+        if (!ok) {
+            break;
+        }
+
+        free(raw);
+        free(packed);
+        raw = malloc(rawSize + 1);
+        packed = malloc(stored + 1);
+
+        ok = raw && packed && fread(packed, 1, stored, file) == stored;
+        if (ok && stored == rawSize) {
+            memcpy(raw, packed, rawSize);
+        }
+        else if (ok) {
+            ok = jpLog__decompress(packed, stored, raw, rawSize);
+        }
+
+        ok = ok && jpLog__checksum(raw, rawSize) == jpLog__get32(header + 8);
+
+        // The lines of an indexed block are passed on without their headers
+        if (ok && headerSize == JP_LOG_INDEXHEADER) {
+            length = 0;
+            offset = 0;
+            while (jpLog__getEntry(raw, rawSize, &offset, &entry)) {
+                memmove(raw + length, entry.text, entry.length);
+                length += entry.length;
+            }
+            ok = offset == rawSize;
+            rawSize = length;
+        }
+
+        if (text) {
+            ok = ok && jpLog__readDictionary(raw, rawSize, &dictionary, text,
+                    write, data);
+        }
+        else {
+            ok = ok && write(data, (const char *)raw, rawSize);
+        }
+    }
+
+    ok = ok && !ferror(file);
+
+    for (offset = 0; offset < dictionary.count; ++offset) {
+        free(dictionary.definitions[offset].data);
+    }
+    free(dictionary.definitions);
+    free(text);
+    free(raw);
+    free(packed);
+    fclose(file);
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_queryFile(
+        const char *path,
+        const jpLogQuery *query,
+        jpLogWriteFn write,
+        void *data,
+        jpLogQueryStats *stats)
+{
+    if (!path || !write) {
+        return 0;
+    }
+
+    char line[JP_LOG_TIMESIZE + JP_LOG_LINEMAX];
+    jpLogQueryStats counts;
+    jpLogQuery all;
+    jpLogBlockIndex index;
+    jpLogEntry entry;
+    struct stat info;
+    const unsigned char *map = NULL;
+    const unsigned char *header = NULL;
+    unsigned char *raw = NULL;
+    void *grown = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t rawSize = 0;
+    size_t stored = 0;
+    size_t offset = 0;
+    size_t length = 0;
+    size_t pos = sizeof(JP_LOG_INDEXMAGIC) - 1;
+    uint32_t fileHash = 0;
+    uint32_t siteKey = 0;
+    int fd = open(path, O_RDONLY);
+    int ok = 0;
+
+    memset(&counts, 0, sizeof(counts));
+    memset(&all, 0, sizeof(all));
+    query = query ? query : &all;
+    if (query->file) {
+        fileHash = jpLog__hashFile(query->file);
+        siteKey = jpLog__siteKey(fileHash, (uint32_t)query->line);
+    }
+
+    // Skipped blocks are never even paged in
+    if (fd >= 0 && !fstat(fd, &info) && info.st_size >= (off_t)pos) {
+        size = (size_t)info.st_size;
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        map = map == MAP_FAILED ? NULL : map;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    ok = map && !memcmp(map, JP_LOG_INDEXMAGIC, pos);
+    while (ok && pos < size) {
+        header = map + pos;
+        ok = size - pos >= JP_LOG_INDEXHEADER;
+        rawSize = ok ? jpLog__get32(header) : 0;
+        stored = ok ? jpLog__get32(header + 4) : 0;
+        ok = ok && rawSize <= JP_LOG_BLOCKMAX
+            && stored <= jpLog__compressBound(rawSize)
+            && stored <= size - pos - JP_LOG_INDEXHEADER;
+        if (!ok) {
+            break;
+        }
+
+        pos += JP_LOG_INDEXHEADER + stored;
+        ++counts.blocks;
+        jpLog__getIndex(&index, header);
+        if (!jpLog__blockMayMatch(&index, query, fileHash, siteKey)) {
+            ++counts.skipped;
+            continue;
+        }
+
+        if (rawSize + 1 > capacity) {
+            grown = realloc(raw, rawSize + 1);
+            ok = grown != NULL;
+            if (!ok) {
+                break;
+            }
+            raw = grown;
+            capacity = rawSize + 1;
+        }
+
+        if (stored == rawSize) {
+            memcpy(raw, header + JP_LOG_INDEXHEADER, rawSize);
+        }
+        else {
+            ok = jpLog__decompress(header + JP_LOG_INDEXHEADER, stored, raw,
+                    rawSize);
+        }
+        ok = ok && jpLog__checksum(raw, rawSize) == jpLog__get32(header + 8);
+
+        offset = 0;
+        while (ok && jpLog__getEntry(raw, rawSize, &offset, &entry)) {
+            ++counts.lines;
+            if (!jpLog__entryMatches(&entry, query, fileHash)) {
+                continue;
+            }
+
+            ++counts.matched;
+            length = query->times ? jpLog__formatTime(line, entry.time) : 0;
+            memcpy(line + length, entry.text, entry.length);
+            ok = write(data, line, length + entry.length);
+        }
+        ok = ok && offset == rawSize;
+    }
+
+    if (map) {
+        munmap((void *)map, size);
+    }
+    free(raw);
+
+    if (stats) {
+        *stats = counts;
+    }
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setRecordInfo(unsigned info)
+{
+    jpLog__store(&jpLog__recordInfo, info);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setThreadName(const char *name)
+{
+    size_t length = name ? strlen(name) : 0;
+
+    length = length < sizeof(jpLog__threadName) ? length
+        : sizeof(jpLog__threadName) - 1;
+    memcpy(jpLog__threadName, name ? name : "", length);
+    jpLog__threadName[length] = '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setSampleRate(unsigned rate)
+{
+    jpLog__store(&jpLog__sampleOverride, rate);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatText(const jpLogRecord *record, char *buf, size_t size)
+{
+    size_t limit = size - 1;
+    size_t length = 0;
+
+    if (record->prefix) {
+        length = jpLog__append(buf, length, limit, record->prefix,
+                record->prefixLength);
+    }
+    else {
+        length = jpLog__appendPrefix(buf, length, limit, record->level,
+                record->file, record->func, record->line);
+    }
+
+    length = jpLog__append(buf, length, limit, record->msg, record->length);
+    length = jpLog__appendFields(buf, length, limit, record->fields,
+            record->fieldCount, 0);
+    length = jpLog__appendThread(buf, length, limit, record, 0);
+    buf[length++] = '\n';
+
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatLogfmt(const jpLogRecord *record, char *buf, size_t size)
+{
+    size_t limit = size - 1;
+    size_t length = 0;
+
+    length = jpLog__append(buf, length, limit, "level=", 6);
+    length = jpLog__append(buf, length, limit,
+            jpLog__levelKeys[record->level], 4);
+    length = jpLog__append(buf, length, limit, " file=", 6);
+    length = jpLog__appendLogfmt(buf, length, limit, record->file,
+            strlen(record->file));
+    length = jpLog__append(buf, length, limit, " func=", 6);
+    length = jpLog__appendLogfmt(buf, length, limit, record->func,
+            strlen(record->func));
+    length = jpLog__append(buf, length, limit, " line=", 6);
+    length = jpLog__appendInt(buf, length, limit, record->line);
+    length = jpLog__append(buf, length, limit, " msg=", 5);
+    length = jpLog__appendLogfmt(buf, length, limit, record->msg,
+            record->length);
+    length = jpLog__appendFields(buf, length, limit, record->fields,
+            record->fieldCount, 0);
+    length = jpLog__appendThread(buf, length, limit, record, 0);
+    buf[length++] = '\n';
+
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatJson(const jpLogRecord *record, char *buf, size_t size)
+{
+    size_t limit = size - 2;
+    size_t length = 0;
+
+    length = jpLog__append(buf, length, limit, "{\"level\":\"", 10);
+    length = jpLog__append(buf, length, limit,
+            jpLog__levelKeys[record->level], 4);
+    length = jpLog__append(buf, length, limit, "\",\"file\":\"", 10);
+    length = jpLog__appendEscaped(buf, length, limit, record->file,
+            strlen(record->file));
+    length = jpLog__append(buf, length, limit, "\",\"func\":\"", 10);
+    length = jpLog__appendEscaped(buf, length, limit, record->func,
+            strlen(record->func));
+    length = jpLog__append(buf, length, limit, "\",\"line\":", 9);
+    length = jpLog__appendInt(buf, length, limit, record->line);
+    length = jpLog__append(buf, length, limit, ",\"msg\":\"", 8);
+    length = jpLog__appendEscaped(buf, length, limit, record->msg,
+            record->length);
+    length = jpLog__append(buf, length, limit, "\"", 1);
+    length = jpLog__appendFields(buf, length, limit, record->fields,
+            record->fieldCount, 1);
+    length = jpLog__appendThread(buf, length, limit, record, 1);
+    buf[length++] = '}';
+    buf[length++] = '\n';
+
+    return length;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatTrace(const jpLogRecord *record, char *buf, size_t size)
+{
+    static const char *phases[] = { "i", "B", "E" };
+    size_t limit = size - 4;
+    size_t length = 0;
+
+    length = jpLog__append(buf, length, limit, "{\"name\":\"", 9);
+    length = jpLog__appendEscaped(buf, length, limit, record->msg,
+            record->length);
+    length = jpLog__append(buf, length, limit, "\",\"cat\":\"", 9);
+    length = jpLog__append(buf, length, limit,
+            jpLog__levelKeys[record->level], 4);
+    length = jpLog__append(buf, length, limit, "\",\"ph\":\"", 8);
+    length = jpLog__append(buf, length, limit, phases[record->span], 1);
+
+    // Instant events are scoped to their thread
+    if (record->span == JP_LOG_SPAN_NONE) {
+        length = jpLog__append(buf, length, limit, "\",\"s\":\"t", 8);
+    }
+
+    length = jpLog__append(buf, length, limit, "\",\"ts\":", 7);
+    length = jpLog__appendUint(buf, length, limit, record->time / 1000, 1);
+    length = jpLog__append(buf, length, limit, ".", 1);
+    length = jpLog__appendUint(buf, length, limit, record->time % 1000, 3);
+    length = jpLog__append(buf, length, limit, ",\"pid\":", 7);
+    length = jpLog__appendUint(buf, length, limit,
+            (unsigned long long)getpid(), 1);
+    length = jpLog__append(buf, length, limit, ",\"tid\":", 7);
+    length = jpLog__appendUint(buf, length, limit, record->thread, 1);
+    length = jpLog__append(buf, length, limit, ",\"args\":{\"file\":\"",
+            17);
+    length = jpLog__appendEscaped(buf, length, limit, record->file,
+            strlen(record->file));
+    length = jpLog__append(buf, length, limit, "\",\"func\":\"", 10);
+    length = jpLog__appendEscaped(buf, length, limit, record->func,
+            strlen(record->func));
+    length = jpLog__append(buf, length, limit, "\",\"line\":", 9);
+    length = jpLog__appendInt(buf, length, limit, record->line);
+    length = jpLog__appendFields(buf, length, limit, record->fields,
+            record->fieldCount, 1);
+    memcpy(buf + length, "}},\n", 4);
+
+    return length + 4;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 void jpLog__info(
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
         const char *fmt,
         ...)
 {
+    unsigned long long start = jpLog__startTiming();
     va_list ap;
 
-    fprintf(stdout, "[INFO][%s][%s][%d]: ", file, func, line);
-
+    JP_LOG_ENTER();
     va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    jpLog__log(JP_LOG_INFO, site, file, func, line, fmt, ap, NULL, NULL, 0);
     va_end(ap);
-
-    fprintf(stdout, "\n");
+    JP_LOG_LEAVE();
+    jpLog__stopTiming(start);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 void jpLog__warn(
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *fmt,
+        ...)
+{
+    unsigned long long start = jpLog__startTiming();
+    va_list ap;
+
+    JP_LOG_ENTER();
+    va_start(ap, fmt);
+    jpLog__log(JP_LOG_WARN, site, file, func, line, fmt, ap, NULL, NULL, 0);
+    va_end(ap);
+    JP_LOG_LEAVE();
+    jpLog__stopTiming(start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__exit(
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
@@ -49,33 +7189,278 @@ void jpLog__warn(
 {
     va_list ap;
 
-    fprintf(stderr, "[WARN][%s][%s][%d]: ", file, func, line);
+    JP_LOG_ENTER();
+    va_start(ap, fmt);
+    jpLog__log(JP_LOG_EXIT, site, file, func, line, fmt, ap, NULL, NULL, 0);
+    va_end(ap);
+    JP_LOG_LEAVE();
+
+    jpLog__die();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__fmt(
+        jpLogLevel level,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *types,
+        const char *fmt,
+        ...)
+{
+    unsigned long long start = level == JP_LOG_EXIT ? 0
+        : jpLog__startTiming();
+    va_list ap;
 
+    JP_LOG_ENTER();
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    jpLog__log(level, site, file, func, line, fmt, ap, types, NULL, 0);
     va_end(ap);
+    JP_LOG_LEAVE();
 
-    fprintf(stderr, "\n");
+    if (level == JP_LOG_EXIT) {
+        jpLog__die();
+    }
+    jpLog__stopTiming(start);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void jpLog__exit(
+int jpLog__sample(unsigned rate)
+{
+    jpLogCounters *counters = NULL;
+    unsigned override = jpLog__load(&jpLog__sampleOverride);
+    uint32_t x = jpLog__sampleState;
+
+    rate = override ? override : rate;
+    jpLog__sampleRate = rate > 1 ? rate : 1;
+    if (rate <= 1) {
+        return 1;
+    }
+
+    // xorshift32, seeded differently in each thread
+    if (!x) {
+        x = (uint32_t)((uintptr_t)&jpLog__sampleState * 2654435761U) | 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    jpLog__sampleState = x;
+
+    // True for 1 in rate values of x
+    if (((uint64_t)x * rate) >> 32 == 0) {
+        return 1;
+    }
+
+    JP_LOG_ENTER();
+    if ((counters = jpLog__getCounters())) {
+        jpLog__add(&counters->sampledOut, 1);
+    }
+    JP_LOG_LEAVE();
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__infoSampled(
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
         const char *fmt,
         ...)
 {
+    unsigned long long start = jpLog__startTiming();
+    jpLogField field;
     va_list ap;
 
-    fprintf(stderr, "[EXIT][%s][%s][%d]: ", file, func, line);
+    field.key = "sample_rate";
+    field.type = JP_LOG_FIELD_UINT;
+    field.value.u = jpLog__sampleRate;
 
+    JP_LOG_ENTER();
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    jpLog__log(JP_LOG_INFO, site, file, func, line, fmt, ap, NULL, &field,
+            jpLog__sampleRate > 1);
     va_end(ap);
+    JP_LOG_LEAVE();
+    jpLog__stopTiming(start);
+}
 
-    fprintf(stderr, "\n");
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__kv(
+        jpLogLevel level,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *msg,
+        const jpLogField *fields,
+        size_t count)
+{
+    unsigned long long start = jpLog__startTiming();
 
-    exit(EXIT_FAILURE);
+    JP_LOG_ENTER();
+    jpLog__logFields(level, JP_LOG_SPAN_NONE, 0, site, file, func, line, msg,
+            fields, count);
+    JP_LOG_LEAVE();
+    jpLog__stopTiming(start);
+
+    if (level == JP_LOG_EXIT) {
+        jpLog__die();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__span(
+        jpLogSpan span,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *name)
+{
+    unsigned long long start = jpLog__startTiming();
+    unsigned long long now = jpLog__now();
+    jpLogField fields[2];
+    size_t count = 1;
+
+    fields[0].key = "span";
+    fields[0].type = JP_LOG_FIELD_STR;
+    fields[0].value.s = span == JP_LOG_SPAN_BEGIN ? "begin" : "end";
+
+    if (span == JP_LOG_SPAN_BEGIN) {
+        if (jpLog__spanDepth < JP_LOG_SPANDEPTH) {
+            jpLog__spanStarts[jpLog__spanDepth] = now;
+        }
+        ++jpLog__spanDepth;
+    }
+    else if (jpLog__spanDepth && --jpLog__spanDepth < JP_LOG_SPANDEPTH) {
+        jpLog__setUint(&fields[count++], "dur_ns",
+                now - jpLog__spanStarts[jpLog__spanDepth]);
+    }
+
+    JP_LOG_ENTER();
+    jpLog__logFields(JP_LOG_INFO, span, now, site, file, func, line, name,
+            fields, count);
+    JP_LOG_LEAVE();
+    jpLog__stopTiming(start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long jpLog__timeStart(void)
+{
+    unsigned long long now = jpLog__now();
+
+    return now ? now : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long jpLog__timeStop(
+        const char *file,
+        const char *func,
+        int line,
+        const char *name,
+        unsigned long long start)
+{
+    unsigned long long ns = jpLog__now() - start;
+    jpLogTimer *timer = jpLog__findTimer(file, func, line, name);
+    jpLogCounters *counters = NULL;
+    jpLogHistogram *histogram = NULL;
+    size_t index = 0;
+
+    JP_LOG_ENTER();
+    counters = timer ? jpLog__getCounters() : NULL;
+    if (!counters) {
+        JP_LOG_LEAVE();
+        return 0;
+    }
+
+    index = (size_t)(timer - jpLog__timers);
+    histogram = counters->histograms[index];
+
+    // Only a thread's first time through a site takes a lock
+    if (!histogram && !jpLog__load(&jpLog__steady)) {
+        histogram = calloc(1, sizeof(*histogram));
+        if (histogram) {
+            pthread_mutex_lock(&jpLog__timersLock);
+            histogram->next = timer->histograms;
+            jpLog__store(&timer->histograms, histogram);
+            pthread_mutex_unlock(&jpLog__timersLock);
+            counters->histograms[index] = histogram;
+        }
+    }
+
+    if (histogram) {
+        jpLog__add(&histogram->buckets[jpLog__bucket(ns)], 1);
+        if (ns > histogram->max) {
+            jpLog__add(&histogram->max, ns - histogram->max);
+        }
+    }
+
+    JP_LOG_LEAVE();
+    return 0;
+}
+
+#ifdef JP_LOG_DEBUGALLOC
+///////////////////////////////////////////////////////////////////////////////
+// Allocator checks
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief glibc's own allocator, which the functions below forward to
+///
+/// glibc no longer has malloc hooks, so jp_log.c replaces the functions
+/// themselves. It must be linked into the program rather than a shared
+/// library, where jpLog__inCall could itself need malloc.
+///////////////////////////////////////////////////////////////////////////////
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Aborts if the calling thread is inside a logging call in steady
+///         state
+///////////////////////////////////////////////////////////////////////////////
+static void jpLog__checkAlloc(void)
+{
+    static const char msg[] = "jp_log: allocation in a logging call\n";
+
+    if (jpLog__inCall && jpLog__load(&jpLog__steady)) {
+        jpLog__writeAll(STDERR_FILENO, msg, sizeof(msg) - 1);
+        abort();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void *malloc(size_t size)
+{
+    jpLog__checkAlloc();
+    return __libc_malloc(size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void *calloc(size_t count, size_t size)
+{
+    jpLog__checkAlloc();
+    return __libc_calloc(count, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void *realloc(void *ptr, size_t size)
+{
+    jpLog__checkAlloc();
+    return __libc_realloc(ptr, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void free(void *ptr)
+{
+    if (ptr) {
+        jpLog__checkAlloc();
+    }
+    __libc_free(ptr);
 }
 
+// JP_LOG_DEBUGALLOC
+#endif
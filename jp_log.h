@@ -50,7 +50,179 @@
 ///     like malloc or calloc happen within a jpLog_* function, Valgrind gets
 ///     fussy.
 ///
-/// @TODO Add an API for setting output stream and logging to a file
+/// Levels at run time
+/// ---------------------------------------------------------------------------
+/// JP_LOG_NOINFO, JP_LOG_NOWARN and JP_LOG_NOEXIT remove levels at compile
+/// time. After jpLog_startControl, the levels logged also follow a small
+/// control file, which the jp_loglevel tool (or jpLog_setControl) changes
+/// while the program runs - everywhere, for a file or for a call site, e.g.
+///
+///     jpLog_startControl("/run/service.levels");
+///
+///     jp_loglevel /run/service.levels warn
+///     jp_loglevel /run/service.levels info parser.c:120
+///
+/// Each call site first checks one word holding the levels any rule lets
+/// through, so a level turned off costs a load and a branch. Rules for files
+/// and call sites are then checked by jp_log, and with GCC and Clang cached
+/// in a static of each call site until they change.
+///
+/// Built with JP_LOG_STATICKEYS (GCC or Clang on x86-64 ELF targets), each
+/// info and warn call site is a jump instead, which jp_log patches into a
+/// NOP while the call site's level, file or own rule turns it off, so a call
+/// site turned off costs about as much as one compiled out. Only the call
+/// sites linked into the same executable or shared library as jp_log.c are
+/// patched, and none are if the code cannot be made writable (e.g. under a
+/// W^X policy); those keep jumping into jp_log, which drops their messages.
+/// While the flight recorder runs, every call site logs so that it can be
+/// recorded, and the rules only decide what reaches the sinks.
+///
+/// Format arguments
+/// ---------------------------------------------------------------------------
+/// GCC and Clang check the arguments of the jpLog_*Fmt macros against their
+/// format strings, as they check printf's. Built as C11 or C++11, the macros
+/// also pass a string encoding the type of each argument, made with _Generic
+/// (decltype in C++) at compile time, and a message whose arguments do not
+/// match a format string built at run time is logged as "format mismatch: "
+/// and the format string rather than read from the wrong arguments. The
+/// macros then take at most 16 format arguments - define JP_LOG_NOTYPES to
+/// lift that.
+///
+/// Sinks
+/// ---------------------------------------------------------------------------
+/// Until a sink is added, info messages go to stdout and warn/exit messages
+/// go to stderr. Once sinks are added with jpLog_add*Sink, every message is
+/// sent to each sink whose minimum level it meets, formatted by that sink's
+/// formatter. A sink created with async set writes from its own thread, so a
+/// slow sink (e.g. a socket to a collector) does not stall the others, e.g.
+///
+///     jpLogSinkConfig file = { JP_LOG_INFO, NULL, 1, 0 };
+///     jpLogSinkConfig collector = { JP_LOG_WARN, NULL, 1, 0 };
+///
+///     jpLog_addFileSink("service.log", &file, NULL);
+///     jpLog_addSocketSink("/run/collector.sock", &collector);
+///
+/// When an async sink's queue fills up, its overflow policy decides whether
+/// producers block, lines are dropped or they spill to a file, and
+/// jpLog_getSinkStats reports what it cost. Messages logged before any sink
+/// is added go straight to stdout/stderr and block on them.
+///
+/// An async sink with sharded set gives each thread a queue of its own, of
+/// queueSize bytes, so threads logging at once do not contend for one lock
+/// and cache line. The sink's thread merges the queues by the time each line
+/// was queued. A line queued while the sink's thread is merging may come
+/// out after lines of other threads queued just after it.
+///
+/// A file sink with uring or direct set in its jpLogFileConfig collects
+/// output in a few large buffers and writes each one once it is full, or
+/// after JP_LOG_FLUSHMS idle milliseconds or jpLog_flush. On Linux the
+/// writes go through an io_uring with the buffers registered, so the sink's
+/// thread fills the next buffer while the kernel writes the last one, and
+/// through pwrite where io_uring is not available (e.g. in a sandbox).
+/// Direct writes bypass the page cache where the file system allows it.
+/// Such a file must not be appended to by other processes meanwhile.
+///
+/// A file sink with rotateBytes or rotateSeconds set rotates its own file,
+/// instead of leaving it to logrotate and copytruncate. The sink's thread
+/// renames path to path.1 (path.1 to path.2 and so on) and reopens path,
+/// while producers keep queueing, so no line is lost or split. Another
+/// thread then compresses path.1 to path.1.lz if compressRotated is set,
+/// and removes the oldest rotated files beyond keepFiles and keepBytes.
+///
+/// A file sink with index set writes compressed blocks that each start with
+/// the time range, levels and a bloom filter of the call sites of their
+/// lines. jpLog_queryFile and the jp_logquery tool map such a file and only
+/// decompress the blocks that may hold lines from a given level, file, call
+/// site or time range, e.g.
+///
+///     jp_logquery -l warn -c parser.c:120 -s 2024-01-31T12:00:00 app.log
+///
+/// A file sink with dictionary set writes each call site and format string
+/// once per file, the first time it logs, and then each line as its number
+/// and the text of its arguments, fields and thread details, in compressed
+/// blocks. jpLog_readFile and the jp_logdump tool put the lines back together
+/// as jpLog_formatText writes them. Messages jp_log does not format itself
+/// (see Formatting) are kept whole, as are messages logged with "%s" unless
+/// they read as a format string of their own.
+///
+/// Structured logging
+/// ---------------------------------------------------------------------------
+/// The jpLog_*KV macros attach typed key/value fields to a message. Sinks
+/// using jpLog_formatLogfmt or jpLog_formatJson write one logfmt or JSON
+/// object per line, so the fields can be ingested without parsing text.
+///
+/// Sampling
+/// ---------------------------------------------------------------------------
+/// jpLog_infoSampled logs 1 in N calls of a chatty call site, deciding before
+/// its arguments are evaluated, and tags what it logs with sample_rate=N so
+/// counts can be scaled back up. jpLog_setSampleRate overrides N everywhere.
+///
+/// Spans
+/// ---------------------------------------------------------------------------
+/// jpLog_spanBegin and jpLog_spanEnd log info records that mark where a
+/// span of time starts and ends, tagged span=begin or span=end, and the end
+/// also carries dur_ns. jpLog_span wraps a block in a span, e.g.
+///
+///     jpLog_span("parse") {
+///         parseRequest(req);
+///     }
+///
+/// Spans go to the sinks like other records. A sink added with
+/// jpLog_addTraceSink writes them as Chrome Trace Event JSON, which
+/// chrome://tracing and Perfetto load, with every other record as an
+/// instant event on its thread.
+///
+/// Formatting
+/// ---------------------------------------------------------------------------
+/// jp_log formats %d %u %x (with l, ll or z), %s %p and %% itself, and hands
+/// %f and %g to snprintf one at a time, with the same output as printf. Each
+/// format string is parsed once and cached by address, so it pays to pass
+/// string literals. Formats using anything else (flags, widths, precisions,
+/// other conversions) go through vsnprintf as before.
+///
+/// Metrics
+/// ---------------------------------------------------------------------------
+/// jpLog_getStats counts messages per level, suppressed and sampled-out
+/// messages and what the sinks wrote, dropped and waited for, and
+/// jpLog_getSiteStats counts messages per call site. Counters are kept per
+/// thread, so counting does not add contention. jpLog_startReport logs the
+/// counters periodically, and warns when logging takes more than a budget.
+///
+/// jpLog_timeBlock times a block and adds the time to a histogram of its
+/// call site, kept per thread so recording takes no lock, e.g.
+///
+///     jpLog_timeBlock("db query") {
+///         runQuery(db, sql);
+///     }
+///
+/// jpLog_getTimerStats merges the histograms into p50/p90/p99/max, and each
+/// report of jpLog_startReport logs them for the times since the last one.
+///
+/// Flight recorder
+/// ---------------------------------------------------------------------------
+/// jpLog_startRecorder keeps the last messages of each thread in memory,
+/// including info messages that no sink accepts or that the level control
+/// file turns off, without any I/O. The recorder is dumped by jpLog_exit*
+/// and, after jpLog_installCrashHandler, on fatal signals, so crashes come
+/// with the context that led up to them.
+///
+/// Steady state
+/// ---------------------------------------------------------------------------
+/// After jpLog_preallocate, logging calls do not touch the allocator: each
+/// thread takes its counters, recorder ring and shards from what was set up
+/// for a fixed number of threads, and nothing grows. Messages are truncated
+/// to JP_LOG_MSGMAX bytes and lines to JP_LOG_LINEMAX bytes, as always, and
+/// messages logged before any sink is added are written to fd 1 or 2 instead
+/// of stdout/stderr. What jp_log cannot see is left to the caller: a stdio
+/// sink's stream should be given a buffer with setvbuf, and vsnprintf (used
+/// for formats jp_log does not handle itself) may allocate for positional
+/// arguments or very wide conversions. Building jp_log.c into the program
+/// with JP_LOG_DEBUGALLOC replaces malloc, calloc, realloc and free with
+/// versions that abort if called from a logging call in steady state.
+///
+/// Sinks should be added before other threads start logging. Messages longer
+/// than JP_LOG_MSGMAX bytes are truncated. jp_log.c needs a POSIX system with
+/// pthreads.
 ///////////////////////////////////////////////////////////////////////////////
 #ifndef JPA__LOG_H
 #define JPA__LOG_H
@@ -74,14 +246,768 @@
 // Includes
 ///////////////////////////////////////////////////////////////////////////////
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+#include <type_traits>
+#include <utility>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Defines
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Has the compiler check the arguments of a printf-like function
+/// against its format string
+///
+/// @param fmt  Position of the format string
+/// @param args Position of the first format argument
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define JP_LOG_PRINTF(fmt,args) __attribute__((format(printf, fmt, args)))
+#else
+#define JP_LOG_PRINTF(fmt,args)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Longest prefix kept for a call site
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOG_PREFIXMAX        (128)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Defined if the Fmt macros pass the types of their arguments along
+/// - needs C11 _Generic or C++11 decltype, define JP_LOG_NOTYPES to build
+/// without it
+///////////////////////////////////////////////////////////////////////////////
+#if ((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L)\
+    || (defined(__cplusplus) && __cplusplus >= 201103L))\
+    && !defined(JP_LOG_NOTYPES)
+#define JP_LOG_TYPES
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Defined if info and warn call sites are jumps, which jp_log patches
+/// into NOPs while they are turned off at run time - define
+/// JP_LOG_STATICKEYS to use them with GCC or Clang on x86-64 ELF targets
+///////////////////////////////////////////////////////////////////////////////
+#if defined(JP_LOG_STATICKEYS) && defined(__GNUC__) && defined(__x86_64__)\
+    && defined(__ELF__)
+#define JP_LOG_KEYS
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Severity of a log message, from least to most severe
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpLogLevel {
+    JP_LOG_INFO,
+    JP_LOG_WARN,
+    JP_LOG_EXIT,
+    JP_LOG_LEVELCOUNT
+} jpLogLevel;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief What an async sink does with a line when its queue is full
+///
+/// Sync sinks write on the caller's thread, so a slow one always blocks it.
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpLogOverflow {
+    JP_LOG_BLOCK,           ///< Wait for room, counting the time blocked
+    JP_LOG_DROPNEWEST,      ///< Drop the new line
+    JP_LOG_DROPOLDEST,      ///< Drop queued lines, oldest first, for room
+    JP_LOG_SPILL            ///< Append the new line to the spill file
+} jpLogOverflow;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Details of the logging thread added to records, combined with |
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpLogRecordInfo {
+    JP_LOG_THREADID = 1,    ///< ID of the thread (its TID on Linux)
+    JP_LOG_THREADNAME = 2,  ///< Name given by jpLog_setThreadName
+    JP_LOG_CPU = 4          ///< CPU the thread is running on
+} jpLogRecordInfo;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Whether a record begins or ends a span
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpLogSpan {
+    JP_LOG_SPAN_NONE,
+    JP_LOG_SPAN_BEGIN,
+    JP_LOG_SPAN_END
+} jpLogSpan;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Type of the value of a jpLogField
+///////////////////////////////////////////////////////////////////////////////
+typedef enum jpLogFieldType {
+    JP_LOG_FIELD_INT,
+    JP_LOG_FIELD_UINT,
+    JP_LOG_FIELD_DOUBLE,
+    JP_LOG_FIELD_STR,
+    JP_LOG_FIELD_BOOL
+} jpLogFieldType;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A typed key/value pair attached to a message by the jpLog_*KV
+/// macros - create with jpLog_int, jpLog_uint, jpLog_double, jpLog_str and
+/// jpLog_bool
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogField {
+    const char *key;
+    jpLogFieldType type;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char *s;
+    } value;
+} jpLogField;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A single log message, as passed to formatters
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogRecord {
+    jpLogLevel level;   ///< Severity of the message
+    const char *file;   ///< Name of the file that logged the message
+    const char *func;   ///< Name of the function that logged the message
+    int line;           ///< Line that logged the message
+    const char *msg;    ///< The formatted message (not NUL-terminated)
+    size_t length;      ///< Length of the message in bytes
+    const jpLogField *fields;   ///< Fields of a jpLog_*KV message
+    size_t fieldCount;          ///< Number of fields
+    const char *prefix;         ///< Cached "[LEVEL][file][func][line]: "
+                                ///< of the call site, or NULL
+    size_t prefixLength;        ///< Length of the prefix
+    unsigned long thread;       ///< ID of the thread, or 0
+    const char *threadName;     ///< Name of the thread, or NULL
+    int cpu;                    ///< CPU of the thread, or -1
+    unsigned long long time;    ///< CLOCK_MONOTONIC time in nanoseconds
+    jpLogSpan span;             ///< Whether the record begins or ends a
+                                ///< span - if so, thread is always set
+} jpLogRecord;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Formats a record into a line of output
+///
+/// The line must end with a newline, even if it is truncated.
+///
+/// @param record   The record
+/// @param buf      Buffer for the line
+/// @param size     Size of the buffer (at least 2)
+/// @return Number of bytes written to buf
+///////////////////////////////////////////////////////////////////////////////
+typedef size_t (*jpLogFormatFn)(
+        const jpLogRecord *record,
+        char *buf,
+        size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Writes formatted output to a sink's destination
+///
+/// @param data     The sink's data
+/// @param buf      The output - one or more complete lines
+/// @param length   Length of the output in bytes
+/// @return Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+typedef int (*jpLogWriteFn)(void *data, const char *buf, size_t length);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Releases a sink's data when the sink is removed
+///
+/// @param data The sink's data
+///////////////////////////////////////////////////////////////////////////////
+typedef void (*jpLogCloseFn)(void *data);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Options for a new sink - zero-initialized fields use the defaults
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSinkConfig {
+    jpLogLevel minLevel;    ///< Least severe level sent to the sink
+    jpLogFormatFn format;   ///< Formatter, jpLog_formatText if NULL
+    int async;              ///< If nonzero, the sink writes on its own thread
+    size_t queueSize;       ///< Bytes queued for an async sink before
+                            ///< it overflows, JP_LOG_QUEUESIZE if 0
+    jpLogOverflow overflow; ///< What an async sink does when it overflows
+    const char *spillPath;  ///< File appended to by JP_LOG_SPILL
+    int sharded;            ///< If nonzero, an async sink queues the lines
+                            ///< of each thread apart, merging them by time
+} jpLogSinkConfig;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Counters of a sink, from jpLog_getSinkStats
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSinkStats {
+    unsigned long long dropped;     ///< Lines dropped on overflow
+    unsigned long long spilled;     ///< Lines written to the spill file
+    unsigned long long blockedNs;   ///< Time producers waited for room
+    unsigned long long bytes;       ///< Bytes passed to the sink's writer
+    unsigned long long flushes;     ///< Times an async sink was flushed
+    unsigned long long queueHighWater;  ///< Most bytes ever queued
+} jpLogSinkStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Counters of jp_log as a whole, from jpLog_getStats
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogStats {
+    unsigned long long records[JP_LOG_LEVELCOUNT];  ///< Messages sent to
+                                                    ///< sinks, per level
+    unsigned long long suppressed;  ///< Messages no sink accepted
+    unsigned long long sampledOut;  ///< jpLog_infoSampled calls skipped
+    unsigned long long timeNs;      ///< Time spent in logging calls while a
+                                    ///< report runs
+    jpLogSinkStats sinks;           ///< Counters of every sink, added up
+                                    ///< (the high-water mark is the most)
+} jpLogStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of messages sent to sinks from a call site
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSiteStats {
+    jpLogLevel level;
+    const char *file;
+    const char *func;
+    int line;
+    unsigned long long records;
+} jpLogSiteStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Times of a jpLog_timeBlock call site, in nanoseconds, from
+/// jpLog_getTimerStats
+///
+/// Percentiles are rounded up to the top of their histogram bucket, at most
+/// 12.5% above the exact value.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogTimerStats {
+    const char *name;
+    const char *file;
+    const char *func;
+    int line;
+    unsigned long long count;
+    unsigned long long p50;
+    unsigned long long p90;
+    unsigned long long p99;
+    unsigned long long max;
+} jpLogTimerStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Options for a new file sink - zero-initialized fields use the
+/// defaults
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogFileConfig {
+    int compress;           ///< If nonzero, output is compressed in blocks
+    size_t blockSize;       ///< Bytes of output per compressed block,
+                            ///< JP_LOG_BLOCKSIZE if 0
+    int uring;              ///< If nonzero, output is written in batches
+                            ///< through io_uring, or pwrite without it
+    int direct;             ///< If nonzero, output is written in batches
+                            ///< with O_DIRECT, bypassing the page cache
+    unsigned long long rotateBytes; ///< If nonzero, the file is rotated
+                            ///< before it grows past this many bytes of
+                            ///< output (counted before compression)
+    unsigned rotateSeconds; ///< If nonzero, the file is rotated at each
+                            ///< multiple of this many seconds since the
+                            ///< epoch, e.g. 3600 for every hour (UTC)
+    unsigned keepFiles;     ///< Rotated files kept, all if 0
+    unsigned long long keepBytes;   ///< Bytes of rotated files kept, newest
+                            ///< first, with no limit if 0
+    int compressRotated;    ///< If nonzero, rotated files are compressed
+                            ///< in the background, as path.N.lz
+    int index;              ///< If nonzero, output is compressed in blocks
+                            ///< that each carry an index for
+                            ///< jpLog_queryFile
+    int dictionary;         ///< If nonzero, output is compressed in blocks
+                            ///< that hold each call site and format string
+                            ///< once, then only the arguments of each line
+} jpLogFileConfig;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief What jpLog_queryFile looks for in an indexed file - zero-initialized
+/// fields match every line
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogQuery {
+    unsigned levels;        ///< Bit 1 << level set for each level wanted
+    const char *file;       ///< Base name of the file that logged the line
+    int line;               ///< Line of the call site in file
+    unsigned long long since;   ///< Earliest time, in nanoseconds since the
+                                ///< epoch
+    unsigned long long until;   ///< Latest time, in nanoseconds since the
+                                ///< epoch
+    int times;              ///< If nonzero, each line is prefixed with its
+                            ///< time, as 2024-01-31T12:00:00.000000000Z
+} jpLogQuery;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief What a jpLog_queryFile call read and skipped
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogQueryStats {
+    unsigned long long blocks;      ///< Blocks in the file
+    unsigned long long skipped;     ///< Blocks skipped by their index
+    unsigned long long lines;       ///< Lines in the blocks read
+    unsigned long long matched;     ///< Lines passed on
+} jpLogQueryStats;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief A destination for log output, created by jpLog_add*Sink
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogSink jpLogSink;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief What jp_log caches about a call site of the log macros - used
+/// internally
+///
+/// With GCC and Clang each call site has one as a static (see jpLog__site),
+/// zero until the call site first logs. records comes after the prefix, so
+/// counting does not keep evicting what the other fields are read from.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpLogCallSite {
+    int state;              ///< 0 if new, 1 while being filled, 2 if ready
+    unsigned control;       ///< Epoch of the level control rules it was
+                            ///< last checked against << 1, | 1 if enabled
+    jpLogLevel level;
+    const char *file;
+    const char *func;
+    int line;
+    struct jpLogCallSite *next; ///< The call site readied before it
+    size_t prefixLength;    ///< 0 if the prefix did not fit
+    char prefix[JP_LOG_PREFIXMAX];
+    unsigned long long records; ///< Messages sent to sinks
+} jpLogCallSite;
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Bit 1 << level set for each level whose call sites may log, as set
+/// at run time - read by the log macros, written by jp_log
+///////////////////////////////////////////////////////////////////////////////
+extern unsigned jpLog__levels;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Functions
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that writes through a callback
+///
+/// @param	write   Writes formatted output
+/// @param	close   Releases data when the sink is removed, may be NULL
+/// @param	data    Passed to write and close
+/// @param	config  Options for the sink, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addSink(
+        jpLogWriteFn write,
+        jpLogCloseFn close,
+        void *data,
+        const jpLogSinkConfig *config);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that writes to a stdio stream
+///
+/// The stream is not closed when the sink is removed.
+///
+/// @param	stream  The stream, e.g. stderr
+/// @param	config  Options for the sink, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addStdioSink(FILE *stream, const jpLogSinkConfig *config);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that appends to a file
+///
+/// A compressing file sink is always async: its thread compresses the output
+/// in independent blocks, so producers never pay for compression, and a
+/// truncated file can still be read up to its last complete block. Read
+/// compressed files with jpLog_readFile or the jp_logdump tool. Compressed
+/// and plain output cannot be appended to the same file. So is a file sink
+/// writing through io_uring or with O_DIRECT, which owns its write buffers.
+///
+/// An indexed file sink compresses its output too, and notes the times,
+/// levels and call sites of the lines in each block, so jpLog_queryFile or
+/// the jp_logquery tool can skip the blocks a query cannot match. It fails
+/// with the JP_LOG_SPILL overflow policy.
+///
+/// A dictionary file sink compresses its output too, and always writes
+/// lines as jpLog_formatText does, whatever config says. It fails with the
+/// JP_LOG_SPILL overflow policy or with index set. The file must not be
+/// written by two sinks at once.
+///
+/// @param	path        Path of the file, created if it does not exist
+/// @param	config      Options for the sink, the defaults if NULL
+/// @param	fileConfig  Options for the file, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addFileSink(
+        const char *path,
+        const jpLogSinkConfig *config,
+        const jpLogFileConfig *fileConfig);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that keeps the most recent output in memory
+///
+/// Read the output with jpLog_readRing.
+///
+/// @param	size    Number of bytes of output to keep
+/// @param	config  Options for the sink, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addRingSink(size_t size, const jpLogSinkConfig *config);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that writes a Chrome Trace Event file
+///
+/// The file is a JSON array of events, with jpLog_formatTrace as the
+/// formatter whatever config says, and is neither compressed nor rotated.
+/// It is opened with "[" if it is new and left without the closing "]",
+/// which trace viewers do not need, so it can be loaded at any time and
+/// appended to by later runs. Existing files that do not start with that
+/// "[" line are refused.
+///
+/// @param	path    Path of the file, created if it does not exist
+/// @param	config  Options for the sink, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addTraceSink(const char *path, const jpLogSinkConfig *config);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Copies the output kept by a ring sink, oldest first
+///
+/// Only complete lines are copied. If buf is too small, the most recent lines
+/// that fit are copied.
+///
+/// @param	sink    A sink created by jpLog_addRingSink
+/// @param	buf     Buffer for the output
+/// @param	size    Size of the buffer
+/// @return	Number of bytes copied
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_readRing(jpLogSink *sink, char *buf, size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Adds a sink that sends output to a Unix stream socket
+///
+/// The sink connects when it first writes and reconnects after an error.
+/// Output written while the socket cannot be connected is dropped.
+///
+/// @param	path    Path of the socket
+/// @param	config  Options for the sink, the defaults if NULL
+/// @return	The sink, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+jpLogSink *jpLog_addSocketSink(const char *path, const jpLogSinkConfig *config);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads a file written by a file sink, decompressing it if needed
+///
+/// Output is passed to write in chunks, with the lines of dictionary files
+/// put back together as jpLog_formatText wrote them. Reading stops at the
+/// first truncated or corrupt block, after passing on everything before it.
+///
+/// @param	path    Path of the file
+/// @param	write   Receives the output
+/// @param	data    Passed to write
+/// @return	Nonzero if the whole file was read, zero otherwise
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_readFile(const char *path, jpLogWriteFn write, void *data);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the lines of an indexed file that match a query
+///
+/// The file is mapped, and only the blocks whose index may match the query
+/// are decompressed. Lines are passed to write one at a time. Reading stops
+/// at the first truncated or corrupt block, after passing on every match
+/// before it.
+///
+/// @param	path    Path of a file written by an indexed file sink
+/// @param	query   What to look for, every line if NULL
+/// @param	write   Receives the matching lines
+/// @param	data    Passed to write
+/// @param	stats   Receives what was read and skipped, may be NULL
+/// @return	Nonzero if the whole file was read, zero otherwise
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_queryFile(
+        const char *path,
+        const jpLogQuery *query,
+        jpLogWriteFn write,
+        void *data,
+        jpLogQueryStats *stats);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the counters of a sink
+///
+/// @param	sink    The sink
+/// @param	stats   Receives the counters
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_getSinkStats(jpLogSink *sink, jpLogSinkStats *stats);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the counters of jp_log as a whole
+///
+/// Sinks removed by jpLog_shutdown still count.
+///
+/// @param	stats   Receives the counters
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_getStats(jpLogStats *stats);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the number of messages sent to sinks from each call site
+///
+/// Call sites are those of the jpLog_ macros that have logged, built with
+/// GCC or Clang (see jpLog__site). Not to be called once a shared library
+/// whose call sites have logged is unloaded.
+///
+/// @param	sites   Receives up to max call sites
+/// @param	max     Size of sites
+/// @return	Number of call sites, which may be more than max
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_getSiteStats(jpLogSiteStats *sites, size_t max);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the times of each jpLog_timeBlock call site since the
+///         program started
+///
+/// @param	timers  Receives up to max call sites
+/// @param	max     Size of timers
+/// @return	Number of call sites, which may be more than max
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_getTimerStats(jpLogTimerStats *timers, size_t max);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Starts logging jp_log's own counters every periodMs milliseconds
+///
+/// Each report is an info message "jp_log report" with fields for what
+/// changed since the last one. Logging calls are timed while reports run
+/// (reading the clock costs more than the other counters), and a warning
+/// "jp_log over budget" follows any report whose time_ns exceeds budgetNs.
+/// Then each jpLog_timeBlock call site timed since the last report gets an
+/// info message "jp_log timer" with its count, p50_ns, p90_ns, p99_ns and
+/// max_ns.
+///
+/// @param	periodMs    Milliseconds between reports
+/// @param	budgetNs    Time logging calls may take per period, 0 for no
+///                     limit
+/// @return	Nonzero on success, zero on failure or if already started
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startReport(unsigned periodMs, unsigned long long budgetNs);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stops the reports started by jpLog_startReport
+///
+/// Called by jpLog_shutdown.
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_stopReport(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Starts following the levels set in a level control file
+///
+/// The file is created, with every level logged, if it does not exist. Its
+/// rules apply at once, and changes to it (by jpLog_setControl or
+/// jpLog_clearControl, from any process) within JP_LOG_CONTROLMS
+/// milliseconds, or at once when made by this process. Messages turned off
+/// are skipped as if compiled out: their arguments are not evaluated, and
+/// they are not counted or recorded. Exit messages are always logged.
+///
+/// @param	path    Path of the file
+/// @return	Nonzero on success, zero on failure or if already started
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startControl(const char *path);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Stops following the level control file, so every level is
+///         logged again
+///
+/// Called by jpLog_shutdown.
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_stopControl(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Sets the least severe level logged, everywhere or for a file or
+///         call site, in a level control file
+///
+/// A call site's rule comes before its file's, which comes before the level
+/// set everywhere. Files are named by their base name, e.g. "parser.c" for
+/// call sites in src/parser.c. The file is created if it does not exist,
+/// and holds up to 64 rules.
+///
+/// @param	path    Path of the file
+/// @param	site    NULL for everywhere, or "file" or "file:line"
+/// @param	level   The level
+/// @return	Nonzero on success, zero on failure or if the file is full
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_setControl(const char *path, const char *site, jpLogLevel level);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Removes the rule of a file or call site from a level control
+///         file, or every rule
+///
+/// @param	path    Path of the file
+/// @param	site    "file" or "file:line", or NULL to remove every rule and
+///                 log every level again
+/// @return	Nonzero on success, zero on failure or if there is no such rule
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_clearControl(const char *path, const char *site);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads the rules of a level control file
+///
+/// Each rule is passed to write as a line, as "* level" for the level set
+/// everywhere and "file level" or "file:line level" for the others.
+///
+/// @param	path    Path of the file
+/// @param	write   Receives the rules
+/// @param	data    Passed to write
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_readControl(const char *path, jpLogWriteFn write, void *data);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Allocates what logging calls need for a number of threads and
+///         stops them from allocating more
+///
+/// Call after adding sinks and starting the flight recorder, before the
+/// latency-critical part of the program. Sharded sinks added later get
+/// their shards when they are added. Once threads threads hold counters at
+/// once, further threads log without counters (they are not counted in
+/// jpLog_getStats) and queue to sharded sinks through the shared queue. Can
+/// be called again to allow more threads, but not undone.
+///
+/// @param	threads Most threads that will log at once, including those
+///                 already logging
+/// @return	Nonzero on success, zero if out of memory
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_preallocate(size_t threads);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Waits until async sinks have written everything queued so far
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_flush(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Flushes and removes all sinks
+///
+/// Output goes to stdout/stderr again afterwards. Called automatically at
+/// exit. Must not be called while other threads are logging.
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_shutdown(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Starts keeping the most recent messages of each thread in memory
+///
+/// Each thread gets a ring of the given number of records when it first logs,
+/// or from those allocated up front after jpLog_preallocate.
+/// Messages are truncated to JP_LOG_RECORDERMSG bytes in the ring. Messages
+/// at every level are recorded whether or not a sink accepts them or the
+/// level control file turns them off, but not levels compiled out with
+/// JP_LOG_NO*. Call sites turned off at run time are therefore turned back
+/// on while it runs. Can only be called once.
+///
+/// @param	records Number of records kept per thread
+/// @param	fd      File descriptor the recorder is dumped to, e.g. 2
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_startRecorder(size_t records, int fd);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes the flight recorder of every thread, oldest first
+///
+/// Async-signal-safe. Other threads may be logging while their rings are
+/// dumped, in which case their most recent records may be garbled. Called by
+/// jpLog__exit before exiting.
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_dumpRecorder(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Dumps the flight recorder on SIGSEGV, SIGABRT, SIGBUS, SIGILL and
+///         SIGFPE
+///
+/// The signal is raised again after the dump, so its default action (e.g.
+/// a core dump) still happens. Replaces any handlers for those signals.
+///
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+int jpLog_installCrashHandler(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Chooses the details of the logging thread added to each record
+///
+/// The formatters write them after any fields, as thread=, thread_name= and
+/// cpu=. None are added by default.
+///
+/// @param	info    jpLogRecordInfo values combined with |, or 0
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setRecordInfo(unsigned info);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Names the calling thread in its records
+///
+/// Call it once when the thread starts. Names of JP_LOG_NAMEMAX bytes or more
+/// are truncated.
+///
+/// @param	name    Name of the thread, or NULL to remove it
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setThreadName(const char *name);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Overrides the rate of every jpLog_infoSampled call site
+///
+/// e.g. 1 logs every sampled message while debugging, and 1000 thins them
+/// out further under load. 0 restores each call site's own rate.
+///
+/// @param	rate    Log 1 in rate messages, or 0
+///////////////////////////////////////////////////////////////////////////////
+void jpLog_setSampleRate(unsigned rate);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as "[LEVEL][file][func][line]: msg"
+///
+/// The default formatter. Fields are appended as in jpLog_formatLogfmt. See
+/// jpLogFormatFn.
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatText(const jpLogRecord *record, char *buf, size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as a logfmt line
+///
+/// e.g. 'level=info file=a.c func=main line=3 msg="Request done" user=bob'.
+/// Values are quoted when they contain spaces, '=', quotes or control
+/// characters. See jpLogFormatFn.
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatLogfmt(const jpLogRecord *record, char *buf, size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as a line of JSON
+///
+/// e.g. '{"level":"info","file":"a.c","func":"main","line":3,"msg":"Request
+/// done","user":"bob"}'. Non-finite doubles are written as null. A truncated
+/// line is not valid JSON. See jpLogFormatFn.
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatJson(const jpLogRecord *record, char *buf, size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as a Chrome Trace Event, followed by a comma
+///
+/// Spans become "B" and "E" events and other records "i" events, named
+/// after their message, with the level as category and the call site and
+/// fields as args, e.g.
+/// '{"name":"parse","cat":"info","ph":"B","ts":1520.250,"pid":7,"tid":7,
+/// "args":{"file":"main.c","func":"main","line":12,"span":"begin"}},'. ts
+/// is in microseconds. Records without a thread ID (see
+/// jpLog_setRecordInfo) have a tid of 0.
+///////////////////////////////////////////////////////////////////////////////
+size_t jpLog_formatTrace(const jpLogRecord *record, char *buf, size_t size);
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief	Used internally by *_info log macros
 ///
+/// @param	site    The call site, or NULL
 /// @param	file	Name of the current file
 /// @param	func	Name of the current function
 /// @param	line	Current line number
@@ -89,15 +1015,17 @@
 /// @param	...		Format arguments
 ///////////////////////////////////////////////////////////////////////////////
 void jpLog__info (
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
         const char *fmt,
-        ...);
+        ...) JP_LOG_PRINTF(5, 6);
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief	Used internally by *_warn log macros
 ///
+/// @param	site    The call site, or NULL
 /// @param	file	Name of the current file
 /// @param	func	Name of the current function
 /// @param	line	Current line number
@@ -105,15 +1033,17 @@ void jpLog__info (
 /// @param	...		Format arguments
 ///////////////////////////////////////////////////////////////////////////////
 void jpLog__warn(
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
         const char *fmt,
-        ...);
+        ...) JP_LOG_PRINTF(5, 6);
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief	Used internally by *_exit log macros
 ///
+/// @param	site    The call site, or NULL
 /// @param	file	Name of the current file
 /// @param	func	Name of the current function
 /// @param	line	Current line number
@@ -121,16 +1051,433 @@ void jpLog__warn(
 /// @param	...		Format arguments
 ///////////////////////////////////////////////////////////////////////////////
 void jpLog__exit(
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *fmt,
+        ...) JP_LOG_PRINTF(5, 6);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by *Fmt log macros when JP_LOG_TYPES is defined
+///
+/// A message whose arguments do not have the types its format string asks
+/// for is logged as "format mismatch: " and the format string, instead of
+/// being formatted from the wrong arguments. Only the conversions jp_log
+/// formats itself are checked (see jpLog__type).
+///
+/// @param	level   Level of the message - exits after logging if JP_LOG_EXIT
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	types   Types of the format arguments, encoded by jpLog__types
+/// @param	fmt     Format string
+/// @param	...		Format arguments
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__fmt(
+        jpLogLevel level,
+        jpLogCallSite *site,
         const char *file,
         const char *func,
         int line,
+        const char *types,
         const char *fmt,
-        ...);
+        ...) JP_LOG_PRINTF(7, 8);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by *Sampled log macros to decide whether to log,
+///         before the arguments are evaluated
+///
+/// @param	rate    Rate of the call site
+/// @return	Nonzero if the message is to be logged
+///////////////////////////////////////////////////////////////////////////////
+int jpLog__sample(unsigned rate);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by *Sampled log macros, after jpLog__sample
+///
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	fmt     Format string
+/// @param	...		Format arguments
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__infoSampled(
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *fmt,
+        ...) JP_LOG_PRINTF(5, 6);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by *KV log macros
+///
+/// @param	level   Level of the message
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	msg     The message
+/// @param	fields  Fields of the message
+/// @param	count   Number of fields
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__kv(
+        jpLogLevel level,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *msg,
+        const jpLogField *fields,
+        size_t count);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by span macros
+///
+/// @param	span    JP_LOG_SPAN_BEGIN or JP_LOG_SPAN_END
+/// @param	site    The call site, or NULL
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	name    Name of the span
+///////////////////////////////////////////////////////////////////////////////
+void jpLog__span(
+        jpLogSpan span,
+        jpLogCallSite *site,
+        const char *file,
+        const char *func,
+        int line,
+        const char *name);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpLog_timeBlock
+///
+/// @return	The time to start timing from, never 0
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long jpLog__timeStart(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpLog_timeBlock
+///
+/// @param	file	Name of the current file
+/// @param	func	Name of the current function
+/// @param	line	Current line number
+/// @param	name    Name of the timer
+/// @param	start   Returned by jpLog__timeStart
+/// @return	0
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long jpLog__timeStop(
+        const char *file,
+        const char *func,
+        int line,
+        const char *name,
+        unsigned long long start);
+
+#ifdef __cplusplus
+}
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Macros
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Pastes two tokens together after expanding them
+///
+/// Called internally by block macros, for names unique to their line.
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__paste(a,b)       a##b
+#define jpLog__concat(a,b)      jpLog__paste(a,b)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns nonzero if call sites of a level may log, with one load
+///
+/// Called internally by jpLog__check. Rules for files and call sites are
+/// checked by jp_log afterwards.
+///
+/// @param level    The level
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __GNUC__
+#define jpLog__enabled(level)\
+    ( __atomic_load_n(&jpLog__levels, __ATOMIC_RELAXED) >> (level) & 1U )
+#else
+#define jpLog__enabled(level)   ( jpLog__levels >> (level) & 1U )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns nonzero if a call site may log
+///
+/// Called internally by log macros, before evaluating their arguments. With
+/// JP_LOG_KEYS, the call site is a 5-byte jump to the code that logs, listed
+/// in section jp_log_keys as { jump, target, file, line, level } for jp_log
+/// to patch into a NOP, and back, as the levels change. Otherwise it is
+/// jpLog__enabled.
+///
+/// @param level    The level
+///////////////////////////////////////////////////////////////////////////////
+#ifdef JP_LOG_KEYS
+#define jpLog__check(level)\
+    __extension__ ({\
+        __label__ jpLog__jump;\
+        int jpLog__jumped = 0;\
+        __asm__ goto (".balign 8\n"\
+            "1:\t.byte 0xe9\n\t.long %l[jpLog__jump] - 2f\n2:\n\t"\
+            ".pushsection jp_log_keys, \"aw\"\n\t.balign 8\n\t"\
+            ".quad 1b, %l[jpLog__jump], %c0\n\t.long %c1, %c2\n\t"\
+            ".popsection"\
+            : : "i"(__FILE__), "i"(__LINE__), "i"(level) : : jpLog__jump);\
+        if (0) {\
+            jpLog__jump: jpLog__jumped = 1;\
+        }\
+        jpLog__jumped;\
+    })
+#else
+#define jpLog__check(level)     jpLog__enabled(level)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns the jpLogCallSite of a call site, or NULL
+///
+/// Called internally by log macros. With GCC and Clang it is a static of the
+/// call site; other compilers cannot declare one within an expression, so
+/// their call sites go without. C does not allow the static in inline
+/// functions with external linkage - define JP_LOG_NOSITES in files that
+/// log from those.
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__GNUC__) && !defined(JP_LOG_NOSITES)
+#define jpLog__site()\
+    __extension__ ({ static jpLogCallSite jpLog__siteOf; &jpLog__siteOf; })
+#else
+#define jpLog__site()           ( (jpLogCallSite *)0 )
+#endif
+
+#ifdef JP_LOG_TYPES
+
+#ifdef __cplusplus
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Encodes a promoted type as jpLog__type does in C - 'p' for any type
+/// not listed
+///////////////////////////////////////////////////////////////////////////////
+template <typename T> struct jpLog__typeCode
+    : std::integral_constant<char, 'p'> {};
+template <> struct jpLog__typeCode<int>
+    : std::integral_constant<char, 'i'> {};
+template <> struct jpLog__typeCode<unsigned>
+    : std::integral_constant<char, 'I'> {};
+template <> struct jpLog__typeCode<long>
+    : std::integral_constant<char, 'l'> {};
+template <> struct jpLog__typeCode<unsigned long>
+    : std::integral_constant<char, 'L'> {};
+template <> struct jpLog__typeCode<long long>
+    : std::integral_constant<char, 'q'> {};
+template <> struct jpLog__typeCode<unsigned long long>
+    : std::integral_constant<char, 'Q'> {};
+template <> struct jpLog__typeCode<float>
+    : std::integral_constant<char, 'f'> {};
+template <> struct jpLog__typeCode<double>
+    : std::integral_constant<char, 'f'> {};
+template <> struct jpLog__typeCode<long double>
+    : std::integral_constant<char, 'F'> {};
+template <> struct jpLog__typeCode<char *>
+    : std::integral_constant<char, 's'> {};
+template <> struct jpLog__typeCode<const char *>
+    : std::integral_constant<char, 's'> {};
+template <> struct jpLog__typeCode<signed char *>
+    : std::integral_constant<char, 's'> {};
+template <> struct jpLog__typeCode<const signed char *>
+    : std::integral_constant<char, 's'> {};
+template <> struct jpLog__typeCode<unsigned char *>
+    : std::integral_constant<char, 's'> {};
+template <> struct jpLog__typeCode<const unsigned char *>
+    : std::integral_constant<char, 's'> {};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The type a format argument of type T is passed as - arrays decay,
+/// and integers, bools and unscoped enums are promoted (floats are encoded
+/// as doubles are)
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, bool = std::is_arithmetic<T>::value
+    || (std::is_enum<T>::value && std::is_convertible<T, int>::value)>
+struct jpLog__promote {
+    typedef T type;
+};
+template <typename T> struct jpLog__promote<T, true> {
+    typedef decltype(+std::declval<T>()) type;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The types of some format arguments encoded as a string, one
+/// jpLog__typeCode per argument
+///////////////////////////////////////////////////////////////////////////////
+template <typename... T> struct jpLog__typeList {
+    static const char value[sizeof...(T) + 1];
+};
+template <typename... T>
+const char jpLog__typeList<T...>::value[sizeof...(T) + 1] = {
+    jpLog__typeCode<typename jpLog__promote<
+        typename std::decay<T>::type>::type>::value..., '\0'
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief The type of a format argument, for jpLog__typeList to encode
+///
+/// The argument is not evaluated.
+///
+/// @param x    The argument
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__type(x) decltype((x))
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Encodes the type of a format argument, after promotion
+///
+/// 'i' for int, 'I' for unsigned, 'l'/'L' for long, 'q'/'Q' for long long,
+/// 'f' for double, 'F' for long double, 's' for strings and 'p' for anything
+/// else. The argument is not evaluated.
+///
+/// @param x    The argument
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__type(x) _Generic((x),\
+    _Bool: 'i', char: 'i', signed char: 'i', unsigned char: 'i',\
+    short: 'i', unsigned short: 'i', int: 'i', unsigned: 'I',\
+    long: 'l', unsigned long: 'L', long long: 'q', unsigned long long: 'Q',\
+    float: 'f', double: 'f', long double: 'F',\
+    char *: 's', const char *: 's',\
+    signed char *: 's', const signed char *: 's',\
+    unsigned char *: 's', const unsigned char *: 's',\
+    default: 'p')
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Counts the arguments of a macro, from 1 to 16
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__argCount(...)\
+    jpLog__argCountN(__VA_ARGS__,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0)
+#define jpLog__argCountN(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,_12,_13,_14,\
+    _15,_16,n,...) n
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Encodes the types of up to 16 format arguments as a string, one
+/// jpLog__type per argument, built at compile time
+///
+/// Called internally by *Fmt log macros. With GCC and Clang the string is a
+/// static of its call site, so nothing is built when the call runs; other
+/// C compilers get a compound literal. In C++ it is the jpLog__typeList of
+/// the argument types.
+///////////////////////////////////////////////////////////////////////////////
+#if defined(__cplusplus)
+#define jpLog__types(...)\
+    jpLog__typeList<jpLog__concat(jpLog__types,\
+        jpLog__argCount(__VA_ARGS__))(__VA_ARGS__)>::value
+#elif defined(__GNUC__)
+#define jpLog__types(...)\
+    __extension__ ({\
+        static const char jpLog__typesOf[] = { jpLog__concat(jpLog__types,\
+            jpLog__argCount(__VA_ARGS__))(__VA_ARGS__), '\0' };\
+        jpLog__typesOf;\
+    })
+#else
+#define jpLog__types(...)\
+    ( (const char[]){ jpLog__concat(jpLog__types,\
+        jpLog__argCount(__VA_ARGS__))(__VA_ARGS__), '\0' } )
+#endif
+#define jpLog__types1(a)         jpLog__type(a)
+#define jpLog__types2(a,...)     jpLog__type(a),jpLog__types1(__VA_ARGS__)
+#define jpLog__types3(a,...)     jpLog__type(a),jpLog__types2(__VA_ARGS__)
+#define jpLog__types4(a,...)     jpLog__type(a),jpLog__types3(__VA_ARGS__)
+#define jpLog__types5(a,...)     jpLog__type(a),jpLog__types4(__VA_ARGS__)
+#define jpLog__types6(a,...)     jpLog__type(a),jpLog__types5(__VA_ARGS__)
+#define jpLog__types7(a,...)     jpLog__type(a),jpLog__types6(__VA_ARGS__)
+#define jpLog__types8(a,...)     jpLog__type(a),jpLog__types7(__VA_ARGS__)
+#define jpLog__types9(a,...)     jpLog__type(a),jpLog__types8(__VA_ARGS__)
+#define jpLog__types10(a,...)    jpLog__type(a),jpLog__types9(__VA_ARGS__)
+#define jpLog__types11(a,...)    jpLog__type(a),jpLog__types10(__VA_ARGS__)
+#define jpLog__types12(a,...)    jpLog__type(a),jpLog__types11(__VA_ARGS__)
+#define jpLog__types13(a,...)    jpLog__type(a),jpLog__types12(__VA_ARGS__)
+#define jpLog__types14(a,...)    jpLog__type(a),jpLog__types13(__VA_ARGS__)
+#define jpLog__types15(a,...)    jpLog__type(a),jpLog__types14(__VA_ARGS__)
+#define jpLog__types16(a,...)    jpLog__type(a),jpLog__types15(__VA_ARGS__)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs a formatted message along with the types of its arguments
+///
+/// Called internally by *Fmt log macros.
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__logFmt(level,fn,fmt,...)\
+    jpLog__fmt(level,jpLog__site(),__FILE__,__func__,__LINE__,\
+        jpLog__types(__VA_ARGS__),fmt,__VA_ARGS__)
+
+#else
+
+    #define jpLog__logFmt(level,fn,fmt,...)\
+        fn(jpLog__site(),__FILE__,__func__,__LINE__,fmt,__VA_ARGS__)
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Creates a jpLogField with a signed integer value
+///
+/// @param key      Name of the field
+/// @param value    The value
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_int(key,value)\
+    ( (jpLogField){ (key), JP_LOG_FIELD_INT, { .i = (value) } } )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Creates a jpLogField with an unsigned integer value
+///
+/// @param key      Name of the field
+/// @param value    The value
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_uint(key,value)\
+    ( (jpLogField){ (key), JP_LOG_FIELD_UINT, { .u = (value) } } )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Creates a jpLogField with a floating-point value
+///
+/// @param key      Name of the field
+/// @param value    The value
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_double(key,value)\
+    ( (jpLogField){ (key), JP_LOG_FIELD_DOUBLE, { .d = (value) } } )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Creates a jpLogField with a string value
+///
+/// The string is escaped as needed by the formatter.
+///
+/// @param key      Name of the field
+/// @param value    The value (NULL is written as an empty string)
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_str(key,value)\
+    ( (jpLogField){ (key), JP_LOG_FIELD_STR, { .s = (value) } } )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Creates a jpLogField with a boolean value
+///
+/// @param key      Name of the field
+/// @param value    The value, true if nonzero
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_bool(key,value)\
+    ( (jpLogField){ (key), JP_LOG_FIELD_BOOL, { .u = !!(value) } } )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Passes the fields of a *KV log macro to jpLog__kv
+///
+/// Called internally by *KV log macros.
+///
+/// @param ...  The fields
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog__fields(...)\
+    ( (const jpLogField[]){ __VA_ARGS__ } ),\
+    ( sizeof((jpLogField[]){ __VA_ARGS__ }) / sizeof(jpLogField) )
+
 #ifndef JP_LOG_NOINFO
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -138,7 +1485,9 @@ void jpLog__exit(
 ///
 /// @param msg  Message to log
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_info(msg) jpLog__info(__FILE__,__func__,__LINE__,"%s",msg)
+#define jpLog_info(msg)\
+    ( jpLog__check(JP_LOG_INFO)?\
+        jpLog__info(jpLog__site(),__FILE__,__func__,__LINE__,"%s",msg):(void)0 )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a message if expr is true
@@ -154,8 +1503,9 @@ void jpLog__exit(
 /// @param fmt  Format string
 /// @param ...  Format arguments
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_infoFmt(fmt,...) jpLog__info(__FILE__,__func__,__LINE__,fmt,\
-	__VA_ARGS__)
+#define jpLog_infoFmt(fmt,...)\
+    ( jpLog__check(JP_LOG_INFO)?\
+        jpLog__logFmt(JP_LOG_INFO,jpLog__info,fmt,__VA_ARGS__):(void)0 )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a formatted message if expr is true
@@ -167,12 +1517,43 @@ void jpLog__exit(
 #define jpLog_infoFmtIf(expr,fmt,...)\
     ( (expr)?jpLog_infoFmt(fmt,__VA_ARGS__),expr:expr )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs a message with typed key/value fields
+///
+/// e.g. jpLog_infoKV("Request done", jpLog_str("user", name),
+///     jpLog_int("status", 200), jpLog_double("ms", elapsed))
+///
+/// @param msg  Message to log
+/// @param ...  One or more jpLogFields
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_infoKV(msg,...)\
+    ( jpLog__check(JP_LOG_INFO)?\
+        jpLog__kv(JP_LOG_INFO,jpLog__site(),__FILE__,__func__,__LINE__,msg,\
+            jpLog__fields(__VA_ARGS__)):(void)0 )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs a formatted message, picking 1 in rate calls at random
+///
+/// Skipped calls do not evaluate or format their arguments. Logged messages
+/// carry a sample_rate field so counts can be scaled back up. See
+/// jpLog_setSampleRate.
+///
+/// @param rate Log 1 in rate calls - 0 or 1 logs every call
+/// @param ...  Format string and format arguments
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_infoSampled(rate,...)\
+    ( jpLog__check(JP_LOG_INFO) && jpLog__sample(rate)?\
+        jpLog__infoSampled(jpLog__site(),__FILE__,__func__,__LINE__,\
+            __VA_ARGS__):(void)0 )
+
 #else
 
     #define jpLog_info(...)         ( (void)(__VA_ARGS__) )
     #define jpLog_infoIf(...)       ( (void)(__VA_ARGS__) )
     #define jpLog_infoFmt(...)      ( (void)(__VA_ARGS__) )
     #define jpLog_infoFmtIf(...)    ( (void)(__VA_ARGS__) )
+    #define jpLog_infoKV(...)       ( (void)(__VA_ARGS__) )
+    #define jpLog_infoSampled(...)  ( (void)(__VA_ARGS__) )
 
 #endif
 
@@ -183,7 +1564,9 @@ void jpLog__exit(
 ///
 /// @param msg  Message to log
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_warn(msg) jpLog__warn(__FILE__,__func__,__LINE__,"%s",msg)
+#define jpLog_warn(msg)\
+    ( jpLog__check(JP_LOG_WARN)?\
+        jpLog__warn(jpLog__site(),__FILE__,__func__,__LINE__,"%s",msg):(void)0 )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a message indicating a runtime error if expr is true
@@ -199,8 +1582,9 @@ void jpLog__exit(
 /// @param fmt  Format string
 /// @param ...  Format arguments
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_warnFmt(fmt,...) jpLog__warn(__FILE__,__func__,__LINE__,fmt,\
-	__VA_ARGS__)
+#define jpLog_warnFmt(fmt,...)\
+    ( jpLog__check(JP_LOG_WARN)?\
+        jpLog__logFmt(JP_LOG_WARN,jpLog__warn,fmt,__VA_ARGS__):(void)0 )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a formatted message indicating a runtime error if expr is true
@@ -212,12 +1596,25 @@ void jpLog__exit(
 #define jpLog_warnFmtIf(expr,fmt,...)\
     ( (expr)?jpLog_warnFmt(fmt,__VA_ARGS__),expr:expr )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs a message indicating a runtime error with typed key/value
+/// fields
+///
+/// @param msg  Message to log
+/// @param ...  One or more jpLogFields
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_warnKV(msg,...)\
+    ( jpLog__check(JP_LOG_WARN)?\
+        jpLog__kv(JP_LOG_WARN,jpLog__site(),__FILE__,__func__,__LINE__,msg,\
+            jpLog__fields(__VA_ARGS__)):(void)0 )
+
 #else
 
     #define jpLog_warn(...)         ( (void)(__VA_ARGS__) )
     #define jpLog_warnIf(...)       ( (void)(__VA_ARGS__) )
     #define jpLog_warnFmt(...)      ( (void)(__VA_ARGS__) )
     #define jpLog_warnFmtIf(...)    ( (void)(__VA_ARGS__) )
+    #define jpLog_warnKV(...)       ( (void)(__VA_ARGS__) )
 
 #endif
 
@@ -230,7 +1627,8 @@ void jpLog__exit(
 ///
 /// @param msg  Message to log
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_exit(msg) jpLog__exit(__FILE__,__func__,__LINE__,"%s",msg)
+#define jpLog_exit(msg)\
+    jpLog__exit(jpLog__site(),__FILE__,__func__,__LINE__,"%s",msg)
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a message indicating a program error if expr is true
@@ -250,8 +1648,8 @@ void jpLog__exit(
 /// @param fmt  Format string
 /// @param ...  Format arguments
 ///////////////////////////////////////////////////////////////////////////////
-#define jpLog_exitFmt(fmt,...) jpLog__exit(__FILE__,__func__,__LINE__,fmt,\
-	__VA_ARGS__)
+#define jpLog_exitFmt(fmt,...)\
+    jpLog__logFmt(JP_LOG_EXIT,jpLog__exit,fmt,__VA_ARGS__)
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Logs a formatted message indicating a program error if expr is true
@@ -265,12 +1663,96 @@ void jpLog__exit(
 #define jpLog_exitFmtIf(expr,fmt,...)\
     ( (expr)?jpLog_exitFmt(fmt,__VA_ARGS__),expr:expr )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs a message indicating a program error with typed key/value
+/// fields
+///
+/// The program exits after logging.
+///
+/// @param msg  Message to log
+/// @param ...  One or more jpLogFields
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_exitKV(msg,...)\
+    jpLog__kv(JP_LOG_EXIT,jpLog__site(),__FILE__,__func__,__LINE__,msg,\
+        jpLog__fields(__VA_ARGS__))
+
 #else
 
     #define jpLog_exit(...)         ( (void)(__VA_ARGS__) )
     #define jpLog_exitIf(...)       ( (void)(__VA_ARGS__) )
     #define jpLog_exitFmt(...)      ( (void)(__VA_ARGS__) )
     #define jpLog_exitFmtIf(...)    ( (void)(__VA_ARGS__) )
+    #define jpLog_exitKV(...)       ( (void)(__VA_ARGS__) )
+
+#endif
+
+#ifndef JP_LOG_NOSPAN
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs the start of a span
+///
+/// Spans of a thread nest, so each jpLog_spanEnd ends the latest span that
+/// has not ended yet.
+///
+/// @param name Name of the span
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_spanBegin(name)\
+    jpLog__span(JP_LOG_SPAN_BEGIN,jpLog__site(),__FILE__,__func__,__LINE__,name)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Logs the end of the calling thread's latest span, with its
+/// duration
+///
+/// @param name Name of the span
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_spanEnd(name)\
+    jpLog__span(JP_LOG_SPAN_END,jpLog__site(),__FILE__,__func__,__LINE__,name)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Runs the block that follows in a span
+///
+/// name is evaluated at the start and end of the block. Leaving the block
+/// with break, goto or return skips the end of the span.
+///
+/// @param name Name of the span
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_span(name)\
+    for (int jpLog__concat(jpLog__spanLine, __LINE__) =\
+            (jpLog_spanBegin(name), 1);\
+        jpLog__concat(jpLog__spanLine, __LINE__);\
+        jpLog__concat(jpLog__spanLine, __LINE__) = (jpLog_spanEnd(name), 0))
+
+#else
+
+    #define jpLog_spanBegin(...)    ( (void)(__VA_ARGS__) )
+    #define jpLog_spanEnd(...)      ( (void)(__VA_ARGS__) )
+    #define jpLog_span(name)        if (((void)(name), 1))
+
+#endif
+
+#ifndef JP_LOG_NOTIMER
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Times the block that follows, adding the time to the histogram of
+/// this call site
+///
+/// Leaving the block with break, goto or return skips the timing. At most 64
+/// call sites are timed. A thread that first reaches a call site in steady
+/// state (see jpLog_preallocate) does not time it.
+///
+/// @param name Name of the timer, a string literal
+///////////////////////////////////////////////////////////////////////////////
+#define jpLog_timeBlock(name)\
+    for (unsigned long long jpLog__concat(jpLog__timeLine, __LINE__) =\
+            jpLog__timeStart();\
+        jpLog__concat(jpLog__timeLine, __LINE__);\
+        jpLog__concat(jpLog__timeLine, __LINE__) = jpLog__timeStop(\
+            __FILE__,__func__,__LINE__,name,\
+            jpLog__concat(jpLog__timeLine, __LINE__)))
+
+#else
+
+    #define jpLog_timeBlock(name)   if (((void)(name), 1))
 
 #endif
 
@@ -0,0 +1,314 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_vector.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Generic API for managing dynamic arrays in C99
+///////////////////////////////////////////////////////////////////////////////
+#define _POSIX_C_SOURCE 200809L
+#define JP_VECTOR_MMAP
+
+#include "jp_vector.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Defines
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Identifies a file written by jpVector_save
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTOR_FILEMAGIC     "jpVector"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Version of the file layout written by jpVector_save
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTOR_FILEVERSION   (1)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Largest supported alignment of the data within a file
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTOR_FILEMAXALIGN  (4096)
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Smallest offset of the data within a file
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTOR_FILEMINOFFSET (64)
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Header at the beginning of a file written by jpVector_save
+///
+/// The data begins at offset bytes from the start of the file. Since offset
+/// is never larger than the page size, the header of a mapped jpVector can
+/// always be found on the page preceding its data.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpVectorFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t offset;
+    uint64_t elemSize;
+    uint64_t length;
+    uint64_t align;
+    uint64_t checksum;
+} jpVectorFileHeader;
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+size_t jpVector__allocated = 0;
+size_t jpVector__used = 0;
+size_t jpVector__reallocs = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Computes the FNV-1a hash of a block of memory
+///
+/// @param	data    The memory to hash
+/// @param	size    Size of the memory in bytes
+/// @return	The hash
+///////////////////////////////////////////////////////////////////////////////
+static uint64_t jpVector__checksum(const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the offset of the data within a file for an alignment
+///
+/// @param	align   Alignment of the data
+/// @return	The offset
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpVector__offset(size_t align)
+{
+    return align < JP_VECTOR_FILEMINOFFSET ? JP_VECTOR_FILEMINOFFSET : align;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the header of a mapped jpVector
+///
+/// @param	data    Pointer returned by jpVector__map
+/// @return	The header at the beginning of the mapping
+///////////////////////////////////////////////////////////////////////////////
+static const jpVectorFileHeader *jpVector__header(const void *data)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+
+    // The offset is in [64, 4096] and the mapping is page-aligned, so the
+    // byte preceding the data is always on the mapping's first page
+    return (const jpVectorFileHeader *)
+        (((uintptr_t)data - 1) & ~(page - 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Public functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int jpVector__save(
+        const void *data,
+        size_t elemSize,
+        size_t length,
+        size_t align,
+        const char *path)
+{
+    if (!path || (!data && length) || !align || (align & (align - 1))
+            || align > JP_VECTOR_FILEMAXALIGN) {
+        return 0;
+    }
+
+    static const char padding[JP_VECTOR_FILEMAXALIGN];
+    jpVectorFileHeader header;
+    size_t offset = jpVector__offset(align);
+    size_t size = elemSize * length;
+    size_t pathLength = strlen(path);
+    char *tmpPath = NULL;
+    FILE *file = NULL;
+    int written = 0;
+    int dir = -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JP_VECTOR_FILEMAGIC, sizeof(header.magic));
+    header.version = JP_VECTOR_FILEVERSION;
+    header.offset = (uint32_t)offset;
+    header.elemSize = elemSize;
+    header.length = length;
+    header.align = align;
+    header.checksum = jpVector__checksum(data, size);
+
+    tmpPath = malloc(pathLength + sizeof(".tmp"));
+    if (!tmpPath) {
+        return 0;
+    }
+    memcpy(tmpPath, path, pathLength);
+    memcpy(tmpPath + pathLength, ".tmp", sizeof(".tmp"));
+
+    file = fopen(tmpPath, "wb");
+    if (!file) {
+        free(tmpPath);
+        return 0;
+    }
+
+    // The data must be on disk before the rename, or a crash could leave
+    // path naming an empty or partial file
+    written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(padding, offset - sizeof(header), 1, file) == 1
+        && (!size || fwrite(data, size, 1, file) == 1)
+        && !fflush(file)
+        && !fsync(fileno(file));
+
+    if (fclose(file) || !written) {
+        remove(tmpPath);
+        free(tmpPath);
+        return 0;
+    }
+
+    if (rename(tmpPath, path)) {
+        remove(tmpPath);
+        free(tmpPath);
+        return 0;
+    }
+
+    // The rename itself is durable once the directory holding path is.
+    // tmpPath is reused for the directory's name
+    while (pathLength && tmpPath[pathLength - 1] != '/') {
+        --pathLength;
+    }
+    while (pathLength > 1 && tmpPath[pathLength - 1] == '/') {
+        --pathLength;
+    }
+    if (pathLength) {
+        tmpPath[pathLength] = '\0';
+    }
+    dir = open(pathLength ? tmpPath : ".", O_RDONLY);
+    written = dir >= 0 && !fsync(dir);
+    if (dir >= 0) {
+        close(dir);
+    }
+
+    free(tmpPath);
+    return written;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void *jpVector__map(
+        const char *path,
+        size_t elemSize,
+        size_t *length,
+        int verify)
+{
+    if (!path || !length || !elemSize) {
+        return NULL;
+    }
+
+    jpVectorFileHeader header;
+    struct stat info;
+    unsigned char *base = NULL;
+    size_t size = 0;
+    int fd = -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &info) || (size_t)info.st_size < sizeof(header)
+            || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        close(fd);
+        return NULL;
+    }
+
+    if (memcmp(header.magic, JP_VECTOR_FILEMAGIC, sizeof(header.magic))
+            || header.version != JP_VECTOR_FILEVERSION
+            || header.offset != jpVector__offset(header.align)
+            || header.offset > JP_VECTOR_FILEMAXALIGN) {
+        close(fd);
+        return NULL;
+    }
+
+    if (header.elemSize != elemSize) {
+        close(fd);
+        return NULL;
+    }
+
+    // A crafted length must not wrap size and pass the check against st_size
+    if (header.length > (SIZE_MAX - header.offset) / header.elemSize) {
+        close(fd);
+        return NULL;
+    }
+
+    size = header.offset + header.elemSize * header.length;
+    if ((size_t)info.st_size < size) {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (verify && jpVector__checksum(base + header.offset, size
+                - header.offset) != header.checksum) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    *length = header.length;
+    return base + header.offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void jpVector__unmap(const void *data)
+{
+    if (!data) {
+        return;
+    }
+
+    const jpVectorFileHeader *header = jpVector__header(data);
+
+    munmap((void *)header, header->offset
+            + header->elemSize * header->length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+jpVectorStats jpVector__stats(void)
+{
+    jpVectorStats stats;
+
+#ifdef __GNUC__
+    stats.allocated = __atomic_load_n(&jpVector__allocated, __ATOMIC_RELAXED);
+    stats.used = __atomic_load_n(&jpVector__used, __ATOMIC_RELAXED);
+    stats.reallocs = __atomic_load_n(&jpVector__reallocs, __ATOMIC_RELAXED);
+#else
+    stats.allocated = jpVector__allocated;
+    stats.used = jpVector__used;
+    stats.reallocs = jpVector__reallocs;
+#endif
+
+    return stats;
+}
@@ -13,10 +13,104 @@
 #include <stdlib.h>
 #include <string.h>
 
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Memory accounting across all jpVectors
+///
+/// Only updated when JP_VECTOR_STATS is defined before including this header.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpVectorStats {
+    size_t allocated;   ///< Bytes allocated for elements (max * size)
+    size_t used;        ///< Bytes used by elements (length * size)
+    size_t reallocs;    ///< Number of times an allocation was resized
+} jpVectorStats;
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Counters backing jpVector_stats - updated by jpVector macros
+///////////////////////////////////////////////////////////////////////////////
+extern size_t jpVector__allocated;
+extern size_t jpVector__used;
+extern size_t jpVector__reallocs;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Functions
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally when shrinking a jpVector
+///
+/// Shrinking is an optimization, so the original allocation is kept if it
+/// cannot be resized.
+///
+/// @param	data    Pointer to the jpVector's data
+/// @param	size    New size of the allocation in bytes
+/// @return	Pointer to the resized data
+///////////////////////////////////////////////////////////////////////////////
+static inline void *jpVector__shrink(void *data, size_t size)
+{
+    void *shrunk = realloc(data, size);
+
+    return shrunk ? shrunk : data;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpVector_stats
+///
+/// @return	Snapshot of the memory accounting counters
+///////////////////////////////////////////////////////////////////////////////
+jpVectorStats jpVector__stats(void);
+
+#ifdef JP_VECTOR_MMAP
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpVector_save
+///
+/// @param	data        Pointer to the jpVector's data
+/// @param	elemSize    Size of a single element
+/// @param	length      Number of elements to write
+/// @param	align       Alignment of the data within the file
+/// @param	path        Path of the file to write
+/// @return	Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+int jpVector__save(
+        const void *data,
+        size_t elemSize,
+        size_t length,
+        size_t align,
+        const char *path);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpVector_mapReadOnly
+///
+/// @param	path        Path of the file to map
+/// @param	elemSize    Expected size of a single element
+/// @param	length      Receives the number of elements in the file
+/// @param	verify      If nonzero, the data checksum is verified
+/// @return	Pointer to the mapped data, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+void *jpVector__map(
+        const char *path,
+        size_t elemSize,
+        size_t *length,
+        int verify);
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Used internally by jpVector_destroy to release mapped data
+///
+/// @param	data    Pointer returned by jpVector__map
+///////////////////////////////////////////////////////////////////////////////
+void jpVector__unmap(const void *data);
+
+// ifdef JP_VECTOR_MMAP
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // Macros
 ///////////////////////////////////////////////////////////////////////////////
@@ -26,6 +120,66 @@
 ///////////////////////////////////////////////////////////////////////////////
 #define JP_VECTOR_BASESIZE      (2)
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief If nonzero, jpVector_pop and jpVector_erase shrink a jpVector to
+/// half its max length when its length falls below max / JP_VECTOR_SHRINKDIV
+///
+/// Disabled (0) by default, since shrinking reallocs and moves the data,
+/// which invalidates pointers into a jpVector that only had elements
+/// removed. Define it (e.g. as 4) before including this header to opt in.
+/// It must be > 2, or a jpVector shrunk to half its max length would be
+/// full and grow again on the next push. jpVector_shrinkToFit works either
+/// way.
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_VECTOR_SHRINKDIV
+#define JP_VECTOR_SHRINKDIV     (0)
+#endif
+
+#if JP_VECTOR_SHRINKDIV && JP_VECTOR_SHRINKDIV <= 2
+#error "JP_VECTOR_SHRINKDIV must be 0 or greater than 2"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Define JP_VECTOR_MMAP before including jp_vector.h to enable
+/// jpVector_save and jpVector_mapReadOnly
+///
+/// These need jp_vector.c and a POSIX system. It must be defined in every
+/// file that destroys a mapped jpVector, since jpVector_destroy otherwise
+/// frees the data instead of unmapping it.
+///////////////////////////////////////////////////////////////////////////////
+// #define JP_VECTOR_MMAP
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Alignment of the data written by jpVector_save - must be a power of
+/// two between 1 and 4096
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JP_VECTOR_FILEALIGN
+#define JP_VECTOR_FILEALIGN     (64)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Updates a memory accounting counter
+///
+/// Called internally by jpVector macros.
+///
+/// @param counter  Name of the counter (allocated, used or reallocs)
+/// @param delta    Amount to add to the counter (may be negative)
+///////////////////////////////////////////////////////////////////////////////
+#ifdef JP_VECTOR_STATS
+#ifdef __GNUC__
+#define jpVector__count(counter,delta)\
+    __atomic_fetch_add(\
+        &jpVector__##counter,\
+        (size_t)(delta),\
+        __ATOMIC_RELAXED)
+#else
+#define jpVector__count(counter,delta)\
+    ( jpVector__##counter += (size_t)(delta) )
+#endif
+#else
+#define jpVector__count(counter,delta) ( (void)0 )
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Declare a new jpVector
 ///
@@ -49,15 +203,39 @@
     (\
         (vec).length = 0,\
         (vec).max = JP_VECTOR_BASESIZE,\
+        jpVector__count(allocated, JP_VECTOR_BASESIZE * sizeof(*(vec).data)),\
         (vec).data = calloc(JP_VECTOR_BASESIZE, sizeof(*(vec).data))\
     )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Frees the data of a jpVector that was not mapped
+///
+/// Called internally by jpVector_destroy.
+///
+/// @param vec  The jpVector
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector__free(vec)\
+    (\
+        jpVector__count(allocated, -(vec).max * sizeof(*(vec).data)),\
+        jpVector__count(used, -(vec).length * sizeof(*(vec).data)),\
+        free((vec).data)\
+    )
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Frees the memory allocated for a jpVector
 ///
 /// @param vec  The jpVector
 ///////////////////////////////////////////////////////////////////////////////
-#define jpVector_destroy(vec)   ( free((vec).data), (vec).data = NULL )
+#ifdef JP_VECTOR_MMAP
+#define jpVector_destroy(vec)\
+    (\
+        jpVector_isMapped(vec) ?\
+            jpVector__unmap((vec).data) : jpVector__free(vec),\
+        (vec).data = NULL\
+    )
+#else
+#define jpVector_destroy(vec)   ( jpVector__free(vec), (vec).data = NULL )
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Returns the length of a jpVector (number of used elements)
@@ -73,6 +251,15 @@
 ///////////////////////////////////////////////////////////////////////////////
 #define jpVector_max(vec)       ( (vec).max )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns nonzero if a jpVector was created by jpVector_mapReadOnly
+///
+/// Mapped jpVectors have a max of 0 and must not be modified.
+///
+/// @param vec  The jpVector
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_isMapped(vec)  ( (vec).max == 0 && (vec).data != NULL )
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Expands the allocated size of a jpVector
 ///
@@ -82,10 +269,94 @@
 ///////////////////////////////////////////////////////////////////////////////
 #define jpVector_expand(vec)\
     (\
+        jpVector__count(allocated, (vec).max / 2 * sizeof(*(vec).data)),\
+        jpVector__count(reallocs, 1),\
         (vec).max += (vec).max / 2,\
         (vec).data = realloc((vec).data, sizeof(*(vec).data) * (vec).max)\
     )
 
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Ensures a jpVector can hold a number of elements without expanding
+///
+/// @param vec      The jpVector
+/// @param newMax   Number of elements to allocate for
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_reserve(vec,newMax)\
+    (\
+        (newMax) > (vec).max ?\
+            (\
+                jpVector__count(allocated,\
+                    ((newMax) - (vec).max) * sizeof(*(vec).data)),\
+                jpVector__count(reallocs, 1),\
+                (vec).data = realloc(\
+                    (vec).data,\
+                    sizeof(*(vec).data) * (newMax)),\
+                (void)((vec).max = (newMax))\
+            ) : (void)0\
+    )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Reduces the allocated size of a jpVector to a max length
+///
+/// Called internally by jpVector macros. The max length must be >= the length
+/// of the jpVector.
+///
+/// @param vec      The jpVector
+/// @param newMax   New max length of the jpVector
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector__shrinkTo(vec,newMax)\
+    (\
+        jpVector__count(allocated,\
+            ((newMax) - (vec).max) * sizeof(*(vec).data)),\
+        jpVector__count(reallocs, 1),\
+        (vec).data = jpVector__shrink(\
+            (vec).data,\
+            sizeof(*(vec).data) * (newMax)),\
+        (vec).max = (newMax)\
+    )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Halves the allocated size of a jpVector if it is mostly unused
+///
+/// Called internally by jpVector macros that decrease the length, before the
+/// length is decreased. The elements below the new length are kept.
+///
+/// @param vec      The jpVector
+/// @param length   New length of the jpVector
+///////////////////////////////////////////////////////////////////////////////
+#if JP_VECTOR_SHRINKDIV
+#define jpVector__autoShrink(vec,length)\
+    (\
+        ((length) < (vec).max / JP_VECTOR_SHRINKDIV\
+            && (vec).max / 2 >= JP_VECTOR_BASESIZE) ?\
+            (void)jpVector__shrinkTo(vec, (vec).max / 2) : (void)0\
+    )
+#else
+#define jpVector__autoShrink(vec,length) ( (void)0 )
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Reduces the allocated size of a jpVector to its length
+///
+/// The max length never drops below JP_VECTOR_BASESIZE.
+///
+/// @param vec  The jpVector
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_shrinkToFit(vec)\
+    (\
+        (vec).max > (vec).length && (vec).max > JP_VECTOR_BASESIZE ?\
+            (void)jpVector__shrinkTo(vec, (vec).length > JP_VECTOR_BASESIZE ?\
+                (vec).length : JP_VECTOR_BASESIZE) : (void)0\
+    )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Returns a jpVectorStats snapshot of the memory used by all jpVectors
+///
+/// JP_VECTOR_STATS must be defined before including this header in every
+/// file that uses jpVectors, otherwise the counters are not updated.
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_stats()        ( jpVector__stats() )
+
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Returns the jpVector element at a particular index
 ///
@@ -110,31 +381,100 @@
 #define jpVector_push(vec,value)\
     (\
         ((vec).length == (vec).max) ? jpVector_expand(vec) : 0,\
+        jpVector__count(used, sizeof(*(vec).data)),\
         (vec).data[(vec).length++] = (value)\
     )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Pops a value out of the jpVector
 ///
+/// The jpVector may be shrunk (see JP_VECTOR_SHRINKDIV), which never discards
+/// the popped value.
+///
 /// @param vec  The jpVector
 /// @return The value popped
 ///////////////////////////////////////////////////////////////////////////////
-#define jpVector_pop(vec) ( (vec).data[(vec).length--] )
+#define jpVector_pop(vec)\
+    (\
+        jpVector__count(used, -sizeof(*(vec).data)),\
+        jpVector__autoShrink(vec, (vec).length - 1),\
+        (vec).data[--(vec).length]\
+    )
 
 ///////////////////////////////////////////////////////////////////////////////
 /// @brief Removes an entry at a particular index in the jpVector
 ///
+/// The jpVector may be shrunk (see JP_VECTOR_SHRINKDIV).
+///
 /// @param vec      The jpVector
 /// @param index    Index of the element to remove
+/// @return The new length of the jpVector
 ///////////////////////////////////////////////////////////////////////////////
 #define jpVector_erase(vec,index)\
     (\
         memmove(\
             (vec).data + (index),\
-            (vec).data + (index + 1),\
-            ((vec).length - index) * sizeof(*(vec).data)),\
+            (vec).data + (index) + 1,\
+            ((vec).length - (index) - 1) * sizeof(*(vec).data)),\
+        jpVector__count(used, -sizeof(*(vec).data)),\
+        jpVector__autoShrink(vec, (vec).length - 1),\
         --(vec).length\
     )
 
+#ifdef JP_VECTOR_MMAP
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Writes a jpVector to a file that can be mapped by
+/// jpVector_mapReadOnly
+///
+/// The file holds a small header (element size, length, alignment and a
+/// checksum of the data) followed by the raw data, aligned to
+/// JP_VECTOR_FILEALIGN. The file is written next to path, synced and
+/// renamed into place, and the directory is synced after. Processes that
+/// have the old file mapped are unaffected, and after a crash path names
+/// either the old file or the whole new one.
+///
+/// @param vec  The jpVector
+/// @param path Path of the file to write
+/// @return Nonzero on success, zero on failure
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_save(vec,path)\
+    jpVector__save(\
+        (vec).data,\
+        sizeof(*(vec).data),\
+        (vec).length,\
+        JP_VECTOR_FILEALIGN,\
+        (path))
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Maps a file written by jpVector_save as a read-only jpVector
+///
+/// The data is not copied: pages are faulted in from the file as they are
+/// accessed. Use this instead of jpVector_create, and release the jpVector
+/// with jpVector_destroy as usual. The element size stored in the file must
+/// match the jpVector's element type.
+///
+/// Verifying the checksum reads the whole file, so it should only be done
+/// when the file may have been corrupted.
+///
+/// @param vec      The jpVector
+/// @param path     Path of the file to map
+/// @param verify   If nonzero, the data checksum is verified
+/// @return Pointer to the mapped data, or NULL on failure
+///////////////////////////////////////////////////////////////////////////////
+#define jpVector_mapReadOnly(vec,path,verify)\
+    (\
+        (vec).max = 0,\
+        (vec).length = 0,\
+        (vec).data = jpVector__map(\
+            (path),\
+            sizeof(*(vec).data),\
+            &(vec).length,\
+            (verify))\
+    )
+
+// ifdef JP_VECTOR_MMAP
+#endif
+
 // JPA__VECTOR_H
 #endif
@@ -0,0 +1,210 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_heap_test.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Tests for jpHeap
+///
+/// Build and run from the repository root with:
+///
+///     cc -O2 -std=c99 -I. -o jp_heap_test test/jp_heap_test.c
+///     ./jp_heap_test
+///
+/// Add -DJP_HEAP_ARITY=4 to test the 4-ary layout.
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_heap.h"
+#include "test/jp_test.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Element with a key and a payload, as queued by a scheduler
+///////////////////////////////////////////////////////////////////////////////
+typedef struct jpHeapTestTask {
+    int deadline;
+    int id;
+} jpHeapTestTask;
+
+///////////////////////////////////////////////////////////////////////////////
+// Macros
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Orders ints from smallest to largest
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeapTest__less(a,b)       ( (a) < (b) )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Orders ints from largest to smallest
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeapTest__greater(a,b)    ( (a) > (b) )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Orders tasks by deadline
+///////////////////////////////////////////////////////////////////////////////
+#define jpHeapTest__byDeadline(a,b) ( (a).deadline < (b).deadline )
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns a pseudo-random number below n
+///
+/// @param	state   State of the generator
+/// @param	n       Upper bound
+///////////////////////////////////////////////////////////////////////////////
+static int jpHeapTest__random(unsigned long *state, int n)
+{
+    *state = *state * 1103515245UL + 12345UL;
+
+    return (int)((*state >> 16) % (unsigned long)n);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that elements come out in order whatever order they went
+///         in
+///////////////////////////////////////////////////////////////////////////////
+static void jpHeapTest__order(void)
+{
+    jpHeap(int) heap;
+    unsigned long state = 1;
+    int previous = -1;
+    int value = 0;
+    int ok = 1;
+    int i;
+
+    jpHeap_create(heap);
+    for (i = 0; i < 1000; ++i) {
+        jpHeap_push(heap, jpHeapTest__random(&state, 500), jpHeapTest__less);
+        ok &= jpHeap_peek(heap) <= jpHeap_at(heap, jpHeap_length(heap) - 1);
+    }
+
+    jpTest_check(ok);
+    jpTest_check(jpHeap_length(heap) == 1000);
+
+    while (jpHeap_length(heap)) {
+        jpHeap_pop(heap, value, jpHeapTest__less);
+        ok &= value >= previous;
+        previous = value;
+    }
+
+    jpTest_check(ok);
+    jpTest_check(previous < 500);
+
+    // The comparison decides the order
+    for (i = 0; i < 10; ++i) {
+        jpHeap_push(heap, i, jpHeapTest__greater);
+    }
+
+    jpHeap_pop(heap, value, jpHeapTest__greater);
+    jpTest_check(value == 9 && jpHeap_peek(heap) == 8);
+
+    jpHeap_destroy(heap);
+    jpTest_check(!heap.vec.data);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that jpHeap_decreaseKey moves an element forward
+///////////////////////////////////////////////////////////////////////////////
+static void jpHeapTest__decreaseKey(void)
+{
+    jpHeap(jpHeapTestTask) heap;
+    jpHeapTestTask task;
+    size_t index = 0;
+    int ok = 1;
+    int i;
+
+    jpHeap_create(heap);
+    for (i = 0; i < 100; ++i) {
+        task.deadline = 1000 + (i * 37) % 100;
+        task.id = i;
+        jpHeap_push(heap, task, jpHeapTest__byDeadline);
+    }
+
+    while (jpHeap_at(heap, index).id != 42) {
+        ++index;
+    }
+
+    task = jpHeap_at(heap, index);
+    task.deadline = 0;
+    jpHeap_decreaseKey(heap, index, task, jpHeapTest__byDeadline);
+    jpTest_check(jpHeap_peek(heap).id == 42);
+
+    jpHeap_pop(heap, task, jpHeapTest__byDeadline);
+    jpTest_check(task.id == 42 && task.deadline == 0);
+
+    // The rest still come out in order
+    for (i = 0; jpHeap_length(heap); ++i) {
+        jpHeap_pop(heap, task, jpHeapTest__byDeadline);
+        ok &= task.deadline == 1000 + i + (i >= 54);
+    }
+
+    jpTest_check(ok);
+    jpTest_check(i == 99);
+    jpHeap_destroy(heap);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that jpHeap_fromVector orders a jpVector in place
+///////////////////////////////////////////////////////////////////////////////
+static void jpHeapTest__fromVector(void)
+{
+    jpVector(int) vec;
+    jpHeap(int) heap;
+    unsigned long state = 7;
+    int *data;
+    int value = 0;
+    int previous = -1;
+    int ok = 1;
+    int i;
+
+    jpVector_create(vec);
+    for (i = 0; i < 777; ++i) {
+        jpVector_push(vec, jpHeapTest__random(&state, 1000));
+    }
+
+    data = jpVector_data(vec);
+    jpHeap_fromVector(heap, vec, jpHeapTest__less);
+    jpTest_check(!vec.data && jpVector_length(vec) == 0);
+    jpTest_check(heap.vec.data == data && jpHeap_length(heap) == 777);
+
+    while (jpHeap_length(heap)) {
+        jpHeap_pop(heap, value, jpHeapTest__less);
+        ok &= value >= previous;
+        previous = value;
+    }
+
+    jpTest_check(ok);
+    jpHeap_destroy(heap);
+
+    // Empty and single-element jpVectors are already heaps
+    jpVector_create(vec);
+    jpHeap_fromVector(heap, vec, jpHeapTest__less);
+    jpTest_check(jpHeap_length(heap) == 0);
+    jpHeap_push(heap, 3, jpHeapTest__less);
+    jpHeap_push(heap, 1, jpHeapTest__less);
+    jpTest_check(jpHeap_peek(heap) == 1);
+    jpHeap_destroy(heap);
+
+    jpVector_create(vec);
+    jpVector_push(vec, 5);
+    jpHeap_fromVector(heap, vec, jpHeapTest__less);
+    jpHeap_pop(heap, value, jpHeapTest__less);
+    jpTest_check(value == 5 && jpHeap_length(heap) == 0);
+    jpHeap_destroy(heap);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+    jpTest_run(jpHeapTest__order);
+    jpTest_run(jpHeapTest__decreaseKey);
+    jpTest_run(jpHeapTest__fromVector);
+
+    return jpTest_result();
+}
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_log_cpp_test.cpp
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Tests for jpLog's header compiled as C++
+///
+/// Build and run from the repository root with:
+///
+///     cc -O2 -std=c99 -pthread -I. -c jp_log.c
+///     c++ -O2 -std=c++11 -pthread -I. -c test/jp_log_cpp_test.cpp
+///     c++ -pthread -o jp_log_cpp_test jp_log_cpp_test.o jp_log.o
+///     ./jp_log_cpp_test
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_log.h"
+#include "test/jp_test.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Output collected by jpLogCppTest__collect
+///////////////////////////////////////////////////////////////////////////////
+static char jpLogCppTest__output[4096];
+static size_t jpLogCppTest__outputLength = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Appends output to jpLogCppTest__output, see jpLogWriteFn
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogCppTest__collect(void *data, const char *buf, size_t length)
+{
+    (void)data;
+
+    if (length > sizeof(jpLogCppTest__output) - jpLogCppTest__outputLength) {
+        return 0;
+    }
+
+    memcpy(jpLogCppTest__output + jpLogCppTest__outputLength, buf, length);
+    jpLogCppTest__outputLength += length;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as its message alone
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLogCppTest__formatMsg(
+        const jpLogRecord *record,
+        char *buf,
+        size_t size)
+{
+    size_t length = record->length < size ? record->length : size - 1;
+
+    memcpy(buf, record->msg, length);
+    buf[length] = '\n';
+    return length + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that the macros log from C++ through the C functions, and
+///         that the Fmt macros encode argument types as they do in C
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogCppTest__macros(void)
+{
+    enum { jpLogCppTest__A };
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogCppTest__formatMsg, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    const char *volatile expected = "3 items\nkv\n";
+    char fmt[32];
+
+    jpLog_addSink(jpLogCppTest__collect, NULL, NULL, &config);
+
+    strcpy(fmt, "%d items");
+    jpLog_infoFmt(fmt, 3);
+    jpLog_warnKV("kv", jpLog_int("a", 1));
+    jpTest_check(jpLogCppTest__outputLength == strlen(expected));
+    jpTest_check(!memcmp(jpLogCppTest__output, expected, strlen(expected)));
+
+#ifdef JP_LOG_TYPES
+    jpTest_check(!strcmp(jpLog__types((char)1, 2U, 3L, 4ULL, 1.5f, "s",
+                    fmt, (void *)fmt, JP_LOG_WARN), "iIlQfsspi"));
+    jpTest_check(!strcmp(jpLog__types((short)1, true, 1.5L, 5UL, 6LL, fmt[0],
+                    jpLogCppTest__A, nullptr), "iiFLqiip"));
+
+    jpLogCppTest__outputLength = 0;
+    jpLog_infoFmt(fmt, "3");
+    jpTest_check(jpLogCppTest__outputLength == 26);
+    jpTest_check(!memcmp(jpLogCppTest__output, "format mismatch: %d items\n",
+                26));
+#endif
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+    jpTest_run(jpLogCppTest__macros);
+
+    return jpTest_result();
+}
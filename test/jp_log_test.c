@@ -0,0 +1,2044 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_log_test.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Tests for jpLog
+///
+/// Build and run from the repository root with:
+///
+///     cc -O2 -std=c99 -pthread -I. -o jp_log_test test/jp_log_test.c jp_log.c
+///     ./jp_log_test
+///
+/// Add -DJP_LOG_DEBUGALLOC to check that logging calls in steady state do not
+/// allocate, -DJP_LOG_STATICKEYS to check the call sites jpLog patches, and
+/// build with -std=c11 to check the argument types the Fmt macros pass along.
+///////////////////////////////////////////////////////////////////////////////
+#define _POSIX_C_SOURCE 200809L
+
+#include "jp_log.h"
+#include "test/jp_test.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Defines
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Path of the file written by the tests
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOGTEST_PATH         "jp_log_test.log"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Path of the socket used by the tests
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOGTEST_SOCKET       "jp_log_test.sock"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Path of the level control file used by the tests
+///////////////////////////////////////////////////////////////////////////////
+#define JP_LOGTEST_CONTROL      "jp_log_test.levels"
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Counts the occurrences of a string in a buffer
+///
+/// @param	buf     The buffer
+/// @param	length  Length of the buffer
+/// @param	str     The string
+/// @return	Number of occurrences
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogTest__count(const char *buf, size_t length, const char *str)
+{
+    size_t strLength = strlen(str);
+    size_t i;
+    int count = 0;
+
+    for (i = 0; i + strLength <= length; ++i) {
+        count += !memcmp(buf + i, str, strLength);
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads a whole file into a buffer
+///
+/// @param	path    Path of the file
+/// @param	buf     The buffer
+/// @param	size    Size of the buffer
+/// @return	Number of bytes read
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLogTest__read(const char *path, char *buf, size_t size)
+{
+    FILE *file = fopen(path, "rb");
+    size_t length = 0;
+
+    jpTest_check(file);
+    if (!file) {
+        return 0;
+    }
+
+    length = fread(buf, 1, size, file);
+    fclose(file);
+    return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Reads a whole file into a buffer sized to fit it
+///
+/// @param	path    Path of the file
+/// @param	length  Receives the number of bytes read
+/// @return	The bytes, followed by a NUL, to be freed by the caller
+///////////////////////////////////////////////////////////////////////////////
+static char *jpLogTest__load(const char *path, size_t *length)
+{
+    struct stat info;
+    char *buf = NULL;
+
+    *length = 0;
+    jpTest_check(!stat(path, &info));
+    buf = malloc((size_t)info.st_size + 1);
+    jpTest_check(buf);
+    if (!buf) {
+        return NULL;
+    }
+
+    *length = jpLogTest__read(path, buf, (size_t)info.st_size);
+    buf[*length] = '\0';
+    return buf;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks whether a file exists
+///
+/// @param	path    Path of the file
+/// @return	Nonzero if it exists
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogTest__exists(const char *path)
+{
+    struct stat info;
+
+    return !stat(path, &info);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Output collected from jpLog_readFile
+///////////////////////////////////////////////////////////////////////////////
+static char jpLogTest__output[1 << 20];
+static size_t jpLogTest__outputLength = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Collects output from jpLog_readFile in jpLogTest__output
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogTest__collect(void *data, const char *buf, size_t length)
+{
+    (void)data;
+
+    if (length > sizeof(jpLogTest__output) - jpLogTest__outputLength) {
+        return 0;
+    }
+
+    memcpy(jpLogTest__output + jpLogTest__outputLength, buf, length);
+    jpLogTest__outputLength += length;
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Formats a record as its message alone
+///////////////////////////////////////////////////////////////////////////////
+static size_t jpLogTest__formatMsg(
+        const jpLogRecord *record,
+        char *buf,
+        size_t size)
+{
+    size_t length = record->length < size ? record->length : size - 1;
+
+    memcpy(buf, record->msg, length);
+    buf[length] = '\n';
+    return length + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Holds writes by jpLogTest__gatedWrite until the gate opens
+///////////////////////////////////////////////////////////////////////////////
+static pthread_mutex_t jpLogTest__gateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jpLogTest__gateCond = PTHREAD_COND_INITIALIZER;
+static int jpLogTest__gateOpen = 0;
+static int jpLogTest__gateWaiting = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Collects output like jpLogTest__collect, once the gate is open
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogTest__gatedWrite(void *data, const char *buf, size_t length)
+{
+    pthread_mutex_lock(&jpLogTest__gateLock);
+    jpLogTest__gateWaiting = 1;
+    pthread_cond_broadcast(&jpLogTest__gateCond);
+    while (!jpLogTest__gateOpen) {
+        pthread_cond_wait(&jpLogTest__gateCond, &jpLogTest__gateLock);
+    }
+    pthread_mutex_unlock(&jpLogTest__gateLock);
+
+    return jpLogTest__collect(data, buf, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Closes the gate and waits until a write is held by it
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__holdWrites(void)
+{
+    pthread_mutex_lock(&jpLogTest__gateLock);
+    jpLogTest__gateOpen = 0;
+    jpLogTest__gateWaiting = 0;
+    pthread_mutex_unlock(&jpLogTest__gateLock);
+
+    jpLog_info("held");
+
+    pthread_mutex_lock(&jpLogTest__gateLock);
+    while (!jpLogTest__gateWaiting) {
+        pthread_cond_wait(&jpLogTest__gateCond, &jpLogTest__gateLock);
+    }
+    pthread_mutex_unlock(&jpLogTest__gateLock);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Opens the gate
+///
+/// @param	arg Milliseconds to wait first, as an intptr_t
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLogTest__releaseWrites(void *arg)
+{
+    struct timespec delay = { 0, 0 };
+
+    delay.tv_nsec = (long)(intptr_t)arg * 1000000L;
+    nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&jpLogTest__gateLock);
+    jpLogTest__gateOpen = 1;
+    pthread_cond_broadcast(&jpLogTest__gateCond);
+    pthread_mutex_unlock(&jpLogTest__gateLock);
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Logs from a named thread
+///
+/// @param	arg Unused
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLogTest__namedThread(void *arg)
+{
+    (void)arg;
+
+    jpLog_setThreadName("worker");
+    jpLog_info("from worker");
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Logs from a second thread
+///
+/// @param	arg Unused
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLogTest__thread(void *arg)
+{
+    (void)arg;
+    jpLog_info("from thread");
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Logs numbered lines from a thread
+///
+/// @param	arg Number of the thread, as an intptr_t
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLogTest__countingThread(void *arg)
+{
+    int i;
+
+    for (i = 0; i < 5000; ++i) {
+        jpLog_infoFmt("%d %d", (int)(intptr_t)arg, i);
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Spins for a while in a timed block
+///
+/// @param	ns  Nanoseconds to spin for
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__timedWork(long ns)
+{
+    struct timespec start;
+    struct timespec now;
+
+    jpLog_timeBlock("work") {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while ((now.tv_sec - start.tv_sec) * 1000000000L
+                + (now.tv_nsec - start.tv_nsec) < ns);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Does short timed work from a thread
+///
+/// @param	arg Unused
+/// @return	NULL
+///////////////////////////////////////////////////////////////////////////////
+static void *jpLogTest__timingThread(void *arg)
+{
+    int i;
+
+    (void)arg;
+    for (i = 0; i < 50; ++i) {
+        jpLogTest__timedWork(20000);
+    }
+
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Runs the flight recorder in a child process that exits through
+///         jpLog_exit or a signal
+///
+/// @param	crash   If nonzero, the child raises SIGSEGV instead
+/// @param	control If nonzero, the level control file turns info off first
+/// @return	Status of the child
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogTest__runRecorder(int crash, int control)
+{
+    jpLogSinkConfig warn = { JP_LOG_WARN, NULL, 0, 0, JP_LOG_BLOCK, NULL, 0 };
+    static char file[400];
+    static char func[300];
+    char ring[64];
+    jpLogSink *sink = NULL;
+    pthread_t thread;
+    int status = 0;
+    int fd = -1;
+    int i;
+    pid_t pid;
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_CONTROL);
+
+    pid = fork();
+    if (!pid) {
+        if (control && (!jpLog_startControl(JP_LOGTEST_CONTROL)
+                    || !jpLog_setControl(JP_LOGTEST_CONTROL, NULL,
+                        JP_LOG_WARN))) {
+            _exit(0);
+        }
+
+        fd = open(JP_LOGTEST_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || !jpLog_startRecorder(4, fd)
+                || !jpLog_installCrashHandler()) {
+            _exit(0);
+        }
+
+        // Info is disabled, by the sink or the rules, but still recorded
+        sink = jpLog_addRingSink(4096, control ? NULL : &warn);
+        for (i = 0; i < 10; ++i) {
+            jpLog_infoFmt("info %d", i);
+        }
+
+        // Names longer than the dump's line are cut short, not the message
+        memset(file, 'f', sizeof(file) - 1);
+        memset(func, 'g', sizeof(func) - 1);
+        jpLog__info(NULL, file, func, 12345, "long names");
+
+        pthread_create(&thread, NULL, jpLogTest__thread, NULL);
+        pthread_join(thread, NULL);
+        if (jpLog_readRing(sink, ring, sizeof(ring))) {
+            _exit(0);
+        }
+
+        if (crash) {
+            raise(SIGSEGV);
+        }
+        jpLog_exit("fatal");
+    }
+
+    jpTest_check(pid > 0 && waitpid(pid, &status, 0) == pid);
+    return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that sinks only receive messages at their minimum level
+///         or above
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__levels(void)
+{
+    jpLogSinkConfig warn = { JP_LOG_WARN, NULL, 0, 0, JP_LOG_BLOCK, NULL, 0 };
+    jpLogSink *all = jpLog_addRingSink(4096, NULL);
+    jpLogSink *some = jpLog_addRingSink(4096, &warn);
+    char path[200];
+    char expected[256];
+    char buf[4096];
+    size_t length = 0;
+    int line = __LINE__ + 6;
+    int i;
+
+    memset(path, 'x', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+
+    jpLog_info("first");
+    jpLog_warnFmt("second %d", 2);
+
+    length = jpLog_readRing(all, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "\n") == 2);
+    jpTest_check(jpLogTest__count(buf, length, "]: first\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: second 2\n") == 1);
+
+    // The default format is unchanged
+    snprintf(expected, sizeof(expected), "[INFO][%s][%s][%d]: first\n",
+            __FILE__, __func__, line);
+    jpTest_check(!strncmp(buf, expected, strlen(expected)));
+
+    length = jpLog_readRing(some, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[WARN]") == 1);
+
+    jpLog_shutdown();
+
+    // Prefixes are cached per call site, unless they are too long
+    all = jpLog_addRingSink(4096, NULL);
+    for (i = 0; i < 3; ++i) {
+        jpLog__info(NULL, "a.c", "f", i, "short");
+        jpLog__info(NULL, "a.c", "f", 7, "short");
+        jpLog__warn(NULL, path, "f", 7, "long");
+    }
+
+    length = jpLog_readRing(all, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "[INFO][a.c][f][1]: short\n")
+            == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[INFO][a.c][f][7]: short\n")
+            == 3);
+    snprintf(expected, sizeof(expected), "[WARN][%s][f][7]: long\n", path);
+    jpTest_check(jpLogTest__count(buf, length, expected) == 3);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that key/value fields are typed and escaped by each
+///         formatter
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__fields(void)
+{
+    jpLogSinkConfig logfmt = {
+        JP_LOG_INFO, jpLog_formatLogfmt, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    jpLogSinkConfig json = {
+        JP_LOG_INFO, jpLog_formatJson, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    jpLogSink *text = jpLog_addRingSink(4096, NULL);
+    jpLogSink *kv = jpLog_addRingSink(4096, &logfmt);
+    jpLogSink *js = jpLog_addRingSink(4096, &json);
+    char buf[4096];
+    size_t length = 0;
+
+    jpLog_infoKV("Request done", jpLog_str("user", "bob \"b\"\n"),
+            jpLog_int("status", -200),
+            jpLog_uint("bytes", 18446744073709551615ULL),
+            jpLog_double("ms", 1.5), jpLog_bool("ok", 7));
+    jpLog_warnKV("plain", jpLog_str("path", "/tmp/x"), jpLog_str("none", NULL));
+
+    length = jpLog_readRing(text, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: Request done "
+                "user=\"bob \\\"b\\\"\\n\" status=-200 "
+                "bytes=18446744073709551615 ms=1.5 ok=true\n") == 1);
+
+    length = jpLog_readRing(kv, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "level=info file=") == 1);
+    jpTest_check(jpLogTest__count(buf, length, " msg=\"Request done\" ") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "level=warn file=") == 1);
+    jpTest_check(jpLogTest__count(buf, length,
+                " msg=plain path=/tmp/x none=\"\"\n") == 1);
+
+    length = jpLog_readRing(js, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "{\"level\":\"info\",") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "\"msg\":\"Request done\","
+                "\"user\":\"bob \\\"b\\\"\\n\",\"status\":-200,"
+                "\"bytes\":18446744073709551615,\"ms\":1.5,\"ok\":true}\n")
+            == 1);
+    jpTest_check(jpLogTest__count(buf, length,
+                "\"path\":\"/tmp/x\",\"none\":\"\"}\n") == 1);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that records carry the details of their thread when asked
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__threadInfo(void)
+{
+    jpLogSinkConfig json = {
+        JP_LOG_INFO, jpLog_formatJson, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    jpLogSink *text = jpLog_addRingSink(4096, NULL);
+    jpLogSink *js = jpLog_addRingSink(4096, &json);
+    const char *found = NULL;
+    unsigned long mainId = 0;
+    unsigned long workerId = 0;
+    pthread_t thread;
+    char buf[4096];
+    size_t length = 0;
+    int cpu = -1;
+
+    jpLog_info("plain");
+    jpLog_setRecordInfo(JP_LOG_THREADID | JP_LOG_THREADNAME | JP_LOG_CPU);
+    jpLog_setThreadName("main");
+    jpLog_info("from main");
+    pthread_create(&thread, NULL, jpLogTest__namedThread, NULL);
+    pthread_join(thread, NULL);
+    jpLog_setRecordInfo(JP_LOG_THREADNAME);
+    jpLog_info("name only");
+    jpLog_setRecordInfo(0);
+    jpLog_setThreadName(NULL);
+
+    length = jpLog_readRing(text, buf, sizeof(buf) - 1);
+    buf[length] = '\0';
+    jpTest_check(strstr(buf, "]: plain\n"));
+    jpTest_check(strstr(buf, "]: name only thread_name=main\n"));
+
+    found = strstr(buf, "]: from main thread=");
+    jpTest_check(found && sscanf(found, "]: from main thread=%lu "
+                "thread_name=main cpu=%d\n", &mainId, &cpu) == 2);
+    jpTest_check(cpu >= 0);
+    found = strstr(buf, "]: from worker thread=");
+    jpTest_check(found && sscanf(found, "]: from worker thread=%lu "
+                "thread_name=worker cpu=%d\n", &workerId, &cpu) == 2);
+    jpTest_check(mainId && workerId && mainId != workerId);
+
+    length = jpLog_readRing(js, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, ",\"thread_name\":\"worker\","
+                "\"cpu\":") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "\"msg\":\"plain\"}\n")
+            == 1);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that spans nest, carry their duration and are written as
+///         Chrome Trace Events by a trace sink
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__spans(void)
+{
+    jpLogSink *text = NULL;
+    unsigned long long begin = 0;
+    unsigned long long end = 0;
+    unsigned long long dur = 0;
+    const char *found = NULL;
+    char buf[8192];
+    size_t length = 0;
+
+    remove(JP_LOGTEST_PATH);
+    text = jpLog_addRingSink(sizeof(buf), NULL);
+    jpTest_check(jpLog_addTraceSink(JP_LOGTEST_PATH, NULL));
+
+    jpLog_span("outer") {
+        jpLog_spanBegin("inner");
+        jpLog_info("inside");
+        jpLog_spanEnd("inner");
+    }
+    jpLog_spanEnd("unmatched");
+
+    length = jpLog_readRing(text, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, " span=begin thread=") == 2);
+    jpTest_check(jpLogTest__count(buf, length, " span=end dur_ns=") == 2);
+    jpTest_check(jpLogTest__count(buf, length, "]: unmatched span=end "
+                "thread=") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: inside\n") == 1);
+    jpLog_shutdown();
+
+    // Spans are events of the thread that logged them, other records are
+    // instant events
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf) - 1);
+    buf[length] = '\0';
+    jpTest_check(!strncmp(buf, "[\n{\"name\":\"outer\",\"cat\":\"info\","
+                "\"ph\":\"B\",\"ts\":", 40));
+    jpTest_check(jpLogTest__count(buf, length, "}},\n") == 6);
+    jpTest_check(jpLogTest__count(buf, length, "\"ph\":\"B\"") == 2);
+    jpTest_check(jpLogTest__count(buf, length, "\"ph\":\"E\"") == 3);
+    jpTest_check(jpLogTest__count(buf, length, "{\"name\":\"inside\","
+                "\"cat\":\"info\",\"ph\":\"i\",\"s\":\"t\",") == 1);
+    jpTest_check(jpLogTest__count(buf, length, ",\"tid\":0,") == 1);
+
+    // ts is in microseconds, so the inner span lasts about dur_ns / 1000
+    found = strstr(buf, "{\"name\":\"inner\",\"cat\":\"info\",\"ph\":\"B\"");
+    jpTest_check(found && sscanf(found, "{\"name\":\"inner\",\"cat\":\"info\","
+                "\"ph\":\"B\",\"ts\":%llu", &begin) == 1);
+    found = found ? strstr(found, "{\"name\":\"inner\",\"cat\":\"info\","
+            "\"ph\":\"E\"") : NULL;
+    jpTest_check(found && sscanf(found, "{\"name\":\"inner\",\"cat\":\"info\","
+                "\"ph\":\"E\",\"ts\":%llu", &end) == 1);
+    found = found ? strstr(found, "\"dur_ns\":") : NULL;
+    jpTest_check(found && sscanf(found, "\"dur_ns\":%llu", &dur) == 1);
+    jpTest_check(end >= begin && end - begin <= dur / 1000 + 1);
+
+    // A later run appends to the same array
+    jpTest_check(jpLog_addTraceSink(JP_LOGTEST_PATH, NULL));
+    jpLog_span("again") {
+    }
+    jpLog_shutdown();
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "[") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "}},\n") == 8);
+    remove(JP_LOGTEST_PATH);
+
+    // Other files are not appended to
+    jpTest_check(!jpLog_addTraceSink(NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpLog_info("plain");
+    jpLog_shutdown();
+    jpTest_check(!jpLog_addTraceSink(JP_LOGTEST_PATH, NULL));
+
+    remove(JP_LOGTEST_PATH);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that formatted messages match snprintf
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__format(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    jpLogSink *ring = NULL;
+    const char *volatile none = NULL;
+    static char expected[8192];
+    static char big[4096];
+    char dynamic[32];
+    char buf[4096];
+    size_t length = 0;
+    int ok = 1;
+    int i;
+
+#define jpLogTest__compare(...)\
+    do {\
+        jpLogTest__outputLength = 0;\
+        snprintf(expected, sizeof(expected), __VA_ARGS__);\
+        jpLog_infoFmt(__VA_ARGS__);\
+        ok &= jpLogTest__outputLength == strlen(expected) + 1\
+            && !memcmp(jpLogTest__output, expected, strlen(expected));\
+    } while (0)
+
+    jpLog_addSink(jpLogTest__collect, NULL, NULL, &config);
+
+    jpLogTest__compare("%d %d %d %d", 0, -1, 2147483647, -2147483647 - 1);
+    jpLogTest__compare("%u|%x|%x", 4294967295U, 0U, 0xdeadbeefU);
+    jpLogTest__compare("%ld %lu %lx", -9223372036854775807L - 1,
+            18446744073709551615UL, 0x123456789abcdefUL);
+    jpLogTest__compare("%lld %llu", -42LL, 1000000000000ULL);
+    jpLogTest__compare("%zu %zx %zd", (size_t)12345, (size_t)255,
+            (ssize_t)-7);
+    jpLogTest__compare("[%s] %%d %%", "str");
+    jpLogTest__compare("%p %p", (void *)&ok, (void *)NULL);
+    jpLogTest__compare("%f %f %f %f", 0.0, -1.5, 3.14159265358979, 1e20);
+    jpLogTest__compare("%g %g %g %g %g", 0.0001, 123456789.0, 1e-5, 2.5,
+            1.0 / 0.0);
+    jpLogTest__compare("no conversions%s", "");
+    jpLogTest__compare("%s", "");
+    for (i = 1; i < 300000000; i = i * 7 + 3) {
+        jpLogTest__compare("%d:%u:%x", i, (unsigned)i * 31, (unsigned)i);
+        jpLogTest__compare("%d", -i);
+    }
+
+    // Conversions jp_log does not handle itself are left to vsnprintf
+    jpLogTest__compare("%5d|%-3s|%.2f|%c|%08x|%e", 42, "a", 2.345, 'z', 255U,
+            1234.5);
+    jpLogTest__compare("%d %s %lf", 1, "two", 3.0);
+    jpTest_check(ok);
+
+    jpLogTest__outputLength = 0;
+    jpLog_infoFmt("[%s]", none);
+    jpTest_check(!memcmp(jpLogTest__output, "[(null)]\n", 9));
+
+    // Messages are truncated as vsnprintf truncates them
+    memset(big, 'x', sizeof(big) - 1);
+    jpLogTest__outputLength = 0;
+    jpLog_infoFmt("%d %s", 12, big);
+    jpTest_check(jpLogTest__outputLength < sizeof(big));
+    jpTest_check(!memcmp(jpLogTest__output, "12 xxx", 6));
+
+    // A format string that changes at the same address is parsed again
+    strcpy(dynamic, "a %d b");
+    jpLogTest__compare(dynamic, 1);
+    strcpy(dynamic, "a %s b %d c");
+    jpLogTest__compare(dynamic, "x", 2);
+    strcpy(dynamic, "a %d b %%");
+    jpLogTest__compare(dynamic, 3);
+    strcpy(dynamic, "a %d");
+    jpLogTest__compare(dynamic, 4);
+    jpTest_check(ok);
+
+#undef jpLogTest__compare
+
+    jpLog_shutdown();
+
+    // Doubles in fields take their shortest form that reads back the same
+    ring = jpLog_addRingSink(4096, NULL);
+    jpLog_infoKV("doubles", jpLog_double("a", 0.1), jpLog_double("b", 1e21),
+            jpLog_double("c", 1.0 / 3), jpLog_double("d", 5e-324),
+            jpLog_double("e", 0.30000000000000004));
+    length = jpLog_readRing(ring, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: doubles a=0.1 b=1e+21 "
+                "c=0.3333333333333333 d=5e-324 "
+                "e=0.30000000000000004\n") == 1);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that arguments of the wrong type are not formatted
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__types(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 0, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    char fmt[32];
+
+    jpLog_addSink(jpLogTest__collect, NULL, NULL, &config);
+
+    // Format strings built at run time escape the compiler's checks
+    strcpy(fmt, "%s has %d items");
+    jpLogTest__outputLength = 0;
+    jpLog__fmt(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__, "ss", fmt,
+            "cart", "3");
+    jpLog__fmt(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__, "s", fmt,
+            "cart");
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "format mismatch: %s has %d items\n") == 2);
+
+    // Signedness may differ, and pointers may be strings
+    strcpy(fmt, "%s has %d items at %p");
+    jpLogTest__outputLength = 0;
+    jpLog__fmt(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__, "sIs", fmt,
+            "cart", 3, "x");
+    jpTest_check(!memcmp(jpLogTest__output, "cart has 3 items at 0x", 22));
+
+    // Formats jp_log leaves to vsnprintf are not checked
+    strcpy(fmt, "%5d");
+    jpLogTest__outputLength = 0;
+    jpLog__fmt(JP_LOG_INFO, NULL, __FILE__, __func__, __LINE__, "i", fmt, 42);
+    jpTest_check(!memcmp(jpLogTest__output, "   42\n", 6));
+
+#ifdef JP_LOG_TYPES
+    jpTest_check(!strcmp(jpLog__types((char)1, 2U, 3L, 4ULL, 1.5f, "s",
+                    fmt, (void *)fmt, JP_LOG_WARN), "iIlQfsspi"));
+
+    strcpy(fmt, "%d items");
+    jpLogTest__outputLength = 0;
+    jpLog_infoFmt(fmt, "3");
+    jpLog_infoFmt(fmt, 3);
+    jpTest_check(jpLogTest__outputLength == 34);
+    jpTest_check(!memcmp(jpLogTest__output,
+                "format mismatch: %d items\n3 items\n", 34));
+#endif
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that sampled call sites log about 1 in rate calls, and
+///         only evaluate the arguments of those
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__sampled(void)
+{
+    int evaluated = 0;
+    int lines = 0;
+    int i;
+
+    jpLog_addSink(jpLogTest__collect, NULL, NULL, NULL);
+
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 10000; ++i) {
+        jpLog_infoSampled(10, "sampled %d", ++evaluated);
+    }
+
+    lines = jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+            "\n");
+    jpTest_check(lines > 800 && lines < 1200);
+    jpTest_check(evaluated == lines);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                " sample_rate=10\n") == lines);
+
+    // Rates of 0 and 1 log everything, without a sample_rate field
+    jpLogTest__outputLength = 0;
+    jpLog_infoSampled(0, "every %d", 1);
+    jpLog_infoSampled(1, "every");
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: every 1\n") == 1);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: every\n") == 1);
+
+    // The override replaces every call site's rate until it is reset
+    jpLog_setSampleRate(1);
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoSampled(1000000, "forced");
+    }
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: forced\n") == 1000);
+
+    jpLog_setSampleRate(0);
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoSampled(1000000, "rare");
+    }
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "rare") < 3);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that levels set in a level control file apply everywhere,
+///         per file and per call site, including changes from another
+///         process
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__control(void)
+{
+    struct timespec pause = { 0, 10 * 1000 * 1000 };
+    jpLogCallSite callSite = { 0 };
+    char site[32];
+    int evaluated = 0;
+    int fds[2] = { -1, -1 };
+    unsigned garbled = 0xFFFFFFFFU;
+    char go = 0;
+    int fd = -1;
+    pid_t pid;
+    int i;
+
+    // The other process is forked before any thread of jp_log starts, and
+    // makes its change when told to
+    remove(JP_LOGTEST_CONTROL);
+    jpTest_check(!pipe(fds));
+    pid = fork();
+    if (!pid) {
+        close(fds[1]);
+        _exit(read(fds[0], &go, 1) != 1
+                || !jpLog_setControl(JP_LOGTEST_CONTROL, "b.c", JP_LOG_INFO));
+    }
+    close(fds[0]);
+
+    jpLog_addSink(jpLogTest__collect, NULL, NULL, NULL);
+    jpTest_check(jpLog_startControl(JP_LOGTEST_CONTROL));
+    jpTest_check(!jpLog_startControl(JP_LOGTEST_CONTROL));
+
+    // Changes made by this process apply at once
+    jpTest_check(jpLog_setControl(JP_LOGTEST_CONTROL, NULL, JP_LOG_WARN));
+    jpLogTest__outputLength = 0;
+    jpLog_infoFmt("off %d", ++evaluated);
+    jpLog_infoKV("off", jpLog_int("n", ++evaluated));
+    jpLog_warnFmt("on %d", ++evaluated);
+    jpTest_check(evaluated == 1);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: on 1\n") == 1);
+    jpTest_check(!jpLogTest__count(jpLogTest__output,
+                jpLogTest__outputLength, "off"));
+
+    // A call site's rule turns on that site alone. Other sites at the level
+    // evaluate their arguments, unless JP_LOG_KEYS made them NOPs
+    snprintf(site, sizeof(site), "jp_log_test.c:%d", __LINE__ + 4);
+    jpTest_check(jpLog_setControl(JP_LOGTEST_CONTROL, site, JP_LOG_INFO));
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 3; ++i) {
+        jpLog_infoFmt("site %d", i);
+        jpLog_infoFmt("off %d", ++evaluated);
+    }
+#ifdef JP_LOG_KEYS
+    jpTest_check(evaluated == 1);
+#endif
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: site ") == 3);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "\n") == 3);
+    jpTest_check(jpLog_clearControl(JP_LOGTEST_CONTROL, site));
+    evaluated = 1;
+    jpLogTest__outputLength = 0;
+    jpLog_infoFmt("off %d", ++evaluated);
+    jpTest_check(evaluated == 1 && jpLogTest__outputLength == 0);
+
+    // A call site's rule comes before its file's, which comes before the
+    // level set everywhere, and files are named by their base name
+    jpTest_check(jpLog_setControl(JP_LOGTEST_CONTROL, "a.c", JP_LOG_INFO));
+    jpTest_check(jpLog_setControl(JP_LOGTEST_CONTROL, "src/a.c:5",
+                JP_LOG_WARN));
+    jpTest_check(!jpLog_setControl(JP_LOGTEST_CONTROL, "a.c:x", JP_LOG_INFO));
+    jpTest_check(!jpLog_setControl(JP_LOGTEST_CONTROL, ":5", JP_LOG_INFO));
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 3; ++i) {
+        jpLog__info(NULL, "src/a.c", "f", 4, "file");
+        jpLog__info(NULL, "src/a.c", "f", 5, "site");
+        jpLog__info(NULL, "src/b.c", "f", 4, "other");
+        jpLog__warn(NULL, "src/a.c", "f", 5, "warned");
+    }
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: file\n") == 3);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: warned\n") == 3);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "\n") == 6);
+
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readControl(JP_LOGTEST_CONTROL, jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == 27 && !memcmp(jpLogTest__output,
+                "* warn\na.c info\na.c:5 warn\n", 27));
+
+    // Verdicts cached in a call site are dropped when the rules change
+    jpLogTest__outputLength = 0;
+    jpLog__info(&callSite, "src/a.c", "f", 5, "site");
+    jpTest_check(callSite.control && !(callSite.control & 1U));
+    jpTest_check(jpLog_clearControl(JP_LOGTEST_CONTROL, "a.c:5"));
+    jpTest_check(!jpLog_clearControl(JP_LOGTEST_CONTROL, "a.c:5"));
+    jpLog__info(&callSite, "src/a.c", "f", 5, "site");
+    jpLog__info(&callSite, "src/a.c", "f", 5, "site");
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: site\n") == 2);
+
+    // Another process's changes are picked up by the next check
+    jpTest_check(jpLog_clearControl(JP_LOGTEST_CONTROL, "a.c"));
+    jpTest_check(!jpLog__enabled(JP_LOG_INFO));
+    jpTest_check(write(fds[1], &go, 1) == 1);
+    close(fds[1]);
+    jpTest_check(pid > 0 && waitpid(pid, NULL, 0) == pid);
+    for (i = 0; i < 200 && !jpLog__enabled(JP_LOG_INFO); ++i) {
+        nanosleep(&pause, NULL);
+    }
+    jpLogTest__outputLength = 0;
+    jpLog__info(NULL, "src/a.c", "f", 4, "file");
+    jpLog__info(NULL, "src/b.c", "f", 4, "other");
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: other\n") == 1);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "\n") == 1);
+
+    // A rule count garbled by another process is clamped to the rules the
+    // file holds. It follows the magic, generation and level
+    fd = open(JP_LOGTEST_CONTROL, O_WRONLY);
+    jpTest_check(fd >= 0 && pwrite(fd, &garbled, sizeof(garbled), 16)
+            == (ssize_t)sizeof(garbled));
+    close(fd);
+    jpTest_check(jpLog_clearControl(JP_LOGTEST_CONTROL, "b.c"));
+    jpTest_check(!jpLog_clearControl(JP_LOGTEST_CONTROL, "b.c"));
+    jpTest_check(jpLog_clearControl(JP_LOGTEST_CONTROL, NULL));
+
+    // Stopping logs everything again, and other files are not mapped
+    jpLog_setControl(JP_LOGTEST_CONTROL, NULL, JP_LOG_EXIT);
+    jpLog_stopControl();
+    jpLogTest__outputLength = 0;
+    jpLog_info("again");
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "]: again\n") == 1);
+    jpTest_check(!jpLog_readControl(__FILE__, jpLogTest__collect, NULL));
+
+    jpLog_shutdown();
+    remove(JP_LOGTEST_CONTROL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks each overflow policy of an async sink whose writes are
+///         held up
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__overflow(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 1, 1, JP_LOG_DROPNEWEST,
+        JP_LOGTEST_PATH, 0
+    };
+    static char buf[1 << 16];
+    jpLogSinkStats stats;
+    jpLogSink *sink = NULL;
+    pthread_t thread;
+    size_t length = 0;
+    int lines = 0;
+    int i;
+
+    // The queue is as small as allowed, so 1000 lines overflow it
+    jpLogTest__outputLength = 0;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+    jpLogTest__releaseWrites(NULL);
+    jpLog_flush();
+
+    jpLog_getSinkStats(sink, &stats);
+    lines = jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+            "\n");
+    jpTest_check(stats.dropped > 0 && stats.blockedNs == 0);
+    jpTest_check((unsigned long long)lines + stats.dropped == 1001);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "line 0\n") == 1);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "line 999\n") == 0);
+    jpLog_shutdown();
+
+    jpLogTest__outputLength = 0;
+    config.overflow = JP_LOG_DROPOLDEST;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+    jpLogTest__releaseWrites(NULL);
+    jpLog_flush();
+
+    jpLog_getSinkStats(sink, &stats);
+    lines = jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+            "\n");
+    jpTest_check(stats.dropped > 0);
+    jpTest_check((unsigned long long)lines + stats.dropped == 1001);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "held\nline 0\n") == 0);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "line 999\n") == 1);
+    jpLog_shutdown();
+
+    // Spilled lines go to the spill file instead
+    unlink(JP_LOGTEST_PATH);
+    jpLogTest__outputLength = 0;
+    config.overflow = JP_LOG_SPILL;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+    jpLogTest__releaseWrites(NULL);
+    jpLog_flush();
+
+    jpLog_getSinkStats(sink, &stats);
+    lines = jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+            "\n");
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(stats.spilled > 0 && stats.dropped == 0);
+    jpTest_check(jpLogTest__count(buf, length, "\n") == (int)stats.spilled);
+    jpTest_check(lines + (int)stats.spilled == 1001);
+    jpTest_check(jpLogTest__count(buf, length, "line 999\n") == 1);
+    jpLog_shutdown();
+    unlink(JP_LOGTEST_PATH);
+
+    // Without a spill file, the sink cannot be added
+    config.spillPath = NULL;
+    jpTest_check(!jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config));
+
+    // Blocking loses nothing and counts the wait
+    jpLogTest__outputLength = 0;
+    config.overflow = JP_LOG_BLOCK;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    pthread_create(&thread, NULL, jpLogTest__releaseWrites, (void *)20);
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+    pthread_join(thread, NULL);
+    jpLog_flush();
+
+    jpLog_getSinkStats(sink, &stats);
+    jpTest_check(stats.dropped == 0 && stats.spilled == 0);
+    jpTest_check(stats.blockedNs >= 10000000ULL);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "\n") == 1001);
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a sharded sink merges the lines of its threads in
+///         order
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__sharded(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 1, 0, JP_LOG_BLOCK, NULL, 1
+    };
+    const char *expected = "held\nbefore\nfrom thread\nafter\n";
+    pthread_t threads[4];
+    jpLogSinkStats stats;
+    jpLogSink *sink = NULL;
+    const char *line = NULL;
+    const char *end = NULL;
+    int next[4] = { 0, 0, 0, 0 };
+    int thread = 0;
+    int number = 0;
+    int lines = 0;
+    int ok = 1;
+    int i;
+
+    // Lines queued by different threads come out in the order they were
+    // logged, even when they are merged at once
+    jpLogTest__outputLength = 0;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    jpLog_info("before");
+    pthread_create(&threads[0], NULL, jpLogTest__thread, NULL);
+    pthread_join(threads[0], NULL);
+    jpLog_info("after");
+    jpLogTest__releaseWrites(NULL);
+    jpLog_flush();
+
+    jpTest_check(jpLogTest__outputLength == strlen(expected));
+    jpTest_check(!memcmp(jpLogTest__output, expected, strlen(expected)));
+
+    // Nothing is lost, and each thread's lines stay in order
+    jpLogTest__outputLength = 0;
+    for (i = 0; i < 4; ++i) {
+        pthread_create(&threads[i], NULL, jpLogTest__countingThread,
+                (void *)(intptr_t)i);
+    }
+    for (i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    jpLog_flush();
+
+    line = jpLogTest__output;
+    end = jpLogTest__output + jpLogTest__outputLength;
+    while (line < end) {
+        ok &= sscanf(line, "%d %d", &thread, &number) == 2 && thread >= 0
+            && thread < 4 && number == next[thread]++;
+        line = memchr(line, '\n', (size_t)(end - line));
+        line = line ? line + 1 : end;
+        ++lines;
+    }
+
+    jpTest_check(ok);
+    jpTest_check(lines == 4 * 5000);
+    jpLog_getSinkStats(sink, &stats);
+    jpTest_check(stats.dropped == 0 && stats.queueHighWater > 0);
+    jpLog_shutdown();
+
+    // A full shard drops new lines
+    jpLogTest__outputLength = 0;
+    config.queueSize = 1;
+    config.overflow = JP_LOG_DROPNEWEST;
+    sink = jpLog_addSink(jpLogTest__gatedWrite, NULL, NULL, &config);
+    jpLogTest__holdWrites();
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+    jpLogTest__releaseWrites(NULL);
+    jpLog_flush();
+
+    jpLog_getSinkStats(sink, &stats);
+    lines = jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+            "\n");
+    jpTest_check(stats.dropped > 0);
+    jpTest_check((unsigned long long)lines + stats.dropped == 1001);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "line 0\n") == 1);
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that jp_log counts its own work and reports it
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__stats(void)
+{
+    jpLogSinkConfig warn = { JP_LOG_WARN, NULL, 0, 0, JP_LOG_BLOCK, NULL, 0 };
+    jpLogSinkConfig async = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 1, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    static jpLogSiteStats sites[1024];
+    static char buf[1 << 16];
+    struct timespec pause = { 0, 1000000 };
+    jpLogStats before;
+    jpLogStats after;
+    jpLogSinkStats stats;
+    jpLogSink *sink = NULL;
+    size_t length = 0;
+    size_t count = 0;
+    size_t i;
+    int line = 0;
+    int found = 0;
+
+    // Info messages only reach a warn sink as suppressed ones
+    jpLog_getStats(&before);
+    jpLog_addRingSink(4096, &warn);
+    for (i = 0; i < 10; ++i) {
+        jpLog_info("suppressed");
+    }
+    line = __LINE__ + 1;
+    jpLog_warn("counted");
+    for (i = 0; i < 100; ++i) {
+        jpLog_infoSampled(1000000, "sampled");
+    }
+    jpLog_getStats(&after);
+
+    jpTest_check(after.records[JP_LOG_WARN] - before.records[JP_LOG_WARN]
+            == 1);
+    jpTest_check(after.records[JP_LOG_INFO] == before.records[JP_LOG_INFO]);
+    jpTest_check(after.suppressed - before.suppressed >= 10);
+    jpTest_check(after.sampledOut - before.sampledOut >= 97);
+    jpTest_check(after.timeNs == before.timeNs);
+
+    count = jpLog_getSiteStats(sites, sizeof(sites) / sizeof(sites[0]));
+    jpTest_check(count > 0 && count <= sizeof(sites) / sizeof(sites[0]));
+    for (i = 0; i < count; ++i) {
+        found += sites[i].line == line && !strcmp(sites[i].file, __FILE__)
+            && sites[i].level == JP_LOG_WARN && sites[i].records == 1;
+    }
+    jpTest_check(found == 1);
+    jpLog_shutdown();
+
+    // Sink counters are added up, and kept when the sink is removed
+    jpLog_getStats(&before);
+    jpLogTest__outputLength = 0;
+    sink = jpLog_addSink(jpLogTest__collect, NULL, NULL, &async);
+    for (i = 0; i < 100; ++i) {
+        jpLog_info("0123456789");
+    }
+    jpLog_flush();
+    jpLog_getSinkStats(sink, &stats);
+    jpTest_check(stats.bytes == 1100 && stats.bytes == jpLogTest__outputLength);
+    jpTest_check(stats.flushes >= 1);
+    jpTest_check(stats.queueHighWater >= 11 && stats.queueHighWater <= 1100);
+
+    jpLog_getStats(&after);
+    jpTest_check(after.sinks.bytes - before.sinks.bytes == 1100);
+    jpLog_shutdown();
+    jpLog_getStats(&after);
+    jpTest_check(after.sinks.bytes - before.sinks.bytes == 1100);
+
+    // Reports go through the sinks, and any time is over a 1ns budget
+    sink = jpLog_addRingSink(sizeof(buf), NULL);
+    jpTest_check(jpLog_startReport(5, 1));
+    jpTest_check(!jpLog_startReport(5, 1));
+    for (i = 0; i < 2000; ++i) {
+        jpLog_info("busy");
+        nanosleep(&pause, NULL);
+        length = jpLog_readRing(sink, buf, sizeof(buf));
+        if (jpLogTest__count(buf, length, "jp_log over budget")) {
+            break;
+        }
+    }
+    jpLog_stopReport();
+
+    length = jpLog_readRing(sink, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: jp_log report ") > 0);
+    jpTest_check(jpLogTest__count(buf, length, " budget_ns=1\n") > 0);
+    jpLog_getStats(&after);
+    jpTest_check(after.timeNs > before.timeNs);
+
+    // Nothing is timed once reports stop
+    before = after;
+    jpLog_info("untimed");
+    jpLog_getStats(&after);
+    jpTest_check(after.timeNs == before.timeNs);
+    jpTest_check(!jpLog_startReport(0, 0));
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a ring sink keeps only the most recent whole lines
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__ring(void)
+{
+    jpLogSink *ring = jpLog_addRingSink(300, NULL);
+    char buf[300];
+    size_t length = 0;
+    int i;
+
+    for (i = 0; i < 100; ++i) {
+        jpLog_infoFmt("message %d", i);
+    }
+
+    length = jpLog_readRing(ring, buf, sizeof(buf));
+    jpTest_check(length > 0 && length <= 300);
+    jpTest_check(buf[0] == '[' && buf[length - 1] == '\n');
+    jpTest_check(jpLogTest__count(buf, length, "]: message 99\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: message 0\n") == 0);
+
+    // A small buffer gets the most recent lines
+    length = jpLog_readRing(ring, buf, 100);
+    jpTest_check(length > 0 && length <= 100);
+    jpTest_check(buf[0] == '[');
+    jpTest_check(jpLogTest__count(buf, length, "]: message 99\n") == 1);
+
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that an async file sink writes everything in order
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__asyncFile(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, NULL, 1, 4096, JP_LOG_BLOCK, NULL, 0
+    };
+    char expected[64];
+    char *buf = NULL;
+    size_t length = 0;
+    const char *at = NULL;
+    int ok = 1;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, &config, NULL));
+
+    // More than fits in the queue, so producers have to wait for the thread
+    for (i = 0; i < 1000; ++i) {
+        jpLog_infoFmt("line %d", i);
+    }
+
+    // Each line holds __FILE__, so the output is as long as its path makes it
+    jpLog_flush();
+    buf = jpLogTest__load(JP_LOGTEST_PATH, &length);
+    jpTest_check(jpLogTest__count(buf, length, "\n") == 1000);
+
+    for (i = 0, at = buf; i < 1000 && at; ++i) {
+        snprintf(expected, sizeof(expected), "]: line %d\n", i);
+        at = strstr(at, expected);
+        ok &= at != NULL;
+    }
+
+    jpTest_check(ok);
+    jpLog_shutdown();
+    free(buf);
+
+    // Shutting down writes whatever is still queued
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, &config, NULL));
+    jpLog_warn("last");
+    jpLog_shutdown();
+    buf = jpLogTest__load(JP_LOGTEST_PATH, &length);
+    jpTest_check(jpLogTest__count(buf, length, "]: last\n") == 1);
+    free(buf);
+
+    remove(JP_LOGTEST_PATH);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that timed blocks add up across threads into percentiles,
+///         and are reported
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__timers(void)
+{
+    jpLogTimerStats timers[64];
+    jpLogTimerStats *work = NULL;
+    struct timespec pause = { 0, 100000000 };
+    jpLogSink *ring = jpLog_addRingSink(8192, NULL);
+    pthread_t thread;
+    char buf[8192];
+    size_t length = 0;
+    size_t count = 0;
+    size_t i;
+
+    // 90% short, 10% long
+    pthread_create(&thread, NULL, jpLogTest__timingThread, NULL);
+    for (i = 0; i < 90; ++i) {
+        jpLogTest__timedWork(i < 40 ? 20000 : i < 76 ? 40000 : 400000);
+    }
+    pthread_join(thread, NULL);
+
+    count = jpLog_getTimerStats(timers, sizeof(timers) / sizeof(timers[0]));
+    for (i = 0; i < count; ++i) {
+        work = !strcmp(timers[i].name, "work") ? &timers[i] : work;
+    }
+
+    jpTest_check(work && work->count == 140 && work->line > 0);
+    jpTest_check(work && !strcmp(work->file, __FILE__)
+            && !strcmp(work->func, "jpLogTest__timedWork"));
+    jpTest_check(work && work->p50 >= 20000 && work->p50 <= work->p90
+            && work->p90 <= work->p99 && work->p99 <= work->max);
+    jpTest_check(work && work->p99 >= 400000);
+
+    // Only the first report has times since the last one
+    jpTest_check(jpLog_startReport(20, 0));
+    nanosleep(&pause, NULL);
+    jpLog_stopReport();
+
+    length = jpLog_readRing(ring, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: jp_log timer ") == 1);
+    jpTest_check(jpLogTest__count(buf, length, " timer=work ") == 1);
+    jpTest_check(jpLogTest__count(buf, length, " count=140 p50_ns=") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: jp_log report ") >= 2);
+    jpLog_shutdown();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a compressed file reads back the same as a plain one
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__compress(void)
+{
+    jpLogFileConfig fileConfig = { 1, 4096, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    static char plain[1 << 20];
+    size_t plainLength = 0;
+    struct stat info;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".lz");
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".lz", NULL, &fileConfig));
+
+    for (i = 0; i < 5000; ++i) {
+        jpLog_infoFmt("request %d took %d us", i, (i * 7919) % 1000);
+    }
+
+    jpLog_flush();
+
+    // Plain and compressed output cannot be mixed
+    jpTest_check(!jpLog_addFileSink(JP_LOGTEST_PATH, NULL, &fileConfig));
+    jpTest_check(!jpLog_addFileSink(JP_LOGTEST_PATH ".lz", NULL, NULL));
+
+    jpLog_warn("after flush");
+    jpLog_shutdown();
+
+    plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain, sizeof(plain));
+    jpTest_check(!stat(JP_LOGTEST_PATH ".lz", &info));
+    jpTest_check((size_t)info.st_size * 4 < plainLength);
+
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".lz", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, plainLength));
+
+    // Plain files read back as they are
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH, jpLogTest__collect, NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+
+    // A truncated file reads up to its last complete block
+    jpTest_check(!truncate(JP_LOGTEST_PATH ".lz", info.st_size / 2));
+    jpLogTest__outputLength = 0;
+    jpTest_check(!jpLog_readFile(JP_LOGTEST_PATH ".lz", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength > 0);
+    jpTest_check(jpLogTest__outputLength % 4096 == 0);
+    jpTest_check(!memcmp(jpLogTest__output, plain, jpLogTest__outputLength));
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".lz");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the wall clock time in nanoseconds since the epoch
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long jpLogTest__wallTime(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL
+        + (unsigned long long)now.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that queries on an indexed file skip the blocks that
+///         cannot match and find the lines that do
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__index(void)
+{
+    jpLogSinkConfig sharded = { JP_LOG_INFO, NULL, 1, 0, JP_LOG_BLOCK, NULL,
+        1 };
+    jpLogSinkConfig spill = { JP_LOG_INFO, NULL, 1, 0, JP_LOG_SPILL,
+        JP_LOGTEST_PATH ".spill", 0 };
+    jpLogFileConfig fileConfig = { 0, 4096, 0, 0, 0, 0, 0, 0, 0, 1, 0 };
+    static char plain[1 << 20];
+    jpLogQueryStats stats;
+    jpLogQuery query;
+    size_t plainLength = 0;
+    unsigned long long middle = 0;
+    int warnLine = 0;
+    struct stat info;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".ix");
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".ix", &sharded,
+                &fileConfig));
+    jpTest_check(!jpLog_addFileSink(JP_LOGTEST_PATH ".spill", &spill,
+                &fileConfig));
+
+    for (i = 0; i < 5000; ++i) {
+        if (i == 2500) {
+            jpLog_flush();
+            middle = jpLogTest__wallTime();
+        }
+        if (i % 100 == 0) {
+            warnLine = __LINE__; jpLog_warnFmt("request %d failed", i);
+        }
+        jpLog_infoFmt("request %d took %d us", i, (i * 7919) % 1000);
+    }
+
+    jpLog_shutdown();
+
+    // Indexed files read back like any other
+    plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain, sizeof(plain));
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".ix", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, plainLength));
+
+    // Everything matches an empty query
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", NULL,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(stats.blocks > 10 && !stats.skipped);
+    jpTest_check(stats.lines == 5050 && stats.matched == 5050);
+
+    // Blocks without warnings are skipped
+    memset(&query, 0, sizeof(query));
+    query.levels = 1 << JP_LOG_WARN;
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(stats.matched == 50 && stats.skipped > 0);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "[WARN]") == 50);
+
+    // So are blocks without the call site
+    memset(&query, 0, sizeof(query));
+    query.file = "jp_log_test.c";
+    query.line = warnLine;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(stats.matched == 50 && stats.skipped > 0);
+
+    query.line = warnLine + 1000;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(!stats.matched && stats.skipped == stats.blocks);
+
+    query.file = "other.c";
+    query.line = 0;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(!stats.matched && stats.skipped == stats.blocks);
+
+    // And blocks outside the time range
+    memset(&query, 0, sizeof(query));
+    query.levels = 1 << JP_LOG_INFO;
+    query.since = middle;
+    query.times = 1;
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(stats.matched == 2500 && stats.skipped > 0);
+    jpTest_check(jpLogTest__count(jpLogTest__output, jpLogTest__outputLength,
+                "Z [INFO]") == 2500);
+    jpTest_check(!memcmp(jpLogTest__output, "20", 2));
+
+    query.until = middle - 1;
+    jpTest_check(jpLog_queryFile(JP_LOGTEST_PATH ".ix", &query,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(!stats.matched && stats.skipped == stats.blocks);
+
+    // Only indexed files can be queried
+    jpTest_check(!jpLog_queryFile(JP_LOGTEST_PATH, NULL, jpLogTest__collect,
+                NULL, NULL));
+
+    // A truncated file is queried up to its last complete block
+    jpTest_check(!stat(JP_LOGTEST_PATH ".ix", &info));
+    jpTest_check(!truncate(JP_LOGTEST_PATH ".ix", info.st_size / 2));
+    jpLogTest__outputLength = 0;
+    jpTest_check(!jpLog_queryFile(JP_LOGTEST_PATH ".ix", NULL,
+                jpLogTest__collect, NULL, &stats));
+    jpTest_check(stats.matched > 0 && stats.matched < 5050);
+    jpTest_check(!memcmp(jpLogTest__output, plain, jpLogTest__outputLength));
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".ix");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that dictionary files read back as the lines they hold,
+///         in a fraction of the size of plain ones
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__dictionary(void)
+{
+    jpLogSinkConfig sharded = { JP_LOG_INFO, NULL, 1, 0, JP_LOG_BLOCK, NULL,
+        1 };
+    jpLogSinkConfig spill = { JP_LOG_INFO, NULL, 1, 0, JP_LOG_SPILL,
+        JP_LOGTEST_PATH ".spill", 0 };
+    jpLogFileConfig dictionary = { 0, 4096, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    jpLogFileConfig both = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1 };
+    static char plain[1 << 20];
+    size_t plainLength = 0;
+    struct stat info;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".dc");
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".dc", &sharded,
+                &dictionary));
+    jpTest_check(!jpLog_addFileSink(JP_LOGTEST_PATH ".spill", &spill,
+                &dictionary));
+    jpTest_check(!jpLog_addFileSink(JP_LOGTEST_PATH ".spill", NULL, &both));
+
+    // Split messages, messages kept whole and messages that are their own
+    // format string, with fields and thread details after them
+    jpLog_setThreadName("dict");
+    jpLog_setRecordInfo(JP_LOG_THREADID | JP_LOG_THREADNAME);
+    for (i = 0; i < 2000; ++i) {
+        jpLog_infoFmt("request %d took %zu us, %d%% of %s", i,
+                (size_t)(i * 7919) % 1000, i % 100, "budget");
+        if (i % 100 == 0) {
+            jpLog_warnFmt("request %d failed: %s", i, "timeout");
+            jpLog_infoFmt("%5d padded", i);
+            jpLog_infoFmt("%s", i % 200 ? "100% sure" : "no conversions");
+            jpLog_infoKV("served", jpLog_int("status", 200 + i % 3));
+            jpLog_info("tick");
+            jpLog_infoFmt("%g ms", i / 8.0);
+        }
+    }
+    jpLog_setRecordInfo(0);
+    jpLog_shutdown();
+
+    plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain, sizeof(plain));
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".dc", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, plainLength));
+
+    jpTest_check(!stat(JP_LOGTEST_PATH ".dc", &info));
+    jpTest_check(info.st_size * 5 < (off_t)plainLength);
+
+    // Another run appends its own definitions, which replace the first's
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".dc", NULL, &dictionary));
+    jpLog_warnFmt("run %d", 2);
+    jpLog_infoFmt("request %d took %zu us, %d%% of %s", 1, (size_t)2, 3, "x");
+    jpLog_shutdown();
+
+    plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain, sizeof(plain));
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".dc", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, plainLength));
+
+    // A truncated file is read up to its last complete block
+    jpTest_check(!stat(JP_LOGTEST_PATH ".dc", &info));
+    jpTest_check(!truncate(JP_LOGTEST_PATH ".dc", info.st_size / 2));
+    jpLogTest__outputLength = 0;
+    jpTest_check(!jpLog_readFile(JP_LOGTEST_PATH ".dc", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength > 0
+            && jpLogTest__outputLength < plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, jpLogTest__outputLength));
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".dc");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that file sinks writing through io_uring or with O_DIRECT
+///         write the same as a plain one
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__uring(void)
+{
+    jpLogFileConfig uring = { 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+    jpLogFileConfig direct = { 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0 };
+    jpLogFileConfig both = { 1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    static char plain[1 << 20];
+    static char buf[1 << 20];
+    size_t plainLength = 0;
+    size_t length = 0;
+    FILE *file = NULL;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".uring");
+    remove(JP_LOGTEST_PATH ".direct");
+    remove(JP_LOGTEST_PATH ".lz");
+
+    // Existing output is kept, even when it does not end on a whole block
+    file = fopen(JP_LOGTEST_PATH ".direct", "w");
+    jpTest_check(file && fputs("existing\n", file) >= 0);
+    jpTest_check(file && !fclose(file));
+
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, NULL, NULL));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".uring", NULL, &uring));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".direct", NULL,
+                &direct));
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH ".lz", NULL, &both));
+
+    // Enough output to go through every buffer a few times, with flushes
+    // leaving partial blocks in between
+    for (i = 0; i < 10000; ++i) {
+        jpLog_infoFmt("request %d took %d us", i, (i * 7919) % 1000);
+        if (i % 3000 == 0) {
+            jpLog_flush();
+            plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain,
+                    sizeof(plain));
+            length = jpLogTest__read(JP_LOGTEST_PATH ".uring", buf,
+                    sizeof(buf));
+            jpTest_check(length == plainLength);
+            length = jpLogTest__read(JP_LOGTEST_PATH ".direct", buf,
+                    sizeof(buf));
+            jpTest_check(length == plainLength + 9);
+        }
+    }
+
+    jpLog_warn("last");
+    jpLog_shutdown();
+
+    plainLength = jpLogTest__read(JP_LOGTEST_PATH, plain, sizeof(plain));
+    jpTest_check(plainLength > 4 * 64 * 1024);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH ".uring", buf, sizeof(buf));
+    jpTest_check(length == plainLength && !memcmp(buf, plain, length));
+
+    length = jpLogTest__read(JP_LOGTEST_PATH ".direct", buf, sizeof(buf));
+    jpTest_check(length == plainLength + 9);
+    jpTest_check(!memcmp(buf, "existing\n", 9));
+    jpTest_check(!memcmp(buf + 9, plain, plainLength));
+
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".lz", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == plainLength);
+    jpTest_check(!memcmp(jpLogTest__output, plain, plainLength));
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".uring");
+    remove(JP_LOGTEST_PATH ".direct");
+    remove(JP_LOGTEST_PATH ".lz");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a file sink rotates by size and time, keeping only
+///         the newest rotated files
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__rotate(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 1, 0, JP_LOG_BLOCK, NULL, 0
+    };
+    jpLogFileConfig fileConfig = { 0, 0, 0, 0, 1000, 0, 3, 0, 0, 0, 0 };
+    const char *paths[] = {
+        JP_LOGTEST_PATH ".3", JP_LOGTEST_PATH ".2", JP_LOGTEST_PATH ".1",
+        JP_LOGTEST_PATH
+    };
+    struct timespec pause = { 1, 100000000 };
+    static char buf[1 << 16];
+    char expected[32];
+    size_t length = 0;
+    int ok = 1;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+
+    // Flushes every 20 lines write 200 bytes at a time, so each file gets
+    // 1000 bytes and the last 4 files hold lines 100 to 499
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, &config, &fileConfig));
+    for (i = 0; i < 500; ++i) {
+        jpLog_infoFmt("line %04d", i);
+        if (i % 20 == 19) {
+            jpLog_flush();
+        }
+    }
+    jpLog_shutdown();
+
+    jpTest_check(!jpLogTest__exists(JP_LOGTEST_PATH ".4"));
+    for (i = 0; i < 4; ++i) {
+        length += jpLogTest__read(paths[i], buf + length,
+                sizeof(buf) - length);
+    }
+
+    jpTest_check(length == 4000);
+    for (i = 100; i < 500; ++i) {
+        snprintf(expected, sizeof(expected), "line %04d\n", i);
+        ok &= !memcmp(buf + (i - 100) * 10, expected, 10);
+    }
+    jpTest_check(ok);
+
+    // Rotated files are compressed, and kept up to a number of bytes -
+    // compressed ones counting as such
+    fileConfig.keepFiles = 0;
+    fileConfig.keepBytes = 2500;
+    fileConfig.compressRotated = 1;
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, &config, &fileConfig));
+    jpLog_info("next");
+    jpLog_flush();
+    jpLog_shutdown();
+
+    jpTest_check(!jpLogTest__exists(JP_LOGTEST_PATH ".1"));
+    jpTest_check(jpLogTest__exists(JP_LOGTEST_PATH ".1.lz"));
+    jpTest_check(jpLogTest__exists(JP_LOGTEST_PATH ".2"));
+    jpTest_check(jpLogTest__exists(JP_LOGTEST_PATH ".3"));
+    jpTest_check(!jpLogTest__exists(JP_LOGTEST_PATH ".4"));
+
+    jpLogTest__outputLength = 0;
+    jpTest_check(jpLog_readFile(JP_LOGTEST_PATH ".1.lz", jpLogTest__collect,
+                NULL));
+    jpTest_check(jpLogTest__outputLength == 1000);
+    jpTest_check(!memcmp(jpLogTest__output, "line 0400\n", 10));
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(length == 5 && !memcmp(buf, "next\n", 5));
+
+    // A file rotated by time is not split before the next interval
+    remove(JP_LOGTEST_PATH ".1.lz");
+    remove(JP_LOGTEST_PATH ".2");
+    remove(JP_LOGTEST_PATH ".3");
+    fileConfig.rotateBytes = 0;
+    fileConfig.rotateSeconds = 1;
+    fileConfig.compressRotated = 0;
+    jpTest_check(jpLog_addFileSink(JP_LOGTEST_PATH, &config, &fileConfig));
+    nanosleep(&pause, NULL);
+    jpLog_info("later");
+    jpLog_flush();
+    jpLog_shutdown();
+
+    length = jpLogTest__read(JP_LOGTEST_PATH ".1", buf, sizeof(buf));
+    jpTest_check(length == 5 && !memcmp(buf, "next\n", 5));
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(length == 6 && !memcmp(buf, "later\n", 6));
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_PATH ".1");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a socket sink sends to a listening collector
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__socket(void)
+{
+    jpLogSinkConfig config = { JP_LOG_WARN, NULL, 1, 0, JP_LOG_BLOCK, NULL, 0 };
+    struct sockaddr_un addr;
+    char buf[4096];
+    size_t length = 0;
+    ssize_t received = 0;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    int peer = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, JP_LOGTEST_SOCKET);
+    remove(JP_LOGTEST_SOCKET);
+
+    jpTest_check(listener >= 0);
+    jpTest_check(!bind(listener, (struct sockaddr *)&addr, sizeof(addr)));
+    jpTest_check(!listen(listener, 1));
+    jpTest_check(jpLog_addSocketSink(JP_LOGTEST_SOCKET, &config));
+
+    jpLog_info("not sent");
+    jpLog_warn("sent");
+    jpLog_shutdown();
+
+    peer = accept(listener, NULL, NULL);
+    jpTest_check(peer >= 0);
+    while ((received = read(peer, buf + length, sizeof(buf) - length)) > 0) {
+        length += (size_t)received;
+    }
+
+    jpTest_check(jpLogTest__count(buf, length, "\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[WARN]") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: sent\n") == 1);
+
+    close(peer);
+    close(listener);
+    remove(JP_LOGTEST_SOCKET);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that threads log from what jpLog_preallocate set up, in a
+///         child process since steady state cannot be undone
+///
+/// Built with -DJP_LOG_DEBUGALLOC, the child aborts if a logging call
+/// allocates.
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__steady(void)
+{
+    jpLogSinkConfig config = {
+        JP_LOG_INFO, jpLogTest__formatMsg, 1, 0, JP_LOG_BLOCK, NULL, 1
+    };
+    static char buf[1 << 18];
+    static char big[8192];
+    pthread_t threads[4];
+    jpLogStats before;
+    jpLogStats after;
+    const char *line = NULL;
+    size_t length = 0;
+    int status = 0;
+    pid_t pid;
+    int i;
+
+    remove(JP_LOGTEST_PATH);
+    memset(big, 'x', sizeof(big) - 1);
+
+    pid = fork();
+    if (!pid) {
+        jpLog_addFileSink(JP_LOGTEST_PATH, &config, NULL);
+        jpLog_startRecorder(16, STDERR_FILENO);
+        if (!jpLog_preallocate(5)) {
+            _exit(1);
+        }
+
+        jpLog_getStats(&before);
+        for (i = 0; i < 4; ++i) {
+            pthread_create(&threads[i], NULL, jpLogTest__countingThread,
+                    (void *)(intptr_t)i);
+        }
+        for (i = 0; i < 4; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        // Too long for the buffers, so it is truncated
+        jpLog_infoFmt("%s", big);
+        jpLog_getStats(&after);
+        jpLog_shutdown();
+
+        _exit(after.records[JP_LOG_INFO] - before.records[JP_LOG_INFO]
+                == 4 * 5000 + 1 ? 0 : 2);
+    }
+
+    jpTest_check(pid > 0 && waitpid(pid, &status, 0) == pid);
+    jpTest_check(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(length < sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "\n") == 4 * 5000 + 1);
+
+    line = strchr(buf, 'x');
+    jpTest_check(line && strspn(line, "x") > 1000
+            && strspn(line, "x") < sizeof(big) - 1);
+
+    remove(JP_LOGTEST_PATH);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that jpLog_exit writes queued output before exiting
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__exit(void)
+{
+    jpLogSinkConfig config = { JP_LOG_INFO, NULL, 1, 0, JP_LOG_BLOCK, NULL, 0 };
+    char buf[4096];
+    size_t length = 0;
+    int status = 0;
+    pid_t pid;
+
+    remove(JP_LOGTEST_PATH);
+
+    pid = fork();
+    if (!pid) {
+        jpLog_addFileSink(JP_LOGTEST_PATH, &config, NULL);
+        jpLog_info("before");
+        jpLog_exit("fatal");
+    }
+
+    jpTest_check(pid > 0 && waitpid(pid, &status, 0) == pid);
+    jpTest_check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: before\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[EXIT]") == 1);
+
+    remove(JP_LOGTEST_PATH);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that the flight recorder is dumped by jpLog_exit and on
+///         fatal signals
+///////////////////////////////////////////////////////////////////////////////
+static void jpLogTest__recorder(void)
+{
+    char buf[8192];
+    size_t length = 0;
+    int status = jpLogTest__runRecorder(0, 0);
+
+    jpTest_check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "flight recorder") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "-- thread ") == 2);
+    jpTest_check(jpLogTest__count(buf, length, "]: info ") == 2);
+    jpTest_check(jpLogTest__count(buf, length, "]: info 8\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: info 9\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "][12345]: long names\n")
+            == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[EXIT]") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: fatal\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: from thread\n") == 1);
+
+    status = jpLogTest__runRecorder(1, 0);
+    jpTest_check(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "flight recorder") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: info 9\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: from thread\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "[EXIT]") == 0);
+
+    // Info turned off by the level control file is recorded all the same
+    status = jpLogTest__runRecorder(0, 1);
+    jpTest_check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE);
+
+    length = jpLogTest__read(JP_LOGTEST_PATH, buf, sizeof(buf));
+    jpTest_check(jpLogTest__count(buf, length, "]: info 8\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: info 9\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: from thread\n") == 1);
+    jpTest_check(jpLogTest__count(buf, length, "]: fatal\n") == 1);
+
+    remove(JP_LOGTEST_PATH);
+    remove(JP_LOGTEST_CONTROL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+    jpTest_run(jpLogTest__levels);
+    jpTest_run(jpLogTest__ring);
+    jpTest_run(jpLogTest__fields);
+    jpTest_run(jpLogTest__format);
+    jpTest_run(jpLogTest__types);
+    jpTest_run(jpLogTest__sampled);
+    jpTest_run(jpLogTest__control);
+    jpTest_run(jpLogTest__threadInfo);
+    jpTest_run(jpLogTest__spans);
+    jpTest_run(jpLogTest__asyncFile);
+    jpTest_run(jpLogTest__overflow);
+    jpTest_run(jpLogTest__sharded);
+    jpTest_run(jpLogTest__stats);
+    jpTest_run(jpLogTest__timers);
+    jpTest_run(jpLogTest__compress);
+    jpTest_run(jpLogTest__index);
+    jpTest_run(jpLogTest__dictionary);
+    jpTest_run(jpLogTest__uring);
+    jpTest_run(jpLogTest__rotate);
+    jpTest_run(jpLogTest__socket);
+    jpTest_run(jpLogTest__steady);
+    jpTest_run(jpLogTest__exit);
+    jpTest_run(jpLogTest__recorder);
+
+    return jpTest_result();
+}
@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_test.h
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Shared checks for the tests
+///
+/// Each test program includes this header once, runs its tests with
+/// jpTest_run and returns jpTest_result() from main.
+///////////////////////////////////////////////////////////////////////////////
+#ifndef JPA__TEST_H
+#define JPA__TEST_H
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Globals
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Number of checks that failed so far
+///////////////////////////////////////////////////////////////////////////////
+static int jpTest__failures = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Macros
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Reports a failure if expr is false
+///
+/// @param expr Expression to test
+///////////////////////////////////////////////////////////////////////////////
+#define jpTest_check(expr)\
+    ( (expr) ? (void)0 : (void)(++jpTest__failures,\
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,\
+            #expr)) )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Runs a test function taking no arguments
+///
+/// @param test The test function
+///////////////////////////////////////////////////////////////////////////////
+#define jpTest_run(test)\
+    ( fprintf(stderr, "%s\n", #test), test() )
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Reports the number of failed checks
+///
+/// @return EXIT_SUCCESS if no check failed, EXIT_FAILURE otherwise
+///////////////////////////////////////////////////////////////////////////////
+#define jpTest_result()\
+    ( jpTest__failures ? (fprintf(stderr, "%d checks failed\n",\
+            jpTest__failures), EXIT_FAILURE) : EXIT_SUCCESS )
+
+// JPA__TEST_H
+#endif
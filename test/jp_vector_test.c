@@ -0,0 +1,355 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_vector_test.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Tests for jpVector
+///
+/// Build and run from the repository root with:
+///
+///     cc -O2 -std=c99 -I. -o jp_vector_test test/jp_vector_test.c jp_vector.c
+///     ./jp_vector_test
+///////////////////////////////////////////////////////////////////////////////
+#define _POSIX_C_SOURCE 200809L
+#define JP_VECTOR_MMAP
+#define JP_VECTOR_SHRINKDIV     (4)
+#define JP_VECTOR_STATS
+
+#include "jp_vector.h"
+#include "test/jp_test.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Defines
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Path of the file written by the tests
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTORTEST_PATH      "jp_vector_test.bin"
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief Offset of the length field in the header of a jpVector file
+///////////////////////////////////////////////////////////////////////////////
+#define JP_VECTORTEST_LENGTH    (24)
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Overwrites part of the file written by the tests
+///
+/// @param	offset  Offset of the bytes to overwrite
+/// @param	data    The new bytes
+/// @param	size    Number of bytes
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__patch(long offset, const void *data, size_t size)
+{
+    FILE *file = fopen(JP_VECTORTEST_PATH, "r+b");
+
+    jpTest_check(file);
+    jpTest_check(!fseek(file, offset, SEEK_SET));
+    jpTest_check(fwrite(data, size, 1, file) == 1);
+    jpTest_check(!fclose(file));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes a jpVector of n doubles to the file written by the tests
+///
+/// @param	n   Number of elements
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__save(size_t n)
+{
+    jpVector(double) vec;
+    size_t i;
+
+    jpVector_create(vec);
+    for (i = 0; i < n; ++i) {
+        jpVector_push(vec, i * 0.5);
+    }
+
+    jpTest_check(jpVector_save(vec, JP_VECTORTEST_PATH));
+    jpVector_destroy(vec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that push, pop, erase and at keep the elements in order
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__basics(void)
+{
+    jpVector(int) vec;
+    int i;
+
+    jpVector_create(vec);
+    jpTest_check(vec.data && jpVector_max(vec) == JP_VECTOR_BASESIZE);
+
+    for (i = 0; i < 100; ++i) {
+        jpVector_push(vec, i);
+    }
+
+    jpTest_check(jpVector_length(vec) == 100);
+    jpTest_check(jpVector_max(vec) >= 100);
+    jpTest_check(jpVector_at(vec, 0) == 0 && jpVector_at(vec, 99) == 99);
+    jpTest_check(!jpVector_isMapped(vec));
+
+    jpTest_check(jpVector_pop(vec) == 99 && jpVector_length(vec) == 99);
+    jpTest_check(jpVector_pop(vec) == 98 && jpVector_length(vec) == 98);
+
+    jpVector_erase(vec, 0);
+    jpTest_check(jpVector_length(vec) == 97 && jpVector_at(vec, 0) == 1);
+
+    jpVector_destroy(vec);
+    jpTest_check(!vec.data);
+
+    // Erasing from a full jpVector must not read past its allocation
+    jpVector_create(vec);
+    jpVector_push(vec, 1);
+    jpVector_push(vec, 2);
+    jpTest_check(jpVector_length(vec) == jpVector_max(vec));
+    jpVector_erase(vec, 0);
+    jpTest_check(jpVector_length(vec) == 1 && jpVector_at(vec, 0) == 2);
+    jpVector_destroy(vec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that jpVector_shrinkToFit and automatic shrinking keep the
+///         elements
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__shrink(void)
+{
+    jpVector(int) vec;
+    size_t max;
+    int ok = 1;
+    int i;
+
+    jpVector_create(vec);
+    for (i = 0; i < 1000; ++i) {
+        jpVector_push(vec, i);
+    }
+
+    jpVector_shrinkToFit(vec);
+    jpTest_check(jpVector_max(vec) == 1000);
+    jpVector_shrinkToFit(vec);
+    jpTest_check(jpVector_max(vec) == 1000);
+
+    // Popping below a quarter of the max halves it
+    max = jpVector_max(vec);
+    while (jpVector_length(vec) >= max / 4) {
+        i = jpVector_pop(vec);
+        ok &= i == (int)jpVector_length(vec);
+    }
+
+    jpTest_check(ok);
+
+    jpTest_check(jpVector_max(vec) == max / 2);
+
+    // Erasing shrinks as well, down to JP_VECTOR_BASESIZE
+    while (jpVector_length(vec) > 1) {
+        jpVector_erase(vec, 0);
+        jpTest_check(jpVector_max(vec) >= jpVector_length(vec));
+    }
+
+    jpTest_check(jpVector_max(vec) < 8);
+    jpTest_check(jpVector_max(vec) >= JP_VECTOR_BASESIZE);
+    jpTest_check(jpVector_at(vec, 0) == (int)(max / 4) - 2);
+
+    jpVector_destroy(vec);
+
+    // shrinkToFit never goes below JP_VECTOR_BASESIZE
+    jpVector_create(vec);
+    jpVector_shrinkToFit(vec);
+    jpTest_check(jpVector_max(vec) == JP_VECTOR_BASESIZE);
+
+    for (i = 0; i < 10; ++i) {
+        jpVector_push(vec, i);
+    }
+
+    jpVector_erase(vec, 9);
+    jpVector_shrinkToFit(vec);
+    jpTest_check(jpVector_max(vec) == 9);
+
+    for (i = 0; i < 9; ++i) {
+        ok &= jpVector_at(vec, i) == i;
+    }
+
+    jpTest_check(ok);
+    jpVector_destroy(vec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that pushing into a reserved jpVector does not expand it
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__reserve(void)
+{
+    jpVector(int) vec;
+    int *data;
+    int i;
+
+    jpVector_create(vec);
+    jpVector_push(vec, -1);
+    jpVector_reserve(vec, 1000);
+    jpTest_check(jpVector_max(vec) == 1000);
+    jpTest_check(jpVector_length(vec) == 1 && jpVector_at(vec, 0) == -1);
+
+    data = jpVector_data(vec);
+    for (i = 1; i < 1000; ++i) {
+        jpVector_push(vec, i);
+    }
+
+    jpTest_check(jpVector_data(vec) == data);
+    jpTest_check(jpVector_max(vec) == 1000);
+
+    // Reserving less than the max does nothing
+    jpVector_reserve(vec, 10);
+    jpTest_check(jpVector_max(vec) == 1000);
+
+    jpVector_destroy(vec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks the memory accounting of JP_VECTOR_STATS
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__stats(void)
+{
+    jpVectorStats before = jpVector_stats();
+    jpVectorStats stats;
+    jpVector(double) a;
+    jpVector(char) b;
+    int i;
+
+    jpVector_create(a);
+    jpVector_create(b);
+    for (i = 0; i < 100; ++i) {
+        jpVector_push(a, i);
+    }
+
+    jpVector_push(b, 'x');
+
+    stats = jpVector_stats();
+    jpTest_check(stats.used - before.used == 100 * sizeof(double) + 1);
+    jpTest_check(stats.allocated - before.allocated
+            == jpVector_max(a) * sizeof(double) + jpVector_max(b));
+    jpTest_check(stats.reallocs > before.reallocs);
+
+    jpVector_shrinkToFit(a);
+    stats = jpVector_stats();
+    jpTest_check(stats.allocated - before.allocated
+            == 100 * sizeof(double) + JP_VECTOR_BASESIZE);
+
+    jpVector_pop(a);
+    stats = jpVector_stats();
+    jpTest_check(stats.used - before.used == 99 * sizeof(double) + 1);
+
+    jpVector_destroy(a);
+    jpVector_destroy(b);
+    stats = jpVector_stats();
+    jpTest_check(stats.allocated == before.allocated);
+    jpTest_check(stats.used == before.used);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that a saved jpVector maps back with the same elements
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__roundTrip(void)
+{
+    jpVector(double) mapped;
+    jpVector(float) other;
+    size_t i;
+    int ok = 1;
+
+    jpVectorTest__save(10000);
+
+    jpTest_check(jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 1));
+    jpTest_check(jpVector_isMapped(mapped));
+    jpTest_check(jpVector_length(mapped) == 10000);
+    jpTest_check(((uintptr_t)jpVector_data(mapped)
+                % JP_VECTOR_FILEALIGN) == 0);
+
+    for (i = 0; i < jpVector_length(mapped); ++i) {
+        ok &= jpVector_at(mapped, i) == i * 0.5;
+    }
+
+    jpTest_check(ok);
+    jpVector_destroy(mapped);
+    jpTest_check(!mapped.data);
+
+    // The element size in the file must match
+    jpTest_check(!jpVector_mapReadOnly(other, JP_VECTORTEST_PATH, 0));
+
+    // An empty jpVector round-trips too
+    jpVectorTest__save(0);
+    jpTest_check(jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 1));
+    jpTest_check(jpVector_length(mapped) == 0);
+    jpVector_destroy(mapped);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Checks that corrupt and truncated files are rejected
+///////////////////////////////////////////////////////////////////////////////
+static void jpVectorTest__corrupt(void)
+{
+    jpVector(double) mapped;
+    uint64_t length = UINT64_MAX / 8;
+    double value = -1.0;
+
+    jpTest_check(!jpVector_mapReadOnly(mapped, "jp_vector_missing.bin", 0));
+
+    // Bad magic
+    jpVectorTest__save(100);
+    jpVectorTest__patch(0, "jpVectoX", 8);
+    jpTest_check(!jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 0));
+
+    // A length that wraps the mapping size
+    jpVectorTest__save(100);
+    jpVectorTest__patch(JP_VECTORTEST_LENGTH, &length, sizeof(length));
+    jpTest_check(!jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 0));
+
+    // A length past the end of the file
+    length = 101;
+    jpVectorTest__save(100);
+    jpVectorTest__patch(JP_VECTORTEST_LENGTH, &length, sizeof(length));
+    jpTest_check(!jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 0));
+
+    // Corrupt data is only caught when verifying
+    jpVectorTest__save(100);
+    jpVectorTest__patch(JP_VECTOR_FILEALIGN + 8, &value, sizeof(value));
+    jpTest_check(!jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 1));
+    jpTest_check(jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 0));
+    jpTest_check(jpVector_at(mapped, 1) == -1.0);
+    jpVector_destroy(mapped);
+
+    // A truncated header
+    jpTest_check(!truncate(JP_VECTORTEST_PATH, 16));
+    jpTest_check(!jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 0));
+
+    // Saving to a missing directory fails, and saving through one syncs it
+    jpTest_check(!jpVector_save(mapped, "jp_vector_missing/x.bin"));
+    jpTest_check(jpVector_save(mapped, "./" JP_VECTORTEST_PATH));
+    jpTest_check(jpVector_mapReadOnly(mapped, JP_VECTORTEST_PATH, 1));
+    jpTest_check(jpVector_length(mapped) == 0);
+    jpVector_destroy(mapped);
+
+    remove(JP_VECTORTEST_PATH);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(void)
+{
+    jpTest_run(jpVectorTest__basics);
+    jpTest_run(jpVectorTest__shrink);
+    jpTest_run(jpVectorTest__reserve);
+    jpTest_run(jpVectorTest__stats);
+    jpTest_run(jpVectorTest__roundTrip);
+    jpTest_run(jpVectorTest__corrupt);
+
+    return jpTest_result();
+}
@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_logdump.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Prints files written by jpLog file sinks as text
+///
+/// Build from the repository root with:
+///
+///     cc -O2 -std=c99 -pthread -I. -o jp_logdump tools/jp_logdump.c jp_log.c
+///
+/// and run as 'jp_logdump file...'. Compressed and indexed files are
+/// decompressed, the lines of dictionary files are put back together from
+/// their format strings and arguments, and plain files are printed as they
+/// are. A truncated file is printed up to its last complete block and
+/// reported on stderr.
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_log.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to stdout
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogDump__write(void *data, const char *buf, size_t length)
+{
+    (void)data;
+    return fwrite(buf, length, 1, stdout) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+    int status = EXIT_SUCCESS;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 1; i < argc; ++i) {
+        if (!jpLog_readFile(argv[i], jpLogDump__write, NULL)) {
+            fprintf(stderr, "%s: %s is truncated, corrupt or unreadable\n",
+                    argv[0], argv[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    return fflush(stdout) ? EXIT_FAILURE : status;
+}
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_loglevel.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Shows or changes the levels a running program logs at
+///
+/// Build from the repository root with:
+///
+///     cc -O2 -std=c99 -pthread -I. -o jp_loglevel tools/jp_loglevel.c jp_log.c
+///
+/// and run on the level control file a program passed to jpLog_startControl
+/// as one of
+///
+///     jp_loglevel file                Print the rules
+///     jp_loglevel file level [site]   Log level (info, warn or exit) and
+///                                     above, everywhere or at site
+///     jp_loglevel file clear [site]   Remove the rule of site, or every rule
+///
+/// where site is a file, by its base name, or a call site as file:line. The
+/// program follows the change within JP_LOG_CONTROLMS milliseconds.
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_log.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to stdout
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogLevel__write(void *data, const char *buf, size_t length)
+{
+    (void)data;
+    return fwrite(buf, length, 1, stdout) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Parses a level given on the command line
+///
+/// @param	str     The level
+/// @param	level   Receives the level
+/// @return	Nonzero on success, zero if str is not a level
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogLevel__parseLevel(const char *str, jpLogLevel *level)
+{
+    static const char *names[JP_LOG_LEVELCOUNT] = { "info", "warn", "exit" };
+    int i;
+
+    for (i = 0; i < JP_LOG_LEVELCOUNT; ++i) {
+        if (!strcmp(str, names[i])) {
+            *level = (jpLogLevel)i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+    jpLogLevel level = JP_LOG_INFO;
+    const char *site = argc > 3 ? argv[3] : NULL;
+    int ok = 0;
+
+    if (argc < 2 || argc > 4 || (argc > 2 && strcmp(argv[2], "clear")
+                && !jpLogLevel__parseLevel(argv[2], &level))) {
+        fprintf(stderr, "usage: %s file [info|warn|exit|clear [file[:line]]]"
+                "\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2) {
+        ok = jpLog_readControl(argv[1], jpLogLevel__write, NULL);
+    }
+    else if (!strcmp(argv[2], "clear")) {
+        ok = jpLog_clearControl(argv[1], site);
+    }
+    else {
+        ok = jpLog_setControl(argv[1], site, level);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "%s: could not %s %s\n", argv[0],
+                argc == 2 ? "read" : "change", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    return fflush(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
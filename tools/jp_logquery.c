@@ -0,0 +1,227 @@
+///////////////////////////////////////////////////////////////////////////////
+/// @file	jp_logquery.c
+/// @author	Jacob Adkins (jpadkins)
+/// @brief	Prints the lines of indexed jpLog files that match a query
+///
+/// Build from the repository root with:
+///
+///     cc -O2 -std=c99 -pthread -I. -o jp_logquery tools/jp_logquery.c jp_log.c
+///
+/// and run as 'jp_logquery [option]... file...' on files written by file
+/// sinks with index set. Only the blocks whose index may hold a match are
+/// decompressed. The options are:
+///
+///     -l level        Lines at level (info, warn or exit) or above
+///     -f file         Lines logged from file, by its base name
+///     -c file:line    Lines logged from a call site
+///     -s time         Lines logged at or after time
+///     -u time         Lines logged at or before time
+///     -t              Prefix each line with its time
+///     -v              Report blocks read and skipped on stderr
+///
+/// Times are UTC, as 2024-01-31T12:00:00 with optional fractions of a second,
+/// or seconds since the epoch.
+///////////////////////////////////////////////////////////////////////////////
+#include "jp_log.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+///////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Private functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Writes output to stdout
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogQuery__write(void *data, const char *buf, size_t length)
+{
+    (void)data;
+    return fwrite(buf, length, 1, stdout) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Returns the number of days from 1970-01-01 to a date
+///
+/// @param	year    The year
+/// @param	month   The month, from 1
+/// @param	day     The day of the month, from 1
+///////////////////////////////////////////////////////////////////////////////
+static long jpLogQuery__days(long year, long month, long day)
+{
+    long era = 0;
+    long dayOfEra = 0;
+
+    // Years start in March, so leap days come last
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    dayOfEra = (year - era * 400) * 365 + (year - era * 400) / 4
+        - (year - era * 400) / 100
+        + (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Parses a time given on the command line
+///
+/// @param	str     The time
+/// @param	time    Receives the time in nanoseconds since the epoch
+/// @return	Nonzero on success, zero if str is not a time
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogQuery__parseTime(const char *str, unsigned long long *time)
+{
+    long year = 0;
+    long month = 0;
+    long day = 0;
+    long hour = 0;
+    long minute = 0;
+    long second = 0;
+    unsigned long long fraction = 0;
+    unsigned long long scale = 1000000000ULL;
+    int length = 0;
+
+    if (sscanf(str, "%4ld-%2ld-%2ldT%2ld:%2ld:%2ld%n", &year, &month, &day,
+                &hour, &minute, &second, &length) == 6) {
+        if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31
+                || hour > 23 || minute > 59 || second > 60) {
+            return 0;
+        }
+        second += ((jpLogQuery__days(year, month, day) * 24 + hour) * 60
+                + minute) * 60;
+    }
+    else if (sscanf(str, "%ld%n", &second, &length) != 1 || second < 0) {
+        return 0;
+    }
+
+    str += length;
+    if (*str == '.') {
+        while (*++str >= '0' && *str <= '9') {
+            scale /= 10;
+            fraction += (unsigned long long)(*str - '0') * scale;
+        }
+    }
+    if (*str == 'Z') {
+        ++str;
+    }
+
+    *time = (unsigned long long)second * 1000000000ULL + fraction;
+    return !*str;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Parses a level given on the command line
+///
+/// @param	str     The level
+/// @param	levels  Receives the bits of the level and the ones above it
+/// @return	Nonzero on success, zero if str is not a level
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogQuery__parseLevel(const char *str, unsigned *levels)
+{
+    static const char *names[JP_LOG_LEVELCOUNT] = { "info", "warn", "exit" };
+    int level;
+
+    for (level = 0; level < JP_LOG_LEVELCOUNT; ++level) {
+        if (!strcmp(str, names[level])) {
+            *levels = (1U << JP_LOG_LEVELCOUNT) - (1U << level);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// @brief	Parses a call site given on the command line
+///
+/// @param	str     The call site, as file:line - cut at the colon
+/// @param	query   Receives the file and line
+/// @return	Nonzero on success, zero if str is not a call site
+///////////////////////////////////////////////////////////////////////////////
+static int jpLogQuery__parseSite(char *str, jpLogQuery *query)
+{
+    char *colon = strrchr(str, ':');
+    char *end = NULL;
+
+    if (!colon || colon == str) {
+        return 0;
+    }
+
+    *colon = '\0';
+    query->file = str;
+    query->line = (int)strtol(colon + 1, &end, 10);
+    return *end == '\0' && query->line > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+    jpLogQueryStats stats;
+    jpLogQuery query;
+    int verbose = 0;
+    int status = EXIT_SUCCESS;
+    int ok = 1;
+    int i;
+
+    memset(&query, 0, sizeof(query));
+
+    for (i = 1; ok && i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "-t")) {
+            query.times = 1;
+        }
+        else if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        }
+        else if (i + 1 == argc) {
+            ok = 0;
+        }
+        else if (!strcmp(argv[i], "-l")) {
+            ok = jpLogQuery__parseLevel(argv[++i], &query.levels);
+        }
+        else if (!strcmp(argv[i], "-f")) {
+            query.file = argv[++i];
+            query.line = 0;
+        }
+        else if (!strcmp(argv[i], "-c")) {
+            ok = jpLogQuery__parseSite(argv[++i], &query);
+        }
+        else if (!strcmp(argv[i], "-s")) {
+            ok = jpLogQuery__parseTime(argv[++i], &query.since);
+        }
+        else if (!strcmp(argv[i], "-u")) {
+            ok = jpLogQuery__parseTime(argv[++i], &query.until);
+        }
+        else {
+            ok = 0;
+        }
+    }
+
+    if (!ok || i == argc) {
+        fprintf(stderr, "usage: %s [-l level] [-f file] [-c file:line] "
+                "[-s time] [-u time] [-t] [-v] file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (; i < argc; ++i) {
+        if (!jpLog_queryFile(argv[i], &query, jpLogQuery__write, NULL,
+                    &stats)) {
+            fprintf(stderr, "%s: %s is not indexed, or is truncated, corrupt "
+                    "or unreadable\n", argv[0], argv[i]);
+            status = EXIT_FAILURE;
+        }
+        if (verbose) {
+            fprintf(stderr, "%s: %llu of %llu blocks skipped, %llu of %llu "
+                    "lines matched\n", argv[i], stats.skipped, stats.blocks,
+                    stats.matched, stats.lines);
+        }
+    }
+
+    return fflush(stdout) ? EXIT_FAILURE : status;
+}